@@ -0,0 +1,168 @@
+/* ============================================================
+ * Description : Tests of the separator sheet barcodes.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "Barcode.h"
+
+#include <QTest>
+
+#include <KSaneWidget>
+
+#include <algorithm>
+#include <string.h>
+
+using namespace KSaneIface;
+
+class BarcodeTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void decode_data();
+    void decode();
+    void decodeNoise();
+    void find_data();
+    void find();
+
+private:
+    static QVector<int> code39Runs(const QString &text, int narrow, int wide);
+    static QByteArray page(const QVector<int> &runs, int width, int height, int barcodeTop, int barcodeHeight);
+};
+
+// Bar and space widths of "*text*", the start and stop character included
+QVector<int> BarcodeTest::code39Runs(const QString &text, int narrow, int wide)
+{
+    static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%*";
+    static const int patterns[] = {
+        0x034, 0x121, 0x061, 0x160, 0x031, 0x130, 0x070, 0x025, 0x124, 0x064,
+        0x109, 0x049, 0x148, 0x019, 0x118, 0x058, 0x00D, 0x10C, 0x04C, 0x01C,
+        0x103, 0x043, 0x142, 0x013, 0x112, 0x052, 0x007, 0x106, 0x046, 0x016,
+        0x181, 0x0C1, 0x1C0, 0x091, 0x190, 0x0D0, 0x085, 0x184, 0x0C4, 0x0A8,
+        0x0A2, 0x08A, 0x02A, 0x094
+    };
+    QVector<int> runs;
+    const QString full = QLatin1Char('*') + text + QLatin1Char('*');
+    for (int c = 0; c < full.size(); ++c) {
+        const int pattern = patterns[strchr(alphabet, full[c].toLatin1()) - alphabet];
+        if (c > 0) {
+            runs.append(narrow);
+        }
+        for (int i = 8; i >= 0; --i) {
+            runs.append((pattern & (1 << i)) ? wide : narrow);
+        }
+    }
+    return runs;
+}
+
+// A white 8 bit gray page with the barcode from x = 50 in the given rows
+QByteArray BarcodeTest::page(const QVector<int> &runs, int width, int height, int barcodeTop, int barcodeHeight)
+{
+    QByteArray data(width * height, char(230));
+    for (int y = barcodeTop; y < barcodeTop + barcodeHeight; ++y) {
+        int x = 50;
+        for (int i = 0; i < runs.size(); ++i) {
+            if (i % 2 == 0) {
+                memset(data.data() + y * width + x, 20, runs[i]);
+            }
+            x += runs[i];
+        }
+    }
+    return data;
+}
+
+void BarcodeTest::decode_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("narrow");
+    QTest::addColumn<int>("wide");
+
+    QTest::newRow("split") << QStringLiteral("SPLIT") << 2 << 5;
+    QTest::newRow("profile") << QStringLiteral("PROFILE-GRAY") << 3 << 7;
+    QTest::newRow("all characters") << QStringLiteral("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%") << 4 << 9;
+}
+
+void BarcodeTest::decode()
+{
+    QFETCH(QString, text);
+    QFETCH(int, narrow);
+    QFETCH(int, wide);
+
+    QVector<int> runs = code39Runs(text, narrow, wide);
+    QCOMPARE(Barcode::decodeCode39(runs), text);
+
+    // read from the other side on a sheet fed upside down
+    std::reverse(runs.begin(), runs.end());
+    QCOMPARE(Barcode::decodeCode39(runs), text);
+
+    // text in front of the start character
+    runs = QVector<int>() << 2 << 3 << 5 << 40;
+    runs += code39Runs(text, narrow, wide);
+    QCOMPARE(Barcode::decodeCode39(runs), text);
+}
+
+void BarcodeTest::decodeNoise()
+{
+    QCOMPARE(Barcode::decodeCode39(QVector<int>()), QString());
+    QCOMPARE(Barcode::decodeCode39(QVector<int>(40, 3)), QString());
+
+    // without the stop character
+    QVector<int> runs = code39Runs(QStringLiteral("SPLIT"), 2, 5);
+    runs.resize(runs.size() - 10);
+    QCOMPARE(Barcode::decodeCode39(runs), QString());
+
+    // the bars are too much alike to tell narrow and wide apart
+    QCOMPARE(Barcode::decodeCode39(code39Runs(QStringLiteral("SPLIT"), 4, 5)), QString());
+}
+
+void BarcodeTest::find_data()
+{
+    QTest::addColumn<int>("barcodeTop");
+    QTest::addColumn<bool>("upsideDown");
+    QTest::addColumn<double>("searchHeight");
+    QTest::addColumn<QString>("text");
+
+    // 300 dpi, one row every 24 pixels is read
+    QTest::newRow("top") << 20 << false << 0.25 << QStringLiteral("SPLIT");
+    QTest::newRow("upside down") << 20 << true << 0.25 << QStringLiteral("SPLIT");
+    QTest::newRow("middle") << 450 << false << 0.25 << QString();
+    QTest::newRow("middle, whole page") << 450 << false << 1.0 << QStringLiteral("SPLIT");
+    QTest::newRow("one row only") << 20 << false << 0.05 << QString();
+}
+
+void BarcodeTest::find()
+{
+    QFETCH(int, barcodeTop);
+    QFETCH(bool, upsideDown);
+    QFETCH(double, searchHeight);
+    QFETCH(QString, text);
+
+    const int width = 600;
+    const int height = 1000;
+    QByteArray data = page(code39Runs(QStringLiteral("SPLIT"), 3, 7), width, height, barcodeTop, 60);
+    if (upsideDown) {
+        std::reverse(data.begin(), data.end());
+    }
+    QCOMPARE(Barcode::findCode39(data, width, height, width, KSaneWidget::FormatGrayScale8, 300, searchHeight), text);
+}
+
+QTEST_GUILESS_MAIN(BarcodeTest)
+
+#include "barcodetest.moc"
@@ -0,0 +1,191 @@
+/* ============================================================
+ * Description : Tests of the file names of the saved pages.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "FileNamer.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTest>
+
+class FileNamerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void expand_data();
+    void expand();
+    void reserve();
+    void reserveTemplated();
+    void suggest();
+    void release();
+
+private:
+    static FileNamer::Fields fields(const QString &prefix, const QDate &date = QDate(2019, 3, 13));
+};
+
+FileNamer::Fields FileNamerTest::fields(const QString &prefix, const QDate &date)
+{
+    FileNamer::Fields fields;
+    fields.prefix = prefix;
+    fields.device = QStringLiteral("pixma:04A9/1912");
+    fields.profile = QStringLiteral("Color documents");
+    fields.page = 7;
+    fields.time = QDateTime(date, QTime(14, 25, 1));
+    return fields;
+}
+
+void FileNamerTest::expand_data()
+{
+    QTest::addColumn<QString>("nameTemplate");
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<bool>("numbersOnly");
+
+    QTest::newRow("default") << QString() << QStringLiteral("Image-0042.png") << true;
+    QTest::newRow("no number") << QStringLiteral("{prefix}") << QStringLiteral("Image-0042.png") << true;
+    QTest::newRow("width") << QStringLiteral("scan_{n}_{n:6}") << QStringLiteral("scan_42_000042.png") << true;
+    QTest::newRow("time") << QStringLiteral("{date}_{time}_{n:2}") << QStringLiteral("2019-03-13_142501_42.png") << false;
+    QTest::newRow("device and profile") << QStringLiteral("{device}-{profile}-{n}") << QStringLiteral("pixma_04A9_1912-Color_documents-42.png") << false;
+    QTest::newRow("page") << QStringLiteral("{prefix}{page:3}-{n}") << QStringLiteral("Image-007-42.png") << false;
+    QTest::newRow("unknown field") << QStringLiteral("{prefix}{foo}{n}") << QStringLiteral("Image-{foo}42.png") << false;
+}
+
+void FileNamerTest::expand()
+{
+    QFETCH(QString, nameTemplate);
+    QFETCH(QString, name);
+    QFETCH(bool, numbersOnly);
+
+    FileNamer namer;
+    namer.setTemplate(nameTemplate);
+    QCOMPARE(namer.expand(fields(QStringLiteral("Image-")), QStringLiteral("png"), 42), name);
+    QCOMPARE(namer.numbersOnly(), numbersOnly);
+}
+
+void FileNamerTest::reserve()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    FileNamer namer;
+    int number = 0;
+    QString error;
+
+    QCOMPARE(namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number, &error),
+             QDir(dir.path()).filePath(QStringLiteral("Image-0001.png")));
+    QCOMPARE(number, 1);
+    QVERIFY(QFileInfo::exists(dir.path() + QStringLiteral("/Image-0001.png")));
+    QVERIFY(QFileInfo::exists(dir.path() + QStringLiteral("/.skanlite-counters")));
+
+    // a name taken by someone else is skipped
+    QFile other(dir.path() + QStringLiteral("/Image-0003.png"));
+    QVERIFY(other.open(QIODevice::WriteOnly));
+    other.close();
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number, &error);
+    QCOMPARE(number, 2);
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number, &error);
+    QCOMPARE(number, 4);
+
+    // the start number of {prefix}{n} is followed when it is higher than the counter
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 10, &number, &error);
+    QCOMPARE(number, 10);
+
+    // every prefix and suffix has its own counter
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Scan-")), 1, &number, &error);
+    QCOMPARE(number, 1);
+    namer.reserve(dir.path(), QStringLiteral("jpg"), fields(QStringLiteral("Image-")), 1, &number, &error);
+    QCOMPARE(number, 1);
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number, &error);
+    QCOMPARE(number, 11);
+    QVERIFY(error.isEmpty());
+
+    const QString missing = dir.path() + QStringLiteral("/missing");
+    QVERIFY(namer.reserve(missing, QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number, &error).isEmpty());
+    QVERIFY(!error.isEmpty());
+}
+
+void FileNamerTest::reserveTemplated()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    FileNamer namer;
+    namer.setTemplate(QStringLiteral("{date}-{n:2}"));
+    int number = 0;
+    const QDate first(2019, 3, 13);
+    const QDate second(2019, 3, 14);
+
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QString(), first), 1, &number);
+    QCOMPARE(number, 1);
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QString(), first), 1, &number);
+    QCOMPARE(number, 2);
+
+    // a new date starts at the start number again
+    QCOMPARE(namer.reserve(dir.path(), QStringLiteral("png"), fields(QString(), second), 1, &number),
+             QDir(dir.path()).filePath(QStringLiteral("2019-03-14-01.png")));
+    QCOMPARE(number, 1);
+
+    // and the start number does not push on the counter of a date
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QString(), first), 2, &number);
+    QCOMPARE(number, 3);
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QString(), second), 5, &number);
+    QCOMPARE(number, 2);
+}
+
+void FileNamerTest::suggest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    FileNamer namer;
+    int number = 0;
+
+    // nothing is created, neither the image nor the counters
+    const QString name = namer.suggest(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 5, &number);
+    QCOMPARE(name, QDir(dir.path()).filePath(QStringLiteral("Image-0005.png")));
+    QCOMPARE(number, 5);
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files | QDir::Hidden).isEmpty());
+
+    namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 5, &number);
+    namer.suggest(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, &number);
+    QCOMPARE(number, 6);
+}
+
+void FileNamerTest::release()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    FileNamer namer;
+    const QString empty = namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, nullptr);
+    const QString saved = namer.reserve(dir.path(), QStringLiteral("png"), fields(QStringLiteral("Image-")), 1, nullptr);
+    QFile file(saved);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("data");
+    file.close();
+
+    FileNamer::release(empty);
+    FileNamer::release(saved);
+    QVERIFY(!QFileInfo::exists(empty));
+    QVERIFY(QFileInfo::exists(saved));
+}
+
+QTEST_GUILESS_MAIN(FileNamerTest)
+
+#include "filenamertest.moc"
@@ -0,0 +1,180 @@
+/* ============================================================
+ * Description : Tests of the post-processing stages.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "ImagePipeline.h"
+
+#include <QTest>
+
+#include <KSaneWidget>
+
+using namespace KSaneIface;
+
+class ImagePipelineTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void parse_data();
+    void parse();
+    void parseDefaults();
+    void levels8();
+    void levels16();
+    void rotate_data();
+    void rotate();
+    void rotateBack();
+};
+
+void ImagePipelineTest::parse_data()
+{
+    QTest::addColumn<QString>("spec");
+    QTest::addColumn<int>("stages");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("empty") << QString() << 0 << true;
+    QTest::newRow("levels and unsharp") << QStringLiteral("levels=10:245;unsharp=0.8:2") << 2 << true;
+    QTest::newRow("all stages") << QStringLiteral("levels=12:240:1.1;gamma=1.2;curve=0:0:128:150:255:255;"
+                                                  "balance=highlights:-18:0:0;unsharp=0.8:2:3;despeckle;rotate=90") << 7 << true;
+    QTest::newRow("spaces and case") << QStringLiteral(" Levels = 10 : 245 ; ; ") << 1 << true;
+    QTest::newRow("white below black") << QStringLiteral("levels=245:10") << 0 << false;
+    QTest::newRow("missing argument") << QStringLiteral("levels=10") << 0 << false;
+    QTest::newRow("no number") << QStringLiteral("gamma=bright") << 0 << false;
+    QTest::newRow("negative gamma") << QStringLiteral("gamma=-1") << 0 << false;
+    QTest::newRow("odd curve") << QStringLiteral("curve=0:0:128:150:255") << 0 << false;
+    QTest::newRow("unknown range") << QStringLiteral("balance=middle:1:2:3") << 0 << false;
+    QTest::newRow("too much sharpening") << QStringLiteral("unsharp=20") << 0 << false;
+    QTest::newRow("odd angle") << QStringLiteral("rotate=45") << 0 << false;
+    QTest::newRow("unknown stage") << QStringLiteral("blur=3") << 0 << false;
+    QTest::newRow("invalid stage after a valid one") << QStringLiteral("gamma=1.2;blur=3") << 0 << false;
+}
+
+void ImagePipelineTest::parse()
+{
+    QFETCH(QString, spec);
+    QFETCH(int, stages);
+    QFETCH(bool, valid);
+
+    QString error = QStringLiteral("not cleared");
+    const ImagePipeline::Pipeline pipeline = ImagePipeline::parse(spec, &error);
+    QCOMPARE(pipeline.size(), stages);
+    QCOMPARE(error.isEmpty(), valid);
+}
+
+void ImagePipelineTest::parseDefaults()
+{
+    const ImagePipeline::Pipeline pipeline = ImagePipeline::parse(QStringLiteral("unsharp=0.8;curve=255:255:0:0:128:150;balance=Shadows:1:2:3"));
+    QCOMPARE(pipeline.size(), 3);
+
+    QCOMPARE(pipeline[0].op, ImagePipeline::Unsharp);
+    QCOMPARE(pipeline[0].args, QVector<double>() << 0.8 << 1 << 0);
+
+    // the points are sorted by the input level
+    QCOMPARE(pipeline[1].op, ImagePipeline::Curve);
+    QCOMPARE(pipeline[1].args, QVector<double>() << 0 << 0 << 128 << 150 << 255 << 255);
+
+    QCOMPARE(pipeline[2].op, ImagePipeline::ColorBalance);
+    QCOMPARE(pipeline[2].range, 0);
+    QCOMPARE(pipeline[2].args, QVector<double>() << 1 << 2 << 3);
+}
+
+void ImagePipelineTest::levels8()
+{
+    // one row with padding at the end, the padding is left alone
+    QByteArray data("\x00\x0a\x80\xf5\xff\x33", 6);
+    int width = 5;
+    int height = 1;
+    int bpl = 6;
+    ImagePipeline::apply(ImagePipeline::parse(QStringLiteral("levels=10:245")), data, width, height, bpl, KSaneWidget::FormatGrayScale8);
+    QCOMPARE(data, QByteArray("\x00\x00\x80\xff\xff\x33", 6));
+    QCOMPARE(width, 5);
+    QCOMPARE(bpl, 6);
+}
+
+void ImagePipelineTest::levels16()
+{
+    const quint16 samples[] = {0, 10 * 257, 245 * 257, 65535};
+    QByteArray data(reinterpret_cast<const char *>(samples), sizeof(samples));
+    int width = 4;
+    int height = 1;
+    int bpl = sizeof(samples);
+    ImagePipeline::apply(ImagePipeline::parse(QStringLiteral("levels=10:245")), data, width, height, bpl, KSaneWidget::FormatGrayScale16);
+    const quint16 *result = reinterpret_cast<const quint16 *>(data.constData());
+    QCOMPARE(result[0], quint16(0));
+    QCOMPARE(result[1], quint16(0));
+    QCOMPARE(result[2], quint16(65535));
+    QCOMPARE(result[3], quint16(65535));
+}
+
+void ImagePipelineTest::rotate_data()
+{
+    QTest::addColumn<int>("degrees");
+    QTest::addColumn<QByteArray>("rotated");
+    QTest::addColumn<int>("rotatedWidth");
+
+    // "abc" over "def", the source rows are padded to 4 bytes
+    QTest::newRow("90") << 90 << QByteArray("daebfc") << 2;
+    QTest::newRow("180") << 180 << QByteArray("fed.cba.") << 3;
+    QTest::newRow("270") << 270 << QByteArray("cfbead") << 2;
+}
+
+void ImagePipelineTest::rotate()
+{
+    QFETCH(int, degrees);
+    QFETCH(QByteArray, rotated);
+    QFETCH(int, rotatedWidth);
+
+    QByteArray data("abc.def.");
+    int width = 3;
+    int height = 2;
+    int bpl = 4;
+    ImagePipeline::apply(ImagePipeline::parse(QStringLiteral("rotate=%1").arg(degrees)), data, width, height, bpl, KSaneWidget::FormatGrayScale8);
+    QCOMPARE(width, rotatedWidth);
+    QCOMPARE(height, 6 / rotatedWidth);
+    // a half turn is done in place, the padding stays where it is
+    QCOMPARE(bpl, (degrees == 180) ? 4 : 2);
+    QCOMPARE(data, rotated);
+}
+
+void ImagePipelineTest::rotateBack()
+{
+    // RGB, an odd size, and the middle row of a 180 degree turn
+    QByteArray original;
+    for (int i = 0; i < 5 * 3 * 3; ++i) {
+        original.append(char(i));
+    }
+    QByteArray data = original;
+    int width = 5;
+    int height = 3;
+    int bpl = 15;
+    ImagePipeline::apply(ImagePipeline::parse(QStringLiteral("rotate=90;rotate=180;rotate=90")), data, width, height, bpl, KSaneWidget::FormatRGB_8_C);
+    QCOMPARE(width, 5);
+    QCOMPARE(height, 3);
+    QCOMPARE(bpl, 15);
+    QCOMPARE(data, original);
+
+    ImagePipeline::apply(ImagePipeline::parse(QStringLiteral("rotate=180")), data, width, height, bpl, KSaneWidget::FormatRGB_8_C);
+    QCOMPARE(data.mid(7 * 3, 3), original.mid(7 * 3, 3));
+    QCOMPARE(data.mid(0, 3), original.mid(14 * 3, 3));
+}
+
+QTEST_GUILESS_MAIN(ImagePipelineTest)
+
+#include "imagepipelinetest.moc"
@@ -0,0 +1,149 @@
+/* ============================================================
+ * Description : Tests of the write back ends of the image saver.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "OutputSink.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QTest>
+
+class OutputSinkTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void inOrder_data();
+    void inOrder();
+    void outOfOrder_data();
+    void outOfOrder();
+
+private:
+    void addBackEnds();
+
+    QTemporaryDir m_dir;
+    QByteArray    m_data;
+};
+
+void OutputSinkTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    // more than two blocks and not a multiple of the direct I/O alignment
+    for (int i = 0; i < 2 * 1024 * 1024 + 300001; ++i) {
+        m_data.append(char(i * 31 + i / 4099));
+    }
+}
+
+// The back ends fall back to pwrite() where they are not available, e.g.
+// O_DIRECT on tmpfs, the results must be the same either way
+void OutputSinkTest::addBackEnds()
+{
+    QTest::addColumn<bool>("directIo");
+    QTest::addColumn<bool>("asyncIo");
+
+    QTest::newRow("pwrite") << false << false;
+    QTest::newRow("direct") << true << false;
+    QTest::newRow("io_uring") << false << true;
+    QTest::newRow("io_uring+direct") << true << true;
+}
+
+void OutputSinkTest::inOrder_data()
+{
+    addBackEnds();
+}
+
+void OutputSinkTest::inOrder()
+{
+    QFETCH(bool, directIo);
+    QFETCH(bool, asyncIo);
+
+    QFile file(m_dir.filePath(QStringLiteral("inorder")));
+    QVERIFY(file.open(QIODevice::ReadWrite | QIODevice::Truncate));
+    QScopedPointer<OutputSink> sink(OutputSink::create(file.handle(), file.fileName(), directIo, asyncIo));
+    // odd chunk sizes, some of them span the blocks
+    qint64 offset = 0;
+    for (qint64 chunk = 1; offset < m_data.size(); chunk = (chunk * 3 + 17) % 400000) {
+        const qint64 size = qMin<qint64>(chunk + 1, m_data.size() - offset);
+        QVERIFY2(sink->writeAt(offset, m_data.constData() + offset, size), qPrintable(sink->errorString()));
+        offset += size;
+    }
+    QVERIFY2(sink->finish(), qPrintable(sink->errorString()));
+    QCOMPARE(sink->size(), qint64(m_data.size()));
+    QCOMPARE(sink->sha256(), QCryptographicHash::hash(m_data, QCryptographicHash::Sha256));
+    sink.reset();
+
+    file.seek(0);
+    QVERIFY(file.readAll() == m_data);
+}
+
+void OutputSinkTest::outOfOrder_data()
+{
+    addBackEnds();
+}
+
+void OutputSinkTest::outOfOrder()
+{
+    QFETCH(bool, directIo);
+    QFETCH(bool, asyncIo);
+
+    QFile file(m_dir.filePath(QStringLiteral("outoforder")));
+    QVERIFY(file.open(QIODevice::ReadWrite | QIODevice::Truncate));
+    QScopedPointer<OutputSink> sink(OutputSink::create(file.handle(), file.fileName(), directIo, asyncIo));
+    QByteArray expected = m_data;
+    auto write = [&](qint64 offset, const QByteArray &data) {
+        if (offset + data.size() > expected.size()) {
+            expected.append(QByteArray(offset + data.size() - expected.size(), 0));
+        }
+        expected.replace(offset, data.size(), data);
+        return sink->writeAt(offset, data.constData(), data.size());
+    };
+
+    const qint64 half = m_data.size() / 2;
+    QVERIFY(sink->writeAt(0, m_data.constData(), half));
+    // into a block that was already written out, like a TIFF header patched at the end
+    QVERIFY(write(8, QByteArray("header")));
+    // across the start of the current block
+    QVERIFY(write(1024 * 1024 - 3, QByteArray("boundary")));
+    // into the current block
+    QVERIFY(write(half - 10, QByteArray("current")));
+    QVERIFY(sink->writeAt(half, m_data.constData() + half, m_data.size() - half));
+    // past the end of the data and beyond it
+    QVERIFY(write(m_data.size() - 2, QByteArray("tail")));
+    // a hole that reads as zeros
+    QVERIFY(write(expected.size() + 5000, QByteArray("after the hole")));
+    QVERIFY2(sink->finish(), qPrintable(sink->errorString()));
+    QCOMPARE(sink->size(), qint64(expected.size()));
+    // the hash of the stream does not tell the content of the file anymore
+    QVERIFY(sink->sha256().isEmpty());
+    sink.reset();
+
+    file.seek(0);
+    const QByteArray written = file.readAll();
+    QCOMPARE(written.size(), expected.size());
+    QVERIFY(written == expected);
+}
+
+QTEST_GUILESS_MAIN(OutputSinkTest)
+
+#include "outputsinktest.moc"
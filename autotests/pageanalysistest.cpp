@@ -0,0 +1,145 @@
+/* ============================================================
+ * Description : Tests of the analysis of the raw scan data.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "PageAnalysis.h"
+
+#include <QTest>
+#include <QtMath>
+
+#include <KSaneWidget>
+
+using namespace KSaneIface;
+
+class PageAnalysisTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void gradients_data();
+    void gradients();
+    void formats();
+    void similarPages();
+    void tooSmall();
+
+private:
+    // 8 bit gray page, gray(x, y) gives the value
+    template<typename F>
+    static QByteArray page(int width, int height, int bpl, F gray)
+    {
+        QByteArray data(bpl * height, char(0x5a));
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                data[y * bpl + x] = char(gray(x, y));
+            }
+        }
+        return data;
+    }
+
+    static int distance(quint64 a, quint64 b)
+    {
+        int bits = 0;
+        for (quint64 d = a ^ b; d; d &= d - 1) {
+            bits++;
+        }
+        return bits;
+    }
+};
+
+void PageAnalysisTest::gradients_data()
+{
+    QTest::addColumn<bool>("darkToTheRight");
+    QTest::addColumn<quint64>("hash");
+
+    // every cell is compared with its right neighbour
+    QTest::newRow("brighter to the right") << false << Q_UINT64_C(0);
+    QTest::newRow("darker to the right") << true << ~Q_UINT64_C(0);
+}
+
+void PageAnalysisTest::gradients()
+{
+    QFETCH(bool, darkToTheRight);
+    QFETCH(quint64, hash);
+
+    const int width = 900;
+    const int height = 300;
+    const QByteArray data = page(width, height, width + 4, [=](int x, int) {
+        return darkToTheRight ? 255 - x * 255 / width : x * 255 / width;
+    });
+    QCOMPARE(PageAnalysis::perceptualHash(data, width, height, width + 4, KSaneWidget::FormatGrayScale8), hash);
+}
+
+void PageAnalysisTest::formats()
+{
+    // the same page in all formats gives the same hash
+    const int width = 450;
+    const int height = 320;
+    auto gray = [](int x, int y) { return ((x / 50) * 37 + (y / 40) * 91) % 256; };
+    const QByteArray gray8 = page(width, height, width, gray);
+    const quint64 hash = PageAnalysis::perceptualHash(gray8, width, height, width, KSaneWidget::FormatGrayScale8);
+    QVERIFY(hash != 0);
+
+    QByteArray gray16;
+    QByteArray rgb8;
+    QByteArray rgb16;
+    for (char value : gray8) {
+        gray16.append(char(0x80)).append(value);
+        rgb8.append(value).append(value).append(value);
+        for (int c = 0; c < 3; ++c) {
+            rgb16.append(char(0x80)).append(value);
+        }
+    }
+    QCOMPARE(PageAnalysis::perceptualHash(gray16, width, height, width * 2, KSaneWidget::FormatGrayScale16), hash);
+    QCOMPARE(PageAnalysis::perceptualHash(rgb8, width, height, width * 3, KSaneWidget::FormatRGB_8_C), hash);
+    QCOMPARE(PageAnalysis::perceptualHash(rgb16, width, height, width * 6, KSaneWidget::FormatRGB_16_C), hash);
+}
+
+void PageAnalysisTest::similarPages()
+{
+    const int width = 640;
+    const int height = 480;
+    auto content = [](int x, int y) { return 128 + int(100 * qSin(x / 70.0) * qCos(y / 45.0)); };
+    const QByteArray original = page(width, height, width, content);
+    // the same page with a little noise and a bit brighter
+    const QByteArray rescanned = page(width, height, width, [&](int x, int y) {
+        return qMin(255, content(x, y) + 6 + ((x * 7 + y * 13) % 5));
+    });
+    // another page
+    const QByteArray other = page(width, height, width, [](int x, int y) { return 128 + int(100 * qCos(x / 33.0 + y / 51.0)); });
+
+    const quint64 a = PageAnalysis::perceptualHash(original, width, height, width, KSaneWidget::FormatGrayScale8);
+    const quint64 b = PageAnalysis::perceptualHash(rescanned, width, height, width, KSaneWidget::FormatGrayScale8);
+    const quint64 c = PageAnalysis::perceptualHash(other, width, height, width, KSaneWidget::FormatGrayScale8);
+    QVERIFY2(distance(a, b) <= 4, qPrintable(QString::number(distance(a, b))));
+    QVERIFY2(distance(a, c) > 16, qPrintable(QString::number(distance(a, c))));
+}
+
+void PageAnalysisTest::tooSmall()
+{
+    const QByteArray data(8 * 8, char(0));
+    QCOMPARE(PageAnalysis::perceptualHash(data, 8, 8, 8, KSaneWidget::FormatGrayScale8), Q_UINT64_C(0));
+    // less data than the size tells
+    QCOMPARE(PageAnalysis::perceptualHash(data, 9, 8, 9, KSaneWidget::FormatGrayScale8), Q_UINT64_C(0));
+}
+
+QTEST_GUILESS_MAIN(PageAnalysisTest)
+
+#include "pageanalysistest.moc"
@@ -0,0 +1,141 @@
+/* ============================================================
+ * Description : Tests of the raw scan captures.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "RawCapture.h"
+
+#include <QBuffer>
+#include <QTest>
+
+#include <KSaneWidget>
+
+using namespace KSaneIface;
+
+class RawCaptureTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void fileName();
+    void roundTrip_data();
+    void roundTrip();
+    void damaged();
+
+private:
+    static RawCapture::Capture capture(int format, int bytesPerPixel);
+};
+
+RawCapture::Capture RawCaptureTest::capture(int format, int bytesPerPixel)
+{
+    RawCapture::Capture capture;
+    capture.width = 37;
+    capture.height = 11;
+    // rows with padding
+    capture.bpl = capture.width * bytesPerPixel + 3;
+    capture.format = format;
+    capture.dpi = 600;
+    capture.deviceName = QStringLiteral("test:0");
+    capture.options[QStringLiteral("mode")] = QStringLiteral("Color");
+    capture.options[QStringLiteral("resolution")] = QStringLiteral("600");
+    capture.iccProfile = QByteArray("\x00\x01profile\xff", 10);
+    capture.timestamp = QDateTime(QDate(2019, 3, 13), QTime(14, 25, 1), Qt::UTC);
+    for (int i = 0; i < capture.bpl * capture.height; ++i) {
+        capture.data.append(char(i * 7 + i / 13));
+    }
+    return capture;
+}
+
+void RawCaptureTest::fileName()
+{
+    QCOMPARE(RawCapture::fileName(QStringLiteral("/scans/Image-0001.png")), QStringLiteral("/scans/Image-0001.skraw"));
+    QCOMPARE(RawCapture::fileName(QStringLiteral("/scans/page.1.tar.gz")), QStringLiteral("/scans/page.1.tar.skraw"));
+}
+
+void RawCaptureTest::roundTrip_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<int>("bytesPerPixel");
+
+    QTest::newRow("Gray8") << int(KSaneWidget::FormatGrayScale8) << 1;
+    QTest::newRow("Gray16") << int(KSaneWidget::FormatGrayScale16) << 2;
+    QTest::newRow("RGB8") << int(KSaneWidget::FormatRGB_8_C) << 3;
+    QTest::newRow("RGB16") << int(KSaneWidget::FormatRGB_16_C) << 6;
+}
+
+void RawCaptureTest::roundTrip()
+{
+    QFETCH(int, format);
+    QFETCH(int, bytesPerPixel);
+
+    const RawCapture::Capture written = capture(format, bytesPerPixel);
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::ReadWrite));
+    QString error;
+    QVERIFY2(RawCapture::write(&buffer, written, 3, 0, &error), qPrintable(error));
+
+    buffer.seek(0);
+    RawCapture::Capture read;
+    QVERIFY2(RawCapture::read(&buffer, read, &error), qPrintable(error));
+    QCOMPARE(read.width, written.width);
+    QCOMPARE(read.height, written.height);
+    QCOMPARE(read.bpl, written.bpl);
+    QCOMPARE(read.format, written.format);
+    QCOMPARE(read.dpi, written.dpi);
+    QCOMPARE(read.deviceName, written.deviceName);
+    QCOMPARE(read.options, written.options);
+    QCOMPARE(read.iccProfile, written.iccProfile);
+    QCOMPARE(read.timestamp, written.timestamp);
+    QVERIFY(read.data == written.data);
+}
+
+void RawCaptureTest::damaged()
+{
+    const RawCapture::Capture written = capture(KSaneWidget::FormatRGB_8_C, 3);
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::ReadWrite));
+    QString error;
+    QVERIFY(RawCapture::write(&buffer, written, 3, 0, &error));
+    const QByteArray file = buffer.data();
+
+    RawCapture::Capture read;
+    QByteArray truncated = file.left(file.size() - 10);
+    QBuffer truncatedBuffer(&truncated);
+    QVERIFY(truncatedBuffer.open(QIODevice::ReadOnly));
+    QVERIFY(!RawCapture::read(&truncatedBuffer, read, &error));
+    QVERIFY(!error.isEmpty());
+
+    QByteArray other = file;
+    other[0] = 'X';
+    QBuffer otherBuffer(&other);
+    QVERIFY(otherBuffer.open(QIODevice::ReadOnly));
+    QVERIFY(!RawCapture::read(&otherBuffer, read, &error));
+
+    // less data than the size tells
+    RawCapture::Capture shorter = written;
+    shorter.data.chop(1);
+    QBuffer shorterBuffer;
+    QVERIFY(shorterBuffer.open(QIODevice::WriteOnly));
+    QVERIFY(!RawCapture::write(&shorterBuffer, shorter, 3, 0, &error));
+}
+
+QTEST_GUILESS_MAIN(RawCaptureTest)
+
+#include "rawcapturetest.moc"
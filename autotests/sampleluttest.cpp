@@ -0,0 +1,117 @@
+/* ============================================================
+ * Description : Tests of the 16 bit sample conversion.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "SampleLut.h"
+
+#include <QDebug>
+#include <QTest>
+#include <QVector>
+
+class SampleLutTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void map16_data();
+    void map16();
+    void swapBytes16();
+};
+
+void SampleLutTest::initTestCase()
+{
+    // without AVX2 both sides of the comparison are the generic loop
+    qDebug() << "Testing the" << SampleLut::implementation() << "implementation";
+}
+
+void SampleLutTest::map16_data()
+{
+    QTest::addColumn<int>("channels");
+    QTest::addColumn<int>("count");
+
+    // the vector loop takes 16 samples, a tail is left over at odd widths and
+    // the RGB channels start at another phase in every block
+    const int counts[] = {0, 1, 15, 16, 17, 47, 48, 49, 3 * 1001, 3 * 2047 + 2};
+    const int layouts[] = {1, 3, 4};
+    for (int channels : layouts) {
+        for (int count : counts) {
+            QTest::newRow(qPrintable(QStringLiteral("%1 channels, %2 samples").arg(channels).arg(count))) << channels << count;
+        }
+    }
+}
+
+void SampleLutTest::map16()
+{
+    QFETCH(int, channels);
+    QFETCH(int, count);
+
+    // distinct entries in every table, the padding entry at the end included
+    QVector<quint16> table(channels * SampleLut::tableSize + 1);
+    quint32 state = 12345;
+    for (int i = 0; i < table.size(); ++i) {
+        state = state * 1103515245 + 12345;
+        table[i] = quint16(state >> 16);
+    }
+    // one sample more to start the data at an odd address, the extremes included
+    QVector<quint16> src(count + 1);
+    for (int i = 0; i < src.size(); ++i) {
+        state = state * 1103515245 + 12345;
+        src[i] = quint16(state >> 16);
+    }
+    if (count > 1) {
+        src[1] = 0;
+        src[count] = 65535;
+    }
+
+    for (int swapBytes = 0; swapBytes < 2; ++swapBytes) {
+        QVector<quint16> expected(src.size(), 0);
+        QVector<quint16> mapped(src.size(), 0);
+        SampleLut::map16Generic(table.constData(), channels, src.constData() + 1, expected.data() + 1, count, swapBytes);
+        SampleLut::map16(table.constData(), channels, src.constData() + 1, mapped.data() + 1, count, swapBytes);
+        QCOMPARE(mapped, expected);
+
+        // in place, as the saver converts the rows
+        QVector<quint16> inPlace = src;
+        SampleLut::map16(table.constData(), channels, inPlace.constData() + 1, inPlace.data() + 1, count, swapBytes);
+        inPlace[0] = 0;
+        QCOMPARE(inPlace, expected);
+    }
+}
+
+void SampleLutTest::swapBytes16()
+{
+    QVector<quint16> src(3 * 1001);
+    for (int i = 0; i < src.size(); ++i) {
+        src[i] = quint16(i * 40503);
+    }
+    for (int count : {0, 1, 15, 16, 17, 3 * 1001 - 1}) {
+        QVector<quint16> swapped(count + 1, 0);
+        SampleLut::swapBytes16(src.constData() + 1, swapped.data() + 1, count);
+        for (int i = 0; i < count; ++i) {
+            QCOMPARE(swapped[i + 1], quint16((src[i + 1] << 8) | (src[i + 1] >> 8)));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(SampleLutTest)
+
+#include "sampleluttest.moc"
@@ -4,6 +4,9 @@
 # this script sends 'scan' command to Skanlite via D-Bus
 # then listens for scanDone signal and repeats in infinite loop
 
+# NOTE: Skanlite can do this by itself, faster and stopping when the feeder is empty:
+# dbus-send --session --dest=org.kde.skanlite --type=method_call / org.kde.skanlite.startContinuousScan
+
 interface=org.kde.skanlite
 sender=org.kde.skanlite
 member=scanDone
@@ -9,6 +9,9 @@
 # WARNING: buttonPressed signal might work unstable as it's driver dependant
 # WARNING: for example my HP 4370 stop sending hw btn events just after first scan
 
+# NOTE: Skanlite can handle buttons by itself without this script, e.g.
+# dbus-send --session --dest=org.kde.skanlite --type=method_call / org.kde.skanlite.setButtonAction string:"button 0" string:"scan"
+
 interface=org.kde.skanlite
 sender=org.kde.skanlite
 member=buttonPressed
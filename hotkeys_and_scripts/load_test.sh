@@ -0,0 +1,219 @@
+#!/bin/bash
+
+# Skanlite D-Bus load test.
+# Starts its own Skanlite on the SANE "test" device, in a private configuration
+# that saves to a temporary directory. It scans a batch with continuous scanning
+# and reports:
+#   - pages per minute
+#   - the latency of each page, from the start of its scan to imageSaved
+#   - the memory high-water mark of Skanlite
+# The test device produces pages of any size, mode and depth, and can delay
+# every line like a slow scanner. This runs the same imageReady -> save path
+# as a real scan, without hardware.
+#
+# Usage: load_test.sh [-n pages] [-r dpi] [-m Color|Gray|Lineart] [-b 8|16]
+#                     [-W width-mm] [-H height-mm] [-f png|jpg|tif|...]
+#                     [-l line-delay-us] [-d delay-between-pages-ms] [-a] [-k]
+#                     [-P min-pages-per-minute] [-L max-p99-latency-ms]
+#   -a  scan from the simulated document feeder instead of the flatbed,
+#       the test device runs empty after 10 pages
+#   -k  keep the saved pages and the signal log
+#   -P  fail when fewer pages per minute are saved
+#   -L  fail when the p99 latency is higher
+#
+# The skanlite binary is taken from $SKANLITE, e.g. the one of a build
+# directory, and found in the PATH when it is not set.
+#
+# Exits with 1 when a page failed to save, when fewer pages were saved than
+# scanned or requested, or when a threshold is missed.
+#
+# Comparing the numbers of two builds shows regressions of the save pipeline,
+# e.g. in a nightly job:
+#   load_test.sh -n 50 -r 600 -f png -P 20 -L 5000 | tee result.txt
+
+pages=20
+dpi=300
+mode=Color
+depth=8
+width=210
+height=297
+format=png
+line_delay=0
+delay=0
+source=Flatbed
+keep=0
+min_ppm=
+max_p99=
+
+while getopts "n:r:m:b:W:H:f:l:d:akP:L:" opt; do
+    case $opt in
+        n) pages=$OPTARG ;;
+        r) dpi=$OPTARG ;;
+        m) mode=$OPTARG ;;
+        b) depth=$OPTARG ;;
+        W) width=$OPTARG ;;
+        H) height=$OPTARG ;;
+        f) format=$OPTARG ;;
+        l) line_delay=$OPTARG ;;
+        d) delay=$OPTARG ;;
+        a) source="Automatic Document Feeder" ;;
+        k) keep=1 ;;
+        P) min_ppm=$OPTARG ;;
+        L) max_p99=$OPTARG ;;
+        *) sed -n '/^# Usage/,/^#   -L/p' "$0"; exit 1 ;;
+    esac
+done
+
+interface=org.kde.skanlite
+
+call() {
+    dbus-send --session --print-reply --dest=$interface / "$@"
+}
+
+if dbus-send --session --print-reply --dest=org.freedesktop.DBus / org.freedesktop.DBus.NameHasOwner string:$interface | grep -q "boolean true"; then
+    echo "Skanlite is already running, quit it first" >&2
+    exit 1
+fi
+
+work=$(mktemp -d)
+mkdir -p "$work/config" "$work/out"
+cat > "$work/config/skanliterc" <<EOF
+[Image Saving]
+Location=$work/out
+NamePrefix=page-
+ImgFormat=$format
+SaveMode=0
+ShowBeforeSave=false
+EOF
+
+dbus-monitor --profile "type='signal',interface='$interface'" > "$work/signals" &
+monitor=$!
+
+XDG_CONFIG_HOME="$work/config" "${SKANLITE:-skanlite}" -d test > "$work/skanlite.log" 2>&1 &
+skanlite=$!
+
+cleanup() {
+    kill $skanlite $monitor 2> /dev/null
+    wait $skanlite $monitor 2> /dev/null
+    if [[ $keep == 0 ]]; then
+        rm -rf "$work"
+    else
+        echo "Pages and logs kept in $work"
+    fi
+}
+trap cleanup EXIT
+
+for ((i = 0; i < 300; ++i)); do
+    dbus-send --session --print-reply --dest=org.freedesktop.DBus / org.freedesktop.DBus.NameHasOwner string:$interface | grep -q "boolean true" && break
+    sleep 0.1
+done
+
+# One read of a line per delay, like a scanner that sends the page line by line
+bytes_per_line=$(awk -v w="$width" -v r="$dpi" -v m="$mode" -v b="$depth" 'BEGIN {
+    px = int(w / 25.4 * r); c = (m == "Color") ? 3 : 1
+    n = (m == "Lineart") ? int((px + 7) / 8) : px * c * b / 8
+    print (n > 65536) ? 65536 : n }')
+options="mode=$mode,depth=$depth,resolution=$dpi,source=$source,test-picture=Color pattern"
+options+=",tl-x=0,tl-y=0,br-x=$width,br-y=$height"
+if [[ $line_delay -gt 0 ]]; then
+    options+=",read-delay=true,read-delay-duration=$line_delay,read-limit=true,read-limit-size=$bytes_per_line"
+fi
+call $interface.setScannerOptions array:string:"$options" boolean:false > /dev/null || exit 1
+
+echo "Scanning $pages pages, $width x $height mm, $mode $depth bit, $dpi dpi, saved as $format"
+call $interface.startContinuousScan int32:$delay int32:$pages > /dev/null || exit 1
+
+# wait for the batch to end and the saver to catch up
+count() { grep -c $'\t'"$1"'$' "$work/signals"; }
+# the scans that delivered a page, the one that found the feeder empty has no progress
+scanned() {
+    awk -F'\t' '$NF == "scanProgress" { scanning = 1 } $NF == "scanDone" { n += scanning; scanning = 0 } END { print n + 0 }' "$work/signals"
+}
+last=-1
+idle=0
+timed_out=0
+until [[ $(count continuousScanFinished) -gt 0 && $(( $(count imageSaved) + $(count imageSaveFailed) )) -ge $(scanned) ]]; do
+    if ! kill -0 $skanlite 2> /dev/null; then
+        echo "Skanlite exited, see $work/skanlite.log" >&2
+        keep=1
+        exit 1
+    fi
+    saved=$(count imageSaved)
+    if [[ $saved == "$last" ]]; then
+        idle=$((idle + 1))
+        if [[ $idle -ge 600 ]]; then
+            echo "No page saved for 60 s, giving up" >&2
+            timed_out=1
+            break
+        fi
+    else
+        idle=0
+        last=$saved
+    fi
+    sleep 0.1
+done
+
+high_water=$(awk '/^VmHWM/ { print $2, $3 }' /proc/$skanlite/status)
+
+# A page starts with its first scanProgress and is done with its imageSaved or
+# imageSaveFailed. The pages are saved in the order they were scanned.
+awk -F'\t' -v latencies="$work/latencies" -v results="$work/results" '
+$1 == "sig" {
+    t = $2; m = $NF
+    if (m == "scanProgress" && !scanning) { scanning = 1; start[starts++] = t; if (first == "") first = t }
+    else if (m == "scanDone") { if (scanning) { acquire += t - start[starts - 1]; acquired++ } scanning = 0 }
+    else if (m == "imageSaved") { printf "%.1f\n", (t - start[done++]) * 1000 > latencies; saved++; end = t }
+    else if (m == "imageSaveFailed") { done++; failed++ }
+}
+END {
+    close(latencies)
+    ppm = (saved > 0 && end > first) ? saved * 60 / (end - first) : 0
+    printf "Pages saved:        %d, failed: %d\n", saved, failed
+    if (ppm > 0) printf "Pages per minute:   %.1f\n", ppm
+    if (acquired > 0) printf "Mean scan time:     %.1f ms\n", acquire * 1000 / acquired
+    printf "%d %d %d %.1f\n", saved, failed, acquired, ppm > results
+}' "$work/signals"
+read -r saved failed acquired ppm < "$work/results"
+p99=0
+
+if [[ -s "$work/latencies" ]]; then
+    sort -n "$work/latencies" | awk -v results="$work/p99" '
+    function at(p) { i = int(NR * p + 0.5); return v[i < 1 ? 1 : i] }
+    { v[NR] = $1 }
+    END {
+        printf "Latency (ms):       min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               v[1], at(0.5), at(0.9), at(0.99), v[NR]
+        printf "%.1f\n", at(0.99) > results
+    }'
+    read -r p99 < "$work/p99"
+fi
+echo "Memory high-water:  $high_water"
+
+status=0
+if [[ $failed -gt 0 ]]; then
+    echo "FAIL: $failed pages were not saved, see $work/skanlite.log" >&2
+    status=1
+fi
+if [[ $timed_out == 1 || $((saved + failed)) -lt $acquired ]]; then
+    echo "FAIL: $((acquired - saved - failed)) scanned pages are missing" >&2
+    status=1
+fi
+# the feeder of the test device runs empty after 10 pages
+expected=$pages
+[[ $source != Flatbed && $expected -gt 10 ]] && expected=10
+if [[ $acquired -lt $expected ]]; then
+    echo "FAIL: $acquired of $expected pages were scanned" >&2
+    status=1
+fi
+if [[ -n $min_ppm ]] && awk -v a="$ppm" -v b="$min_ppm" 'BEGIN { exit !(a < b) }'; then
+    echo "FAIL: $ppm pages per minute, less than $min_ppm" >&2
+    status=1
+fi
+if [[ -n $max_p99 ]] && awk -v a="$p99" -v b="$max_p99" 'BEGIN { exit !(a > b) }'; then
+    echo "FAIL: p99 latency $p99 ms, more than $max_p99 ms" >&2
+    status=1
+fi
+if [[ $status != 0 ]]; then
+    keep=1
+fi
+exit $status
@@ -9,6 +9,10 @@
 # in particulary for color balance correction
 # in this example we decreasing Highlights (brightest pixels) gamma's red by 18
 
+# Simple corrections like this one can be done by Skanlite itself before the
+# image is saved, without starting gimp for every page:
+# qdbus org.kde.skanlite / setPipeline "balance=highlights:-18:0:0"
+
 interface=org.kde.skanlite
 sender=org.kde.skanlite
 member=imageSaved
@@ -29,6 +33,8 @@ if [[ $line == *"member=imageSaved"* ]]; then
       # Here you can apply some additional filters. For example filter out
       # grayscale scans with help of identify (from imagemagick package)
       # like, identify -verbose $filename | grep 'Type: TrueColor'
+      # The imageSavedWithMetadata signal already carries this information
+      # ("colorMode", "blankScore", "width", "height", "dpi", ...).
 
       filename=${BASH_REMATCH[1]}
       printf "Processing scan: $filename\n"
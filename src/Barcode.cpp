@@ -0,0 +1,190 @@
+/* ============================================================
+ * Description : Detection of barcodes on separator sheets.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "Barcode.h"
+#include "PageAnalysis.h"
+
+#include <QHash>
+
+#include <algorithm>
+
+static const char code39Alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%";
+
+// 9 elements per character, bar space bar ... bar, a 1 bit for a wide element
+static const int code39Patterns[] = {
+    0x034, 0x121, 0x061, 0x160, 0x031, 0x130, 0x070, 0x025, 0x124, 0x064, // 0-9
+    0x109, 0x049, 0x148, 0x019, 0x118, 0x058, 0x00D, 0x10C, 0x04C, 0x01C, // A-J
+    0x103, 0x043, 0x142, 0x013, 0x112, 0x052, 0x007, 0x106, 0x046, 0x016, // K-T
+    0x181, 0x0C1, 0x1C0, 0x091, 0x190, 0x0D0, 0x085, 0x184, 0x0C4, 0x0A8, // U-Z - . space $
+    0x0A2, 0x08A, 0x02A                                                   // / + %
+};
+static const int code39Count = sizeof(code39Patterns) / sizeof(code39Patterns[0]);
+static const int code39StartStop = 0x094; // "*"
+
+// index in the alphabet, code39Count for the start/stop character, -1 if not a character;
+// backwards reads the elements from the last one, for runs taken right to left
+static int decodeCharacter(const int *runs, bool backwards)
+{
+    // the three widest elements are the wide ones, clearly wider than the others
+    int sorted[9];
+    std::copy(runs, runs + 9, sorted);
+    std::sort(sorted, sorted + 9);
+    const int maxNarrow = sorted[5];
+    const int minWide = sorted[6];
+    if (minWide * 2 < maxNarrow * 3 || sorted[8] > sorted[0] * 8) {
+        return -1;
+    }
+    int pattern = 0;
+    for (int i = 0; i < 9; ++i) {
+        pattern = (pattern << 1) | (runs[backwards ? 8 - i : i] >= minWide ? 1 : 0);
+    }
+    if (pattern == code39StartStop) {
+        return code39Count;
+    }
+    for (int i = 0; i < code39Count; ++i) {
+        if (code39Patterns[i] == pattern) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static QString decodeRuns(const QVector<int> &runs, bool backwards)
+{
+    // bars are at the even indexes, a character and the gap after it take 10 runs
+    for (int start = 0; start + 9 <= runs.size(); start += 2) {
+        if (decodeCharacter(runs.constData() + start, backwards) != code39Count) {
+            continue;
+        }
+        int characterWidth = 0;
+        for (int i = start; i < start + 9; ++i) {
+            characterWidth += runs[i];
+        }
+        // the quiet zone in front of the start character
+        if (start > 0 && runs[start - 1] * 2 < characterWidth) {
+            continue;
+        }
+        QString text;
+        for (int pos = start + 10; pos + 9 <= runs.size(); pos += 10) {
+            // the gap between characters is narrow
+            if (runs[pos - 1] * 2 > characterWidth) {
+                break;
+            }
+            const int character = decodeCharacter(runs.constData() + pos, backwards);
+            if (character < 0) {
+                break;
+            }
+            if (character == code39Count) {
+                if (!text.isEmpty()) {
+                    if (backwards) {
+                        std::reverse(text.begin(), text.end());
+                    }
+                    return text;
+                }
+                break;
+            }
+            text += QLatin1Char(code39Alphabet[character]);
+        }
+    }
+    return QString();
+}
+
+QString Barcode::decodeCode39(const QVector<int> &runs)
+{
+    QString text = decodeRuns(runs, false);
+    if (text.isEmpty()) {
+        // a sheet put in upside down
+        text = decodeRuns(runs, true);
+    }
+    return text;
+}
+
+QString Barcode::findCode39(const QByteArray &data, int width, int height, int bpl, int format, int dpi,
+                            double searchHeight)
+{
+    if (width <= 0 || height <= 0 || data.size() < qint64(bpl) * height) {
+        return QString();
+    }
+    if (dpi <= 0) {
+        dpi = 300;
+    }
+    const int rowStep = qMax(1, qRound(dpi * 2 / 25.4));
+    const int columnStep = qMax(1, dpi / 300);
+    const int rows = qBound(1, int(height * searchHeight), height);
+    const int samples = (width + columnStep - 1) / columnStep;
+
+    QVector<uchar> grays(samples);
+    QVector<int> runs;
+    const uchar *bits = reinterpret_cast<const uchar *>(data.constData());
+    auto readRow = [&](int y) -> QString {
+        const uchar *row = bits + qint64(y) * bpl;
+        int darkest = 255;
+        int brightest = 0;
+        for (int i = 0; i < samples; ++i) {
+            int gray, chroma;
+            PageAnalysis::sample(row, i * columnStep, format, gray, chroma);
+            grays[i] = gray;
+            darkest = qMin(darkest, gray);
+            brightest = qMax(brightest, gray);
+        }
+        if (brightest - darkest < 64) {
+            return QString();
+        }
+
+        // run lengths from the first to the last dark sample
+        const int threshold = (darkest + brightest) / 2;
+        runs.clear();
+        bool dark = false;
+        int length = 0;
+        for (int i = 0; i < samples; ++i) {
+            const bool isDark = grays[i] < threshold;
+            if (runs.isEmpty() && length == 0 && !isDark) {
+                continue;
+            }
+            if (length > 0 && isDark != dark) {
+                runs.append(length);
+                length = 0;
+            }
+            dark = isDark;
+            length++;
+        }
+        if (dark && length > 0) {
+            runs.append(length);
+        }
+        return decodeCode39(runs);
+    };
+
+    QHash<QString, int> found;
+    for (int y = rowStep / 2; y < rows; y += rowStep) {
+        // the barcode of a sheet fed upside down is in the bottom band
+        const int bottom = height - 1 - y;
+        for (int band = 0; band < 2; ++band) {
+            if (band == 1 && bottom < rows) {
+                break;
+            }
+            const QString text = readRow(band == 0 ? y : bottom);
+            if (!text.isEmpty() && ++found[text] >= 2) {
+                return text;
+            }
+        }
+    }
+    return QString();
+}
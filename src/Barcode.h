@@ -0,0 +1,46 @@
+/* ============================================================
+ * Description : Detection of barcodes on separator sheets.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef Barcode_h
+#define Barcode_h
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// Reads Code 39 barcodes, the usual choice for separator sheets as any
+// printer can make them. Only a sparse set of rows is looked at, so the
+// detection costs far less than saving the page.
+namespace Barcode
+{
+    // Text of a Code 39 barcode printed horizontally in the top searchHeight
+    // (0..1) part of the page, or in the bottom one for a sheet fed upside down,
+    // or an empty string. One row every 2 mm is read, at no more than 300
+    // samples per inch across, and the text must be read on two rows.
+    QString findCode39(const QByteArray &data, int width, int height, int bpl, int format, int dpi,
+                       double searchHeight = 0.25);
+
+    // Text of the first Code 39 barcode in alternating bar and space widths
+    // starting with a bar, read either way round, or an empty string
+    QString decodeCode39(const QVector<int> &runs);
+}
+
+#endif
@@ -0,0 +1,164 @@
+/* ============================================================
+ * Description : Maps scanner hardware buttons to Skanlite actions.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "ButtonDispatcher.h"
+
+#include <QDebug>
+
+#include <KSharedConfig>
+#include <KConfigGroup>
+
+static const QLatin1String buttonActionsGroup("Button Actions");
+
+ButtonDispatcher::ButtonDispatcher(QObject *parent) : QObject(parent)
+{
+    readSettings();
+}
+
+void ButtonDispatcher::readSettings()
+{
+    KConfigGroup general(KSharedConfig::openConfig(), "General");
+    m_debounceMs = general.readEntry("ButtonDebounceMs", 250);
+
+    KConfigGroup buttons(KSharedConfig::openConfig(), buttonActionsGroup);
+    m_actions.clear();
+    const QMap<QString, QString> entries = buttons.entryMap();
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        QString error;
+        if (!isValidAction(it.value(), &error)) {
+            qWarning() << "Ignoring the action of" << it.key() << error;
+            continue;
+        }
+        m_actions.insert(it.key(), it.value());
+    }
+}
+
+bool ButtonDispatcher::isValidAction(const QString &action, QString *error)
+{
+    const int colon = action.indexOf(QLatin1Char(':'));
+    const QString command = action.left(colon);
+    const QString profile = colon < 0 ? QString() : action.mid(colon + 1);
+
+    QString message;
+    if (command == QLatin1String("scan") || command == QLatin1String("cancel")) {
+        if (colon >= 0 && (command == QLatin1String("cancel") || profile.isEmpty())) {
+            message = QStringLiteral("Invalid argument in \"%1\"").arg(action);
+        }
+    }
+    else if (command == QLatin1String("profile")) {
+        if (profile.isEmpty()) {
+            message = QStringLiteral("No profile given in \"%1\"").arg(action);
+        }
+    }
+    else {
+        message = QStringLiteral("Unknown action \"%1\", expected scan, scan:<profile>, profile:<profile> or cancel").arg(action);
+    }
+    if (error) {
+        *error = message;
+    }
+    return message.isEmpty();
+}
+
+bool ButtonDispatcher::setAction(const QString &optionName, const QString &action, QString *error)
+{
+    if (optionName.isEmpty()) {
+        if (error) {
+            *error = QStringLiteral("No button option name given");
+        }
+        return false;
+    }
+    if (!action.isEmpty() && !isValidAction(action, error)) {
+        return false;
+    }
+    KConfigGroup buttons(KSharedConfig::openConfig(), buttonActionsGroup);
+    if (action.isEmpty()) {
+        m_actions.remove(optionName);
+        buttons.deleteEntry(optionName);
+    }
+    else {
+        m_actions.insert(optionName, action);
+        buttons.writeEntry(optionName, action);
+    }
+    buttons.sync();
+    return true;
+}
+
+QStringList ButtonDispatcher::actions() const
+{
+    QStringList list;
+    for (auto it = m_actions.constBegin(); it != m_actions.constEnd(); ++it) {
+        list.append(it.key() + QLatin1String("=") + it.value());
+    }
+    return list;
+}
+
+void ButtonDispatcher::buttonPressed(const QString &optionName, const QString &optionLabel, bool pressed)
+{
+    Q_UNUSED(optionLabel);
+
+    ButtonState &state = m_states[optionName];
+    const bool pressEdge = pressed && !state.pressed;
+    state.pressed = pressed;
+
+    // The backends report the button state on every poll, only act on a new press
+    // and ignore bouncing contacts and repeated polls of the same press.
+    if (!pressEdge) {
+        return;
+    }
+    if (state.lastTrigger.isValid() && state.lastTrigger.elapsed() < m_debounceMs) {
+        return;
+    }
+    state.lastTrigger.start();
+
+    const QString action = m_actions.value(optionName);
+    if (action.isEmpty()) {
+        return;
+    }
+
+    const int colon = action.indexOf(QLatin1Char(':'));
+    const QString command = action.left(colon);
+    const QString profile = colon < 0 ? QString() : action.mid(colon + 1);
+
+    if (command == QLatin1String("scan")) {
+        if (!profile.isEmpty()) {
+            emit switchProfileRequested(profile);
+        }
+        m_pendingScan.start();
+        emit scanRequested();
+    }
+    else if (command == QLatin1String("profile")) {
+        emit switchProfileRequested(profile);
+    }
+    else if (command == QLatin1String("cancel")) {
+        m_pendingScan.invalidate();
+        emit cancelRequested();
+    }
+}
+
+void ButtonDispatcher::scanStarted()
+{
+    if (!m_pendingScan.isValid()) {
+        return;
+    }
+    const qlonglong latency = m_pendingScan.nsecsElapsed() / 1000;
+    m_pendingScan.invalidate();
+    emit triggerLatency(latency);
+}
@@ -0,0 +1,75 @@
+/* ============================================================
+ * Description : Maps scanner hardware buttons to Skanlite actions.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef ButtonDispatcher_h
+#define ButtonDispatcher_h
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+
+// Turns the buttonPressed() events of KSaneWidget into actions. The actions
+// are read from the "Button Actions" config group, one entry per button option
+// name (for example "button 0"), with one of the values:
+//   "scan"            start a final scan
+//   "scan:<profile>"  switch to <profile> and start a final scan
+//   "profile:<profile>" switch to <profile>
+//   "cancel"          cancel the ongoing scan
+class ButtonDispatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ButtonDispatcher(QObject *parent = nullptr);
+
+    void readSettings();
+
+    // An empty action removes the mapping, an invalid one is rejected with a message in error
+    bool setAction(const QString &optionName, const QString &action, QString *error = nullptr);
+    static bool isValidAction(const QString &action, QString *error = nullptr);
+    // One string per mapped button in form "optionName=action"
+    QStringList actions() const;
+
+public Q_SLOTS:
+    void buttonPressed(const QString &optionName, const QString &optionLabel, bool pressed);
+    // Connected to the scan progress, stops the trigger latency measurement
+    void scanStarted();
+
+Q_SIGNALS:
+    void scanRequested();
+    void cancelRequested();
+    void switchProfileRequested(const QString &profile);
+    // Time from the button press to the first scan progress
+    void triggerLatency(qlonglong microseconds);
+
+private:
+    struct ButtonState {
+        bool          pressed = false;
+        QElapsedTimer lastTrigger;
+    };
+
+    QHash<QString, QString>     m_actions;
+    QHash<QString, ButtonState> m_states;
+    int                         m_debounceMs = 250;
+    QElapsedTimer               m_pendingScan;
+};
+
+#endif
@@ -24,14 +24,17 @@
 #define DBusInterface_h
 
 #include <QDBusConnection>
+#include <QDBusContext>
+#include <QDBusUnixFileDescriptor>
 #include <QDebug>
 #include <KSaneWidget>
 #include <QStringList>
+#include <QVariantMap>
 
 static const bool defaultSelectionFiltering = true;
 static const QLatin1String defaultProfile("1");
 
-class DBusInterface : public QObject
+class DBusInterface : public QObject, protected QDBusContext
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.kde.skanlite")
@@ -54,7 +57,15 @@ Q_SIGNALS:
     // used to communicate with Skanlite class
     void requestedScan();
     void requestedPreview();
+    void requestedQuickPreview(int dpi);
+    void requestedInvalidatePreview();
     void requestedScanCancel();
+    void requestedStartContinuousScan(int delayMs, int maxPages);
+    void requestedStopContinuousScan();
+    void requestedSharedMemoryExport(bool enabled);
+    void requestedCloseDocument();
+    void requestedStartTrace(const QString &fileName);
+    void requestedStopTrace();
     void requestedGetScannerOptions();
     void requestedSetScannerOptions(const QStringList &options, bool ignoreSelection);
     void requestedDefaultScannerOptions();
@@ -63,6 +74,15 @@ Q_SIGNALS:
     void requestedSwitchToProfile(const QString &profile, bool ignoreSelection);
     void requestedGetSelection();
     void requestedSetSelection(const QStringList &options);
+    void requestedGetScanRegions();
+    void requestedGetPipeline();
+    void requestedSetPipeline(const QString &spec);
+    void requestedSavePipelineToProfile(const QString &spec, const QString &profile);
+    void requestedSetScanRegions(const QStringList &regions);
+    void requestedSaveScanRegionsToProfile(const QStringList &regions, const QString &profile);
+    void requestedDeviceList();
+    void requestedButtonActions();
+    void requestedSetButtonAction(const QString &optionName, const QString &action);
 
 public Q_SLOTS:
 
@@ -71,12 +91,50 @@ public Q_SLOTS:
     // Perform scan operation if is in idle
     Q_SCRIPTABLE void scan() { emit requestedScan(); }
 
-    // Perform preview operation if is in idle
+    // Perform preview operation if is in idle. The last preview is kept and scanDone is emitted
+    // right away while it is valid: until invalidatePreview is called, it is older than
+    // General/PreviewCacheMaxAge seconds or an option other than the selection and the
+    // resolution changes.
     Q_SCRIPTABLE void preview() { emit requestedPreview(); }
 
+    // Scan the selection at dpi (0 = the preview resolution from the settings, or 75) without saving
+    // it, and emit quickPreviewReady with the items found on the bed. The preview is kept like the one
+    // of preview() and used by setScanRegions("auto") instead of detecting the items on every scan.
+    Q_SCRIPTABLE void quickPreview(int dpi = 0) { emit requestedQuickPreview(dpi); }
+
+    // Drop the kept previews, e.g. after the items on the bed were replaced
+    Q_SCRIPTABLE void invalidatePreview() { emit requestedInvalidatePreview(); }
+
     // Cancel any ongoing operation
     Q_SCRIPTABLE void scanCancel() { emit requestedScanCancel(); }
 
+    // Scan pages until the feeder is empty, maxPages pages are scanned or stopContinuousScan is called.
+    // The next scan starts delayMs after the previous one is done. Negative values use the values
+    // from the settings, maxPages = 0 means no limit.
+    Q_SCRIPTABLE void startContinuousScan(int delayMs = -1, int maxPages = -1) { emit requestedStartContinuousScan(delayMs, maxPages); }
+
+    // Stop the continuous scanning after the current page
+    Q_SCRIPTABLE void stopContinuousScan() { emit requestedStopContinuousScan(); }
+
+    // Enables the pageBufferReady signal
+    Q_SCRIPTABLE void setSharedMemoryExport(bool enabled) { emit requestedSharedMemoryExport(enabled); }
+
+    // End the current document like a separator sheet with the "split" action would,
+    // documentFinished is emitted when its pages are saved
+    Q_SCRIPTABLE void closeDocument() { emit requestedCloseDocument(); }
+
+    // Record the time spent in each step of the page processing (acquire, convert,
+    // encode, write, ...) until stopTrace, which writes the spans to fileName as a
+    // Chrome trace for chrome://tracing or ui.perfetto.dev
+    Q_SCRIPTABLE void startTrace(const QString &fileName) { emit requestedStartTrace(fileName); }
+
+    // Write the trace, returns an error message or an empty string
+    Q_SCRIPTABLE QString stopTrace()
+    {
+        emit requestedStopTrace();
+        return reply().join(QLatin1String());
+    }
+
     // Return device name, like "Hewlett-Packard:Scanjet 4370"
     Q_SCRIPTABLE QString getDeviceName()
     {
@@ -140,10 +198,130 @@ public Q_SLOTS:
         emit requestedSetSelection(ensureStringList(options));
     }
 
+    // Regions cut from every scan and saved as separate files, "Image-0001-1.png", "Image-0001-2.png"...,
+    // so that several photos or cards are scanned in one pass. One string per region in form
+    // "tl-x,tl-y,br-x,br-y" (mm on the bed, like the selection), or the single string "auto" to
+    // detect the items on the bed. The selection is set to cover all regions. An empty list saves
+    // whole pages again.
+    Q_SCRIPTABLE void setScanRegions(const QStringList &regions)
+    {
+        emit requestedSetScanRegions(ensureStringList(regions));
+    }
+
+    // Returns the current regions in the form of setScanRegions
+    Q_SCRIPTABLE QStringList getScanRegions()
+    {
+        emit requestedGetScanRegions();
+        return reply();
+    }
+
+    // Saves regions to KConfigGroup named "Regions For %Current_Device% - Profile %profile%",
+    // switchToProfile applies them together with the options of the profile
+    Q_SCRIPTABLE void saveScanRegionsToProfile(const QStringList &regions, const QString &profile = defaultProfile)
+    {
+        emit requestedSaveScanRegionsToProfile(ensureStringList(regions), profile);
+    }
+
+    // Post-processing applied to the scanned data before it is saved, instead of an external
+    // editor run on the saved file. Stages are separated by ';', like
+    // "levels=10:245;gamma=1.1;balance=highlights:-18:0:0;unsharp=0.8:2;despeckle;rotate=180".
+    // Returns an error message if spec is invalid, the current pipeline is kept then.
+    Q_SCRIPTABLE QString setPipeline(const QString &spec)
+    {
+        emit requestedSetPipeline(spec);
+        return reply().join(QLatin1String());
+    }
+
+    // Returns the current post-processing pipeline
+    Q_SCRIPTABLE QString getPipeline()
+    {
+        emit requestedGetPipeline();
+        return reply().join(QLatin1String());
+    }
+
+    // Saves a pipeline to KConfigGroup named "Pipeline For %Current_Device% - Profile %profile%",
+    // switchToProfile applies it together with the options of the profile
+    Q_SCRIPTABLE void savePipelineToProfile(const QString &spec, const QString &profile = defaultProfile)
+    {
+        emit requestedSavePipelineToProfile(spec, profile);
+    }
+
+    // Returns the known devices without waiting for a device discovery, one string per device in form
+    // "name;vendor;model;type;lastSeen;state", where state is "live" if the device was found by the
+    // latest discovery and "cached" otherwise. A new discovery is started in the background.
+    Q_SCRIPTABLE QStringList getDeviceList()
+    {
+        emit requestedDeviceList();
+        return reply();
+    }
+
+    // Maps a scanner button option (like "button 0") to an action handled inside Skanlite:
+    // "scan", "scan:<profile>", "profile:<profile>" or "cancel". An empty action removes the mapping.
+    // An invalid action is rejected with an org.freedesktop.DBus.Error.InvalidArgs error.
+    Q_SCRIPTABLE void setButtonAction(const QString &optionName, const QString &action)
+    {
+        emit requestedSetButtonAction(optionName, action);
+        const QString error = reply().join(QLatin1String());
+        if (!error.isEmpty() && calledFromDBus()) {
+            sendErrorReply(QDBusError::InvalidArgs, error);
+        }
+    }
+
+    // Returns the button mappings in form "{"button 0=scan", "button 1=profile:2"}"
+    Q_SCRIPTABLE QStringList getButtonActions()
+    {
+        emit requestedButtonActions();
+        return reply();
+    }
+
 Q_SIGNALS:
 
     Q_SCRIPTABLE void imageSaved(const QString &strFilename);
 
+    // Same as imageSaved, with the page properties so that the file does not have to be read again:
+    // "width", "height", "dpi", "pixelFormat" (BlackWhite, Gray8, Gray16, RGB8, RGB16),
+    // "fileFormat", "fileSize", "fileNumber" (of the name), "sha256", "encodeMs", "writeBackend" (pwrite, direct, io_uring, io_uring+direct),
+    // "blankScore" (1.0 = empty page), "colorMode" (color, gray, bw),
+    // "derivatives" (file names of the thumbnails and proxies, see the "Derivatives" settings),
+    // "perceptualHash" (64 bit dHash as hex), "duplicateOf" (the similar recent page, if any)
+    // and "rawCapture" (the kept scan data, see the Image Saving/RawCapture setting).
+    // Images cut from a page (see setScanRegions) have "region" (1, 2...), "regionCount", "regionOf"
+    // (the page URL) and "regionRect" ("x,y,width,height" in pixels of the page).
+    // With separator sheets configured, "document" (1, 2...) and "pageInDocument" (1, 2...).
+    // "pageId" is the id of the scanned page sent with pageBufferReady.
+    Q_SCRIPTABLE void imageSavedWithMetadata(const QString &strFilename, const QVariantMap &metadata);
+
+    // Emitted instead of imageSaved when writing the image failed, error names the failing step
+    // and the system error. No partial file is left under strFilename.
+    Q_SCRIPTABLE void imageSaveFailed(const QString &strFilename, const QString &error);
+
+    // A page was not saved because it looks like the recently saved page duplicateOf
+    // (double feed or re-scan), hash is its perceptual hash. Only with Saving/DuplicateCheck=skip.
+    Q_SCRIPTABLE void duplicatePageSkipped(const QString &hash, const QString &duplicateOf);
+
+    // The text of a saved page was recognized, sidecars are the written hOCR and text files.
+    // Only when enabled in the OCR settings, see PageOcr.h.
+    Q_SCRIPTABLE void ocrTextReady(const QString &strFilename, const QString &text, const QStringList &sidecars);
+
+    // A separator sheet with the barcode code was scanned and not saved, action is its
+    // entry in the "Separator Actions" settings, like "split" or "profile:Color"
+    Q_SCRIPTABLE void separatorDetected(const QString &code, const QString &action);
+
+    // All pages of a document ended by a separator sheet or by closeDocument were saved,
+    // files are the saved images in page order, a page that failed to save is left out
+    Q_SCRIPTABLE void documentFinished(int document, const QStringList &files);
+
+    // A quick preview is done, regions are the items found on the bed in the form of setScanRegions
+    Q_SCRIPTABLE void quickPreviewReady(const QStringList &regions);
+
+    // The raw data of a scanned page, sent before the page is saved when enabled with setSharedMemoryExport.
+    // fd refers to a sealed memory file that can be mapped read-only, the data has bytesPerLine * height bytes.
+    // pageId counts the scanned pages of this Skanlite, the images saved from the page carry it as "pageId"
+    // in imageSavedWithMetadata. format is BlackWhite, Gray8, Gray16, RGB8 or RGB16, 16 bit samples are in
+    // the byte order of the host.
+    Q_SCRIPTABLE void pageBufferReady(const QDBusUnixFileDescriptor &fd, int pageId, int width, int height, int bytesPerLine,
+                                      const QString &format, int dpi);
+
     // Below are 4 signals which are just forwarded from KSaneWidget.
     // You can take a look in KSaneWidget.h for detailed arguments description
 
@@ -151,6 +329,12 @@ Q_SIGNALS:
     Q_SCRIPTABLE void userMessage(int type, const QString &strStatus);
     Q_SCRIPTABLE void scanProgress(int percent);
     Q_SCRIPTABLE void buttonPressed(const QString &optionName, const QString &optionLabel, bool pressed);
+
+    // Continuous scanning stopped, reason is like "feeder empty", "page limit" or "stopped"
+    Q_SCRIPTABLE void continuousScanFinished(int pages, const QString &reason);
+
+    // Time from a button press mapped to a scan action until the scan started
+    Q_SCRIPTABLE void buttonTriggerLatency(qlonglong microseconds);
 };
 
 #endif
@@ -0,0 +1,196 @@
+/* ============================================================
+ * Description : Thumbnails and low resolution proxies of the
+ *               scanned pages.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "Derivatives.h"
+
+#include <QFileInfo>
+#include <QStringList>
+#include <QVector>
+
+#include <KSaneWidget>
+
+#include <string.h>
+
+using namespace KSaneIface;
+
+QList<Derivatives::Spec> Derivatives::parse(const QMap<QString, QString> &entries)
+{
+    QList<Spec> specs;
+    QMap<QString, QString>::const_iterator it;
+    for (it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QStringList fields = it.value().split(QLatin1Char(','));
+        if (fields.size() < 2) {
+            continue;
+        }
+        Spec spec;
+        spec.tag = it.key();
+        QString size = fields[0].trimmed().toLower();
+        if (size.endsWith(QLatin1String("px"))) {
+            size.chop(2);
+            spec.maxSize = size.toInt();
+        }
+        else if (size.endsWith(QLatin1String("dpi"))) {
+            size.chop(3);
+            spec.dpi = size.toInt();
+        }
+        spec.format = fields[1].trimmed().toLower();
+        if (fields.size() > 2) {
+            spec.quality = fields[2].trimmed().toInt();
+        }
+        if ((spec.maxSize > 0 || spec.dpi > 0) && !spec.format.isEmpty()) {
+            specs.append(spec);
+        }
+    }
+    return specs;
+}
+
+QString Derivatives::fileName(const QString &fileName, const Spec &spec)
+{
+    const QFileInfo info(fileName);
+    return QStringLiteral("%1/%2.%3.%4").arg(info.path(), info.completeBaseName(), spec.tag, spec.format);
+}
+
+namespace
+{
+struct Target {
+    Derivatives::Image image;
+    QVector<int>       column;   // target column of each source column
+    QVector<int>       columns;  // number of source columns per target column
+    QVector<quint32>   sums;
+    int                row = 0;  // target row being accumulated
+    int                rows = 0; // source rows accumulated so far
+};
+}
+
+static void flushRow(Target &target, int channels)
+{
+    if (target.rows == 0) {
+        return;
+    }
+    uchar *dst = reinterpret_cast<uchar *>(target.image.data.data()) + qint64(target.row) * target.image.bpl;
+    for (int x = 0; x < target.image.width; ++x) {
+        const quint32 count = quint32(target.columns[x]) * target.rows;
+        for (int c = 0; c < channels; ++c) {
+            dst[x * channels + c] = (target.sums[x * channels + c] + count / 2) / count;
+        }
+    }
+    target.sums.fill(0);
+    target.rows = 0;
+}
+
+QList<Derivatives::Image> Derivatives::downsample(const QByteArray &data, int width, int height, int bpl, int format,
+                                                  int dpi, const QList<Spec> &specs)
+{
+    QList<Image> images;
+    if (width <= 0 || height <= 0 || data.size() < qint64(bpl) * height) {
+        return images;
+    }
+    const bool color = (format == KSaneWidget::FormatRGB_8_C || format == KSaneWidget::FormatRGB_16_C);
+    const int channels = color ? 3 : 1;
+
+    QVector<Target> targets;
+    foreach (const Spec &spec, specs) {
+        // never scale up
+        double scale = 1.0;
+        if (spec.maxSize > 0) {
+            scale = qMin(1.0, double(spec.maxSize) / qMax(width, height));
+        }
+        else if (spec.dpi > 0 && dpi > 0) {
+            scale = qMin(1.0, double(spec.dpi) / dpi);
+        }
+        Target target;
+        target.image.width = qMax(1, qRound(width * scale));
+        target.image.height = qMax(1, qRound(height * scale));
+        target.image.bpl = target.image.width * channels;
+        target.image.format = color ? KSaneWidget::FormatRGB_8_C : KSaneWidget::FormatGrayScale8;
+        target.image.dpi = qMax(1, qRound(dpi * double(target.image.width) / width));
+        target.image.data.resize(qint64(target.image.bpl) * target.image.height);
+        target.column.resize(width);
+        target.columns.fill(0, target.image.width);
+        for (int x = 0; x < width; ++x) {
+            target.column[x] = int(qint64(x) * target.image.width / width);
+            target.columns[target.column[x]]++;
+        }
+        target.sums.fill(0, target.image.width * channels);
+        targets.append(target);
+    }
+
+    // every source row is converted to 8 bit once and added to all targets
+    QVector<uchar> row(width * channels);
+    for (int y = 0; y < height; ++y) {
+        const uchar *src = reinterpret_cast<const uchar *>(data.constData()) + qint64(y) * bpl;
+        switch (format) {
+        case KSaneWidget::FormatBlackWhite:
+            // SANE line art uses 1 for black
+            for (int x = 0; x < width; ++x) {
+                row[x] = (src[x / 8] & (0x80 >> (x % 8))) ? 0 : 255;
+            }
+            break;
+        case KSaneWidget::FormatGrayScale8:
+        case KSaneWidget::FormatRGB_8_C:
+            memcpy(row.data(), src, width * channels);
+            break;
+        case KSaneWidget::FormatGrayScale16:
+        case KSaneWidget::FormatRGB_16_C:
+            // host byte order
+            for (int i = 0; i < width * channels; ++i) {
+                quint16 value;
+                memcpy(&value, src + i * 2, 2);
+                row[i] = value >> 8;
+            }
+            break;
+        default:
+            return images;
+        }
+
+        for (int t = 0; t < targets.size(); ++t) {
+            Target &target = targets[t];
+            const int targetRow = int(qint64(y) * target.image.height / height);
+            if (targetRow != target.row) {
+                flushRow(target, channels);
+                target.row = targetRow;
+            }
+            quint32 *sums = target.sums.data();
+            const int *column = target.column.constData();
+            if (channels == 1) {
+                for (int x = 0; x < width; ++x) {
+                    sums[column[x]] += row[x];
+                }
+            }
+            else {
+                for (int x = 0; x < width; ++x) {
+                    quint32 *sum = sums + column[x] * 3;
+                    sum[0] += row[x * 3];
+                    sum[1] += row[x * 3 + 1];
+                    sum[2] += row[x * 3 + 2];
+                }
+            }
+            target.rows++;
+        }
+    }
+
+    for (int t = 0; t < targets.size(); ++t) {
+        flushRow(targets[t], channels);
+        images.append(targets[t].image);
+    }
+    return images;
+}
@@ -0,0 +1,66 @@
+/* ============================================================
+ * Description : Thumbnails and low resolution proxies of the
+ *               scanned pages.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef Derivatives_h
+#define Derivatives_h
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+// Smaller versions of a page that are saved next to it, computed from the
+// scanned data so that the saved file does not have to be decoded again.
+namespace Derivatives
+{
+    struct Spec {
+        QString tag;         // part of the file name, "Image-0001.<tag>.<format>"
+        int     maxSize = 0; // longest side in pixels, or
+        int     dpi = 0;     // resolution
+        QString format;      // file suffix, e.g. "jpg" or "webp"
+        int     quality = -1;
+    };
+
+    struct Image {
+        QByteArray data;
+        int        width;
+        int        height;
+        int        bpl;
+        int        format; // KSaneWidget::FormatGrayScale8 or FormatRGB_8_C
+        int        dpi;
+    };
+
+    // One entry per derivative, "<tag>=<size>,<format>[,<quality>]" where size is
+    // "<n>px" for the longest side or "<n>dpi", e.g. "thumbnail=256px,jpg,80".
+    QList<Spec> parse(const QMap<QString, QString> &entries);
+
+    // File name of the derivative of fileName
+    QString fileName(const QString &fileName, const Spec &spec);
+
+    // Box filtered (area averaged) 8 bit versions of the page, all of them are
+    // computed in one pass over the source rows. Gray and black and white
+    // pages give gray images, color pages give RGB images.
+    QList<Image> downsample(const QByteArray &data, int width, int height, int bpl, int format, int dpi,
+                            const QList<Spec> &specs);
+}
+
+#endif
@@ -0,0 +1,127 @@
+/* ============================================================
+ * Description : Persistent cache of discovered scanner devices.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "DeviceCache.h"
+
+#include <KSharedConfig>
+#include <KConfigGroup>
+
+static const QLatin1String deviceCacheGroup("Device Cache");
+
+DeviceCache::DeviceCache()
+{
+    read();
+}
+
+QString DeviceCache::lastDevice() const
+{
+    KConfigGroup general(KSharedConfig::openConfig(), "General");
+    return general.readEntry("LastDevice", QString());
+}
+
+void DeviceCache::setLastDevice(const QString &name, const QString &vendor, const QString &model)
+{
+    KConfigGroup general(KSharedConfig::openConfig(), "General");
+    general.writeEntry("LastDevice", name);
+    general.sync();
+
+    Entry *entry = find(name);
+    if (!entry) {
+        m_entries.append(Entry());
+        entry = &m_entries.last();
+        entry->name = name;
+    }
+    entry->vendor = vendor;
+    entry->model = model;
+    entry->lastSeen = QDateTime::currentDateTime();
+    write(*entry);
+}
+
+void DeviceCache::update(const QList<KSaneIface::KSaneWidget::DeviceInfo> &deviceList)
+{
+    for (int i = 0; i < m_entries.size(); ++i) {
+        m_entries[i].live = false;
+    }
+
+    const QDateTime now = QDateTime::currentDateTime();
+    foreach (const KSaneIface::KSaneWidget::DeviceInfo &info, deviceList) {
+        Entry *entry = find(info.name);
+        if (!entry) {
+            m_entries.append(Entry());
+            entry = &m_entries.last();
+            entry->name = info.name;
+        }
+        entry->vendor = info.vendor;
+        entry->model = info.model;
+        entry->type = info.type;
+        entry->lastSeen = now;
+        entry->live = true;
+        write(*entry);
+    }
+}
+
+QStringList DeviceCache::serialize() const
+{
+    QStringList list;
+    foreach (const Entry &entry, m_entries) {
+        list.append(QStringList({entry.name, entry.vendor, entry.model, entry.type,
+                                 entry.lastSeen.toString(Qt::ISODate),
+                                 entry.live ? QLatin1String("live") : QLatin1String("cached")})
+                    .join(QLatin1Char(';')));
+    }
+    return list;
+}
+
+void DeviceCache::read()
+{
+    KConfigGroup cache(KSharedConfig::openConfig(), deviceCacheGroup);
+    foreach (const QString &name, cache.groupList()) {
+        KConfigGroup device = cache.group(name);
+        Entry entry;
+        entry.name = name;
+        entry.vendor = device.readEntry("Vendor", QString());
+        entry.model = device.readEntry("Model", QString());
+        entry.type = device.readEntry("Type", QString());
+        entry.lastSeen = device.readEntry("LastSeen", QDateTime());
+        m_entries.append(entry);
+    }
+}
+
+void DeviceCache::write(const Entry &entry)
+{
+    KConfigGroup cache(KSharedConfig::openConfig(), deviceCacheGroup);
+    KConfigGroup device = cache.group(entry.name);
+    device.writeEntry("Vendor", entry.vendor);
+    device.writeEntry("Model", entry.model);
+    device.writeEntry("Type", entry.type);
+    device.writeEntry("LastSeen", entry.lastSeen);
+    device.sync();
+}
+
+DeviceCache::Entry *DeviceCache::find(const QString &name)
+{
+    for (int i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].name == name) {
+            return &m_entries[i];
+        }
+    }
+    return nullptr;
+}
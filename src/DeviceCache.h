@@ -0,0 +1,68 @@
+/* ============================================================
+ * Description : Persistent cache of discovered scanner devices.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef DeviceCache_h
+#define DeviceCache_h
+
+#include <QDateTime>
+#include <QList>
+#include <QStringList>
+
+#include <KSaneWidget>
+
+// Remembers the devices found by the SANE device discovery together with the
+// time they were last seen, so that the last used scanner can be opened
+// without waiting for a full (network) discovery on the next start.
+class DeviceCache
+{
+public:
+    struct Entry {
+        QString   name;
+        QString   vendor;
+        QString   model;
+        QString   type;
+        QDateTime lastSeen;
+        bool      live = false;
+    };
+
+    DeviceCache();
+
+    // SANE name of the device that was opened last time, empty if none
+    QString lastDevice() const;
+    void setLastDevice(const QString &name, const QString &vendor, const QString &model);
+
+    // Merge the result of a (background) device discovery into the cache
+    void update(const QList<KSaneIface::KSaneWidget::DeviceInfo> &deviceList);
+
+    const QList<Entry> &entries() const { return m_entries; }
+
+    // One string per device: "name;vendor;model;type;lastSeen;live|cached"
+    QStringList serialize() const;
+
+private:
+    void read();
+    void write(const Entry &entry);
+    Entry *find(const QString &name);
+
+    QList<Entry> m_entries;
+};
+
+#endif
@@ -0,0 +1,262 @@
+/* ============================================================
+ * Description : File names of the saved pages, numbers reserved
+ *               atomically in the target directory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "FileNamer.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QPair>
+#include <QRegularExpression>
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const QLatin1String countersFileName(".skanlite-counters");
+// numbers tried past the counter before giving up, other writers may have taken some
+static const int maxTries = 100000;
+// names with the time in them would grow the file forever, only recent ones are kept
+static const int maxCounters = 256;
+
+void FileNamer::setTemplate(const QString &nameTemplate)
+{
+    m_template = nameTemplate.isEmpty() ? QStringLiteral("{prefix}{n:4}") : nameTemplate;
+    if (!m_template.contains(QRegularExpression(QStringLiteral("\\{n(:\\d+)?\\}")))) {
+        m_template += QStringLiteral("{n:4}");
+    }
+    QString rest = m_template;
+    rest.remove(QRegularExpression(QStringLiteral("\\{(prefix|n(:\\d+)?)\\}")));
+    m_numbersOnly = !rest.contains(QRegularExpression(QStringLiteral("\\{\\w+(:\\d+)?\\}")));
+}
+
+static QString safeFileName(QString name)
+{
+    name.replace(QRegularExpression(QStringLiteral("[^\\w.+-]")), QStringLiteral("_"));
+    return name;
+}
+
+QString FileNamer::expand(const Fields &fields, const QString &suffix, int number) const
+{
+    static const QRegularExpression field(QStringLiteral("\\{(\\w+)(?::(\\d+))?\\}"));
+    QString name;
+    int last = 0;
+    QRegularExpressionMatchIterator it = field.globalMatch(m_template);
+    while (it.hasNext()) {
+        const QRegularExpressionMatch match = it.next();
+        name += m_template.midRef(last, match.capturedStart() - last);
+        last = match.capturedEnd();
+        const QString key = match.captured(1);
+        const int width = match.captured(2).toInt();
+        if (key == QLatin1String("n")) {
+            // the counter of a name is kept under the name without the number
+            name += (number < 0) ? QStringLiteral("#") : QStringLiteral("%1").arg(number, width, 10, QLatin1Char('0'));
+        }
+        else if (key == QLatin1String("page")) {
+            name += QStringLiteral("%1").arg(fields.page, width, 10, QLatin1Char('0'));
+        }
+        else if (key == QLatin1String("prefix")) {
+            name += fields.prefix;
+        }
+        else if (key == QLatin1String("date")) {
+            name += fields.time.toString(QStringLiteral("yyyy-MM-dd"));
+        }
+        else if (key == QLatin1String("time")) {
+            name += fields.time.toString(QStringLiteral("HHmmss"));
+        }
+        else if (key == QLatin1String("device")) {
+            name += safeFileName(fields.device);
+        }
+        else if (key == QLatin1String("profile")) {
+            name += safeFileName(fields.profile);
+        }
+        else {
+            name += match.captured(0);
+        }
+    }
+    name += m_template.midRef(last);
+    // the fields may not create directories
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+    return suffix.isEmpty() ? name : name + QLatin1Char('.') + suffix;
+}
+
+namespace
+{
+// The counters file, locked while it is open. Without locking (e.g. NFS
+// without lockd) the names are still unique thanks to O_EXCL, only the
+// counter may be behind and a few numbers are tried more.
+class Counters
+{
+public:
+    // A read only file is not created, it reads as no counters if it does not exist
+    Counters(const QString &dir, bool readOnly)
+        : m_readOnly(readOnly)
+    {
+        const QByteArray path = QFile::encodeName(QDir(dir).filePath(countersFileName));
+        m_fd = readOnly ? ::open(path.constData(), O_RDONLY | O_CLOEXEC)
+                        : ::open(path.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (m_fd < 0) {
+            return;
+        }
+        struct flock lock = {};
+        lock.l_type = readOnly ? F_RDLCK : F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        int result;
+        do {
+            result = fcntl(m_fd, F_SETLKW, &lock);
+        } while (result < 0 && errno == EINTR);
+        if (result < 0) {
+            qWarning() << "Could not lock" << path << strerror(errno);
+        }
+
+        QByteArray data;
+        char buffer[4096];
+        ssize_t size;
+        while ((size = pread(m_fd, buffer, sizeof(buffer), data.size())) > 0) {
+            data.append(buffer, size);
+        }
+        // one "<next number> <name with # for the number>" line per name, the most recent last
+        foreach (const QByteArray &line, data.split('\n')) {
+            const int space = line.indexOf(' ');
+            if (space > 0) {
+                m_next.append(qMakePair(QString::fromUtf8(line.mid(space + 1)), line.left(space).toInt()));
+            }
+        }
+    }
+
+    ~Counters()
+    {
+        // closing the file releases the lock
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    // 0 if the name has no counter yet
+    int next(const QString &key) const
+    {
+        for (int i = m_next.size() - 1; i >= 0; --i) {
+            if (m_next[i].first == key) {
+                return m_next[i].second;
+            }
+        }
+        return 0;
+    }
+
+    void setNext(const QString &key, int number)
+    {
+        if (m_fd < 0 || m_readOnly) {
+            return;
+        }
+        for (int i = m_next.size() - 1; i >= 0; --i) {
+            if (m_next[i].first == key) {
+                m_next.removeAt(i);
+            }
+        }
+        m_next.append(qMakePair(key, number));
+        while (m_next.size() > maxCounters) {
+            m_next.removeFirst();
+        }
+        QByteArray data;
+        foreach (const Counter &counter, m_next) {
+            data += QByteArray::number(counter.second) + ' ' + counter.first.toUtf8() + '\n';
+        }
+        if (ftruncate(m_fd, 0) < 0 || pwrite(m_fd, data.constData(), data.size(), 0) != data.size()) {
+            qWarning() << "Could not update the file counters" << strerror(errno);
+        }
+    }
+
+private:
+    typedef QPair<QString, int> Counter;
+
+    int            m_fd = -1;
+    bool           m_readOnly;
+    QList<Counter> m_next;
+};
+}
+
+int FileNamer::firstNumber(int counter, int startFrom) const
+{
+    // a counter of names with a date, device or profile in them must not be
+    // pushed on by the numbers of the other names
+    if (counter > 0 && !m_numbersOnly) {
+        return counter;
+    }
+    return qMax(startFrom, counter);
+}
+
+QString FileNamer::reserve(const QString &dir, const QString &suffix, const Fields &fields, int startFrom,
+                           int *number, QString *error)
+{
+    Counters counters(dir, false);
+    const QString key = expand(fields, suffix, -1);
+    int n = firstNumber(counters.next(key), startFrom);
+    for (int tries = 0; tries < maxTries; ++tries, ++n) {
+        const QString name = QDir(dir).filePath(expand(fields, suffix, n));
+        const int fd = ::open(QFile::encodeName(name).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd >= 0) {
+            ::close(fd);
+            counters.setNext(key, n + 1);
+            if (number) {
+                *number = n;
+            }
+            return name;
+        }
+        if (errno != EEXIST) {
+            if (error) {
+                *error = QStringLiteral("Could not create %1: %2").arg(name, QString::fromLocal8Bit(strerror(errno)));
+            }
+            return QString();
+        }
+    }
+    if (error) {
+        *error = QStringLiteral("No free file name in %1").arg(dir);
+    }
+    return QString();
+}
+
+QString FileNamer::suggest(const QString &dir, const QString &suffix, const Fields &fields, int startFrom, int *number)
+{
+    const QString key = expand(fields, suffix, -1);
+    int n = firstNumber(Counters(dir, true).next(key), startFrom);
+    QString name = QDir(dir).filePath(expand(fields, suffix, n));
+    for (int tries = 0; tries < maxTries && QFileInfo::exists(name); ++tries) {
+        name = QDir(dir).filePath(expand(fields, suffix, ++n));
+    }
+    if (number) {
+        *number = n;
+    }
+    return name;
+}
+
+void FileNamer::release(const QString &fileName)
+{
+    struct stat info;
+    const QByteArray name = QFile::encodeName(fileName);
+    if (stat(name.constData(), &info) == 0 && S_ISREG(info.st_mode) && info.st_size == 0) {
+        unlink(name.constData());
+    }
+}
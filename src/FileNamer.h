@@ -0,0 +1,88 @@
+/* ============================================================
+ * Description : File names of the saved pages, numbers reserved
+ *               atomically in the target directory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef FileNamer_h
+#define FileNamer_h
+
+#include <QDateTime>
+#include <QString>
+
+// Hands out the names of the saved pages from a template without scanning the
+// target directory. The next number of every name is kept in a
+// ".skanlite-counters" file in the directory, read and updated under an fcntl()
+// lock, and the name is claimed by creating the empty file with O_EXCL. Several
+// Skanlite instances, also on other hosts sharing the directory, never get the
+// same name; a file created by someone else is skipped.
+//
+// The template fields are
+//   {prefix}          the name prefix from the settings
+//   {n} or {n:4}      the number, zero padded to the given width
+//   {date} {time}     of the scan, "2019-03-13" and "142501"
+//   {device}          the scanner, characters not allowed in file names replaced
+//   {profile}         the last profile switched to
+//   {page} or {page:3} the page in the batch or document
+// "{prefix}{n:4}" gives the names Skanlite always used, {n:4} is added to a
+// template without {n}.
+//
+// Every name without the number, e.g. every date, has its own counter that
+// starts at the start number of the settings. Only the names of a template
+// with just {prefix} and {n} also follow a start number raised above their
+// counter, like the number field of the save location always did.
+class FileNamer
+{
+public:
+    struct Fields {
+        QString   prefix;
+        QString   device;
+        QString   profile;
+        int       page = 0;
+        QDateTime time;
+    };
+
+    void setTemplate(const QString &nameTemplate);
+    const QString &nameTemplate() const { return m_template; }
+    // The template has no fields but {prefix} and {n}
+    bool numbersOnly() const { return m_numbersOnly; }
+
+    // Creates the empty file of the next free name in dir, numbered from the kept
+    // counter of the name, see above for startFrom. Returns the file path and its
+    // number, an empty string and the error if no file could be created.
+    QString reserve(const QString &dir, const QString &suffix, const Fields &fields, int startFrom,
+                    int *number, QString *error = nullptr);
+
+    // The next free name, for proposing it in the file dialog, nothing is created
+    QString suggest(const QString &dir, const QString &suffix, const Fields &fields, int startFrom, int *number);
+
+    // The file name of the fields and number, without the directory
+    QString expand(const Fields &fields, const QString &suffix, int number) const;
+
+    // Removes the file of a reserved name that was not saved, files with data are kept
+    static void release(const QString &fileName);
+
+private:
+    int firstNumber(int counter, int startFrom) const;
+
+    QString m_template = QStringLiteral("{prefix}{n:4}");
+    bool    m_numbersOnly = true;
+};
+
+#endif
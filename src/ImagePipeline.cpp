@@ -0,0 +1,498 @@
+/* ============================================================
+ * Description : Post-processing of the scanned data before it is
+ *               encoded: levels, curves, color balance, sharpening,
+ *               despeckling and rotation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "ImagePipeline.h"
+#include "PageAnalysis.h"
+#include "SampleLut.h"
+
+#include <QPair>
+#include <QStringList>
+#include <QtMath>
+
+#include <KSaneWidget>
+
+#include <algorithm>
+#include <string.h>
+
+using namespace KSaneIface;
+
+ImagePipeline::Pipeline ImagePipeline::parse(const QString &spec, QString *error)
+{
+    Pipeline pipeline;
+    const QStringList stages = spec.split(QLatin1Char(';'), QString::SkipEmptyParts);
+    foreach (const QString &text, stages) {
+        const int equals = text.indexOf(QLatin1Char('='));
+        const QString name = text.left(equals).trimmed().toLower();
+        QStringList values;
+        if (equals >= 0) {
+            values = text.mid(equals + 1).split(QLatin1Char(':'));
+        }
+
+        Stage stage;
+        int minArgs = 0;
+        int maxArgs = 0;
+        if (name == QLatin1String("levels")) {
+            stage.op = Levels;
+            minArgs = 2;
+            maxArgs = 3;
+        }
+        else if (name == QLatin1String("gamma")) {
+            stage.op = Gamma;
+            minArgs = maxArgs = 1;
+        }
+        else if (name == QLatin1String("curve")) {
+            stage.op = Curve;
+            minArgs = 4;
+            maxArgs = 64;
+        }
+        else if (name == QLatin1String("balance")) {
+            stage.op = ColorBalance;
+            const QString range = values.isEmpty() ? QString() : values.takeFirst().trimmed().toLower();
+            if (range == QLatin1String("shadows")) {
+                stage.range = 0;
+            }
+            else if (range == QLatin1String("midtones")) {
+                stage.range = 1;
+            }
+            else if (range == QLatin1String("highlights")) {
+                stage.range = 2;
+            }
+            else {
+                if (error) {
+                    *error = QStringLiteral("Unknown balance range \"%1\"").arg(range);
+                }
+                return Pipeline();
+            }
+            minArgs = maxArgs = 3;
+        }
+        else if (name == QLatin1String("unsharp")) {
+            stage.op = Unsharp;
+            minArgs = 1;
+            maxArgs = 3;
+        }
+        else if (name == QLatin1String("despeckle")) {
+            stage.op = Despeckle;
+        }
+        else if (name == QLatin1String("rotate")) {
+            stage.op = Rotate;
+            minArgs = maxArgs = 1;
+        }
+        else {
+            if (error) {
+                *error = QStringLiteral("Unknown stage \"%1\"").arg(name);
+            }
+            return Pipeline();
+        }
+
+        foreach (const QString &value, values) {
+            bool ok = false;
+            stage.args.append(value.trimmed().toDouble(&ok));
+            if (!ok) {
+                if (error) {
+                    *error = QStringLiteral("Invalid argument \"%1\" of %2").arg(value, name);
+                }
+                return Pipeline();
+            }
+        }
+
+        bool valid = (stage.args.size() >= minArgs && stage.args.size() <= maxArgs);
+        if (valid) {
+            switch (stage.op) {
+            case Levels:
+                valid = (stage.args[1] > stage.args[0]) && (stage.args.size() < 3 || stage.args[2] > 0);
+                break;
+            case Gamma:
+                valid = (stage.args[0] > 0);
+                break;
+            case Curve: {
+                valid = (stage.args.size() % 2 == 0);
+                // sorted by the input level
+                QList<QPair<double, double> > points;
+                for (int i = 0; valid && i < stage.args.size(); i += 2) {
+                    points.append(qMakePair(stage.args[i], stage.args[i + 1]));
+                }
+                std::sort(points.begin(), points.end());
+                for (int i = 0; valid && i < points.size(); ++i) {
+                    stage.args[i * 2] = points[i].first;
+                    stage.args[i * 2 + 1] = points[i].second;
+                }
+                break;
+            }
+            case Unsharp:
+                if (stage.args.size() < 2) {
+                    stage.args.append(1);
+                }
+                if (stage.args.size() < 3) {
+                    stage.args.append(0);
+                }
+                valid = (stage.args[0] > 0 && stage.args[0] <= 10 && stage.args[1] >= 1 && stage.args[1] <= 50 && stage.args[2] >= 0);
+                break;
+            case Rotate:
+                valid = (stage.args[0] == 90 || stage.args[0] == 180 || stage.args[0] == 270);
+                break;
+            default:
+                break;
+            }
+        }
+        if (!valid) {
+            if (error) {
+                *error = QStringLiteral("Invalid arguments of %1").arg(name);
+            }
+            return Pipeline();
+        }
+        pipeline.append(stage);
+    }
+
+    if (error) {
+        error->clear();
+    }
+    return pipeline;
+}
+
+namespace
+{
+using namespace ImagePipeline;
+
+bool isPointOperator(Operator op)
+{
+    return op == Levels || op == Gamma || op == Curve || op == ColorBalance;
+}
+
+// v and the result are normalized to 0..1, levels in the arguments are on the 8 bit scale
+double pointValue(const Stage &stage, int channel, int channels, double v)
+{
+    const QVector<double> &args = stage.args;
+    switch (stage.op) {
+    case Levels:
+        v = qBound(0.0, (v * 255 - args[0]) / (args[1] - args[0]), 1.0);
+        return (args.size() > 2) ? qPow(v, 1.0 / args[2]) : v;
+    case Gamma:
+        return qPow(v, 1.0 / args[0]);
+    case Curve: {
+        const double level = v * 255;
+        if (level <= args[0]) {
+            return args[1] / 255;
+        }
+        for (int i = 2; i < args.size(); i += 2) {
+            if (level <= args[i]) {
+                const double t = (args[i] > args[i - 2]) ? (level - args[i - 2]) / (args[i] - args[i - 2]) : 1.0;
+                return qBound(0.0, (args[i - 1] + t * (args[i + 1] - args[i - 1])) / 255, 1.0);
+            }
+        }
+        return qBound(0.0, args[args.size() - 1] / 255, 1.0);
+    }
+    case ColorBalance: {
+        if (channels == 1) {
+            return v;
+        }
+        double weight;
+        switch (stage.range) {
+        case 0:  weight = qMax(0.0, 1.0 - 2.0 * v); break;
+        case 1:  weight = qMax(0.0, 1.0 - qAbs(2.0 * v - 1.0)); break;
+        default: weight = qMax(0.0, 2.0 * v - 1.0); break;
+        }
+        return qBound(0.0, v + args[channel] / 255 * weight, 1.0);
+    }
+    default:
+        return v;
+    }
+}
+
+// one table per channel with all the stages, 16 bit tables end with a padding entry for SampleLut
+template<typename T>
+QVector<T> buildTable(const QList<Stage> &stages, int channels)
+{
+    const int levels = 1 << (8 * sizeof(T));
+    QVector<T> lut(levels * channels + (sizeof(T) == 2 ? 1 : 0), 0);
+    for (int c = 0; c < channels; ++c) {
+        for (int value = 0; value < levels; ++value) {
+            double v = value / double(levels - 1);
+            foreach (const Stage &stage, stages) {
+                v = pointValue(stage, c, channels, v);
+            }
+            lut[c * levels + value] = T(qRound(qBound(0.0, v, 1.0) * (levels - 1)));
+        }
+    }
+    return lut;
+}
+
+void applyLut8(const QList<Stage> &stages, QByteArray &data, int width, int height, int bpl, int channels)
+{
+    const QVector<quint8> lut = buildTable<quint8>(stages, channels);
+    const quint8 *table = lut.constData();
+    uchar *bits = reinterpret_cast<uchar *>(data.data());
+    for (int y = 0; y < height; ++y) {
+        quint8 *row = bits + qint64(y) * bpl;
+        if (channels == 1) {
+            for (int x = 0; x < width; ++x) {
+                row[x] = table[row[x]];
+            }
+        }
+        else {
+            for (int x = 0; x < width; ++x) {
+                row[x * 3] = table[row[x * 3]];
+                row[x * 3 + 1] = table[256 + row[x * 3 + 1]];
+                row[x * 3 + 2] = table[512 + row[x * 3 + 2]];
+            }
+        }
+    }
+}
+
+void applyLut16(const QList<Stage> &stages, QByteArray &data, int width, int height, int bpl, int channels)
+{
+    const QVector<quint16> lut = buildTable<quint16>(stages, channels);
+    uchar *bits = reinterpret_cast<uchar *>(data.data());
+    for (int y = 0; y < height; ++y) {
+        quint16 *row = reinterpret_cast<quint16 *>(bits + qint64(y) * bpl);
+        SampleLut::map16(lut.constData(), channels, row, row, qint64(width) * channels, false);
+    }
+}
+
+// Horizontal box sums of one row, rows outside of the image repeat the edge
+template<typename T>
+void boxRow(const uchar *bits, int y, int width, int height, int bpl, int channels, int radius, quint32 *sums)
+{
+    const T *row = reinterpret_cast<const T *>(bits + qint64(qBound(0, y, height - 1)) * bpl);
+    for (int c = 0; c < channels; ++c) {
+        quint32 sum = 0;
+        for (int k = -radius; k <= radius; ++k) {
+            sum += row[qBound(0, k, width - 1) * channels + c];
+        }
+        for (int x = 0; x < width; ++x) {
+            sums[x * channels + c] = sum;
+            sum += row[qMin(x + radius + 1, width - 1) * channels + c];
+            sum -= row[qMax(x - radius, 0) * channels + c];
+        }
+    }
+}
+
+// The blur is a box filter with running sums, the vertical sums are kept for a
+// ring of 2 * radius + 1 rows. The horizontal sums of a row are taken before
+// the row is sharpened, so the image is changed in place.
+template<typename T>
+void unsharp(QByteArray &data, int width, int height, int bpl, int channels, double amount, int radius, double threshold)
+{
+    const int maxValue = (1 << (8 * sizeof(T))) - 1;
+    const int limit = qRound(threshold * maxValue / 255);
+    const int gain = qRound(amount * 256);
+    const int samples = width * channels;
+    const int window = 2 * radius + 1;
+    const quint32 area = window * window;
+
+    uchar *bits = reinterpret_cast<uchar *>(data.data());
+    QVector<quint32> ring(window * samples);
+    QVector<quint32> column(samples, 0);
+    for (int y = -radius; y <= radius; ++y) {
+        quint32 *sums = ring.data() + ((y + radius) % window) * samples;
+        boxRow<T>(bits, y, width, height, bpl, channels, radius, sums);
+        for (int i = 0; i < samples; ++i) {
+            column[i] += sums[i];
+        }
+    }
+
+    for (int y = 0; y < height; ++y) {
+        T *row = reinterpret_cast<T *>(bits + qint64(y) * bpl);
+        for (int i = 0; i < samples; ++i) {
+            const int value = row[i];
+            const int diff = value - int((column[i] + area / 2) / area);
+            if (qAbs(diff) > limit) {
+                row[i] = T(qBound(0, value + diff * gain / 256, maxValue));
+            }
+        }
+        if (y == height - 1) {
+            break;
+        }
+        // the slot of row y - radius gets row y + radius + 1
+        quint32 *sums = ring.data() + (y % window) * samples;
+        for (int i = 0; i < samples; ++i) {
+            column[i] -= sums[i];
+        }
+        boxRow<T>(bits, y + radius + 1, width, height, bpl, channels, radius, sums);
+        for (int i = 0; i < samples; ++i) {
+            column[i] += sums[i];
+        }
+    }
+}
+
+inline void sort2(int &a, int &b)
+{
+    if (a > b) {
+        qSwap(a, b);
+    }
+}
+
+// median of 9 values with 19 compare and swap steps
+inline int median9(int p[9])
+{
+    sort2(p[1], p[2]); sort2(p[4], p[5]); sort2(p[7], p[8]);
+    sort2(p[0], p[1]); sort2(p[3], p[4]); sort2(p[6], p[7]);
+    sort2(p[1], p[2]); sort2(p[4], p[5]); sort2(p[7], p[8]);
+    sort2(p[0], p[3]); sort2(p[5], p[8]); sort2(p[4], p[7]);
+    sort2(p[3], p[6]); sort2(p[1], p[4]); sort2(p[2], p[5]);
+    sort2(p[4], p[7]); sort2(p[4], p[2]); sort2(p[6], p[4]);
+    sort2(p[4], p[2]);
+    return p[4];
+}
+
+// 3x3 median, the original rows above and below are kept while the row is replaced
+template<typename T>
+void despeckle(QByteArray &data, int width, int height, int bpl, int channels)
+{
+    const int samples = width * channels;
+    uchar *bits = reinterpret_cast<uchar *>(data.data());
+    QVector<T> above(samples);
+    QVector<T> current(samples);
+    QVector<T> below(samples);
+    memcpy(current.data(), bits, samples * sizeof(T));
+    above = current;
+
+    for (int y = 0; y < height; ++y) {
+        memcpy(below.data(), bits + qint64(qMin(y + 1, height - 1)) * bpl, samples * sizeof(T));
+        T *row = reinterpret_cast<T *>(bits + qint64(y) * bpl);
+        const T *rows[3] = { above.constData(), current.constData(), below.constData() };
+        for (int x = 0; x < width; ++x) {
+            const int left = qMax(0, x - 1) * channels;
+            const int right = qMin(width - 1, x + 1) * channels;
+            for (int c = 0; c < channels; ++c) {
+                int p[9];
+                for (int r = 0; r < 3; ++r) {
+                    p[r * 3] = rows[r][left + c];
+                    p[r * 3 + 1] = rows[r][x * channels + c];
+                    p[r * 3 + 2] = rows[r][right + c];
+                }
+                row[x * channels + c] = T(median9(p));
+            }
+        }
+        above.swap(current);
+        current.swap(below);
+    }
+}
+
+void rotate(QByteArray &data, int &width, int &height, int &bpl, int pixelBytes, int degrees)
+{
+    if (degrees == 180) {
+        uchar *bits = reinterpret_cast<uchar *>(data.data());
+        uchar pixel[8];
+        for (int y = 0; y < (height + 1) / 2; ++y) {
+            uchar *top = bits + qint64(y) * bpl;
+            uchar *bottom = bits + qint64(height - 1 - y) * bpl;
+            const int count = (top == bottom) ? width / 2 : width;
+            for (int x = 0; x < count; ++x) {
+                uchar *a = top + x * pixelBytes;
+                uchar *b = bottom + (width - 1 - x) * pixelBytes;
+                memcpy(pixel, a, pixelBytes);
+                memcpy(a, b, pixelBytes);
+                memcpy(b, pixel, pixelBytes);
+            }
+        }
+        return;
+    }
+
+    // the rotated rows are written one after the other
+    const int newWidth = height;
+    const int newHeight = width;
+    const int newBpl = newWidth * pixelBytes;
+    QByteArray rotated(qint64(newBpl) * newHeight, Qt::Uninitialized);
+    const uchar *src = reinterpret_cast<const uchar *>(data.constData());
+    uchar *dst = reinterpret_cast<uchar *>(rotated.data());
+    for (int y = 0; y < newHeight; ++y) {
+        uchar *row = dst + qint64(y) * newBpl;
+        for (int x = 0; x < newWidth; ++x) {
+            // clockwise: the new row y is the old column y read from the bottom
+            const int srcX = (degrees == 90) ? y : width - 1 - y;
+            const int srcY = (degrees == 90) ? height - 1 - x : x;
+            memcpy(row + x * pixelBytes, src + qint64(srcY) * bpl + srcX * pixelBytes, pixelBytes);
+        }
+    }
+    data = rotated;
+    width = newWidth;
+    height = newHeight;
+    bpl = newBpl;
+}
+}
+
+void ImagePipeline::apply(const Pipeline &pipeline, QByteArray &data, int &width, int &height, int &bpl, int format)
+{
+    const int pixelBytes = PageAnalysis::bytesPerPixel(format);
+    if (pipeline.isEmpty() || pixelBytes == 0 || width <= 0 || height <= 0 || data.size() < qint64(bpl) * height) {
+        return;
+    }
+    const bool wide = (format == KSaneWidget::FormatGrayScale16 || format == KSaneWidget::FormatRGB_16_C);
+    const int channels = (format == KSaneWidget::FormatRGB_8_C || format == KSaneWidget::FormatRGB_16_C) ? 3 : 1;
+
+    int i = 0;
+    while (i < pipeline.size()) {
+        const Stage &stage = pipeline[i];
+        if (isPointOperator(stage.op)) {
+            int end = i + 1;
+            while (end < pipeline.size() && isPointOperator(pipeline[end].op)) {
+                end++;
+            }
+            if (wide) {
+                applyLut16(pipeline.mid(i, end - i), data, width, height, bpl, channels);
+            }
+            else {
+                applyLut8(pipeline.mid(i, end - i), data, width, height, bpl, channels);
+            }
+            i = end;
+            continue;
+        }
+
+        switch (stage.op) {
+        case Unsharp:
+            if (wide) {
+                unsharp<quint16>(data, width, height, bpl, channels, stage.args[0], int(stage.args[1]), stage.args[2]);
+            }
+            else {
+                unsharp<quint8>(data, width, height, bpl, channels, stage.args[0], int(stage.args[1]), stage.args[2]);
+            }
+            break;
+        case Despeckle:
+            if (wide) {
+                despeckle<quint16>(data, width, height, bpl, channels);
+            }
+            else {
+                despeckle<quint8>(data, width, height, bpl, channels);
+            }
+            break;
+        case Rotate:
+            rotate(data, width, height, bpl, pixelBytes, int(stage.args[0]));
+            break;
+        default:
+            break;
+        }
+        ++i;
+    }
+}
+
+QVector<quint16> ImagePipeline::outputTable16(const Pipeline &pipeline, int channels, Pipeline &head)
+{
+    int start = pipeline.size();
+    while (start > 0 && isPointOperator(pipeline[start - 1].op)) {
+        start--;
+    }
+    const Pipeline tail = pipeline.mid(start);
+    head = pipeline.mid(0, start);
+    return tail.isEmpty() ? QVector<quint16>() : buildTable<quint16>(tail, channels);
+}
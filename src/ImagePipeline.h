@@ -0,0 +1,74 @@
+/* ============================================================
+ * Description : Post-processing of the scanned data before it is
+ *               encoded: levels, curves, color balance, sharpening,
+ *               despeckling and rotation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#ifndef ImagePipeline_h
+#define ImagePipeline_h
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// The stages work directly on the data delivered by KSaneWidget::imageReady(),
+// 8 and 16 bit gray and RGB, so no decode and encode cycle is needed for a
+// correction. Line art (black and white) pages are passed through unchanged.
+//
+// A pipeline is written as stages separated by ';', arguments separated by ':'.
+// Levels are on the 8 bit scale for all depths.
+//   levels=<black>:<white>[:<gamma>]          e.g. "levels=12:240:1.1"
+//   gamma=<gamma>                             > 1 brightens the mid tones
+//   curve=<in>:<out>[:<in>:<out>...]          piecewise linear, e.g. "curve=0:0:128:150:255:255"
+//   balance=<range>:<red>:<green>:<blue>      range is shadows, midtones or highlights,
+//                                             the shifts are in levels, e.g. "balance=highlights:-18:0:0"
+//   unsharp=<amount>[:<radius>[:<threshold>]] box blurred unsharp mask, e.g. "unsharp=0.8:2:3"
+//   despeckle                                 3x3 median
+//   rotate=<90|180|270>                       clockwise
+namespace ImagePipeline
+{
+    enum Operator { Levels, Gamma, Curve, ColorBalance, Unsharp, Despeckle, Rotate };
+
+    struct Stage {
+        Operator        op;
+        QVector<double> args;
+        int             range = 0; // ColorBalance: 0 shadows, 1 midtones, 2 highlights
+    };
+
+    typedef QList<Stage> Pipeline;
+
+    // An empty pipeline if spec is empty or invalid, error tells what is wrong
+    Pipeline parse(const QString &spec, QString *error = nullptr);
+
+    // Runs the stages on the image in place, consecutive levels, gamma, curve
+    // and balance stages are combined into one lookup table pass. Rotating by
+    // 90 or 270 degrees swaps width and height.
+    void apply(const Pipeline &pipeline, QByteArray &data, int &width, int &height, int &bpl, int format);
+
+    // The levels, gamma, curve and balance stages at the end of pipeline as a 16 bit
+    // lookup table for SampleLut::map16(), so that they can be applied while the data
+    // is converted for writing. head gets the stages before them. The table is empty
+    // if the pipeline does not end with such stages.
+    QVector<quint16> outputTable16(const Pipeline &pipeline, int channels, Pipeline &head);
+}
+
+#endif
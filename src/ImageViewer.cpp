@@ -35,7 +35,8 @@
 
 struct ImageViewer::Private {
     QGraphicsScene      *scene;
-    QImage              *img;
+    QImage              *img = nullptr;
+    int                  validRows = -1;
 
     QAction *zoomInAction;
     QAction *zoomOutAction;
@@ -87,14 +88,40 @@ void ImageViewer::setQImage(QImage *img)
     }
 
     d->img = img;
+    d->validRows = -1;
     d->scene->setSceneRect(0, 0, img->width(), img->height());
 }
 
+// ------------------------------------------------------------------------
+void ImageViewer::setValidRows(int validRows)
+{
+    const int oldRows = (d->validRows < 0) ? 0 : d->validRows;
+    d->validRows = validRows;
+    if (d->img == nullptr) {
+        return;
+    }
+
+    const int newRows = (validRows < 0) ? d->img->height() : validRows;
+    if (newRows > oldRows) {
+        scene()->invalidate(QRectF(0, oldRows, d->img->width(), newRows - oldRows), QGraphicsScene::BackgroundLayer);
+    }
+    else {
+        scene()->invalidate(scene()->sceneRect(), QGraphicsScene::BackgroundLayer);
+    }
+}
+
 // ------------------------------------------------------------------------
 void ImageViewer::drawBackground(QPainter *painter, const QRectF &rect)
 {
     painter->fillRect(rect, QColor(0x70, 0x70, 0x70));
-    painter->drawImage(rect, *d->img, rect);
+    if (d->validRows < 0) {
+        painter->drawImage(rect, *d->img, rect);
+        return;
+    }
+    const QRectF validRect = rect & QRectF(0, 0, d->img->width(), d->validRows);
+    if (!validRect.isEmpty()) {
+        painter->drawImage(validRect, *d->img, validRect);
+    }
 }
 
 // ------------------------------------------------------------------------
@@ -36,6 +36,10 @@ public:
     ~ImageViewer();
 
     void setQImage(QImage *img);
+    // The image can be filled from the top while it is shown. Only the rows above
+    // validRows are drawn and only the newly valid rows are repainted.
+    // A negative value marks the whole image valid.
+    void setValidRows(int validRows);
 
 public Q_SLOTS:
     void zoomIn();
@@ -23,150 +23,1553 @@
 * ============================================================ */
 
 #include "KSaneImageSaver.h"
+#include "PageAnalysis.h"
+#include "OutputFile.h"
+#include "Derivatives.h"
+#include "ImagePipeline.h"
+#include "SampleLut.h"
+#include "RawCapture.h"
+#include "Trace.h"
+
+#include "config-skanlite.h"
+#include "version.h"
 
 #include <png.h>
+#include <setjmp.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_JPEG
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_TIFF
+#include <tiffio.h>
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_JXL
+#include <jxl/encode.h>
+#include <jxl/thread_parallel_runner.h>
+#endif
+
+#ifdef HAVE_WEBP
+#include <webp/encode.h>
+#endif
 
 #include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QWaitCondition>
 #include <QDebug>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QtConcurrent>
 
 #include <KSaneWidget>
 #include <QUrl>
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#include <QColorSpace>
+#endif
+
 struct KSaneImageSaver::Private {
-    bool   m_savedOk;
-    QMutex m_runMutex;
-
-    QUrl       m_url;
-    QString    m_name;
-    QByteArray m_data;
-    int        m_width;
-    int        m_height;
-    int        m_bpl;
-    int        m_dpi;
-    int        m_format;
-    QString    m_fileFormat;
-    int        m_quality;
-    bool       m_savingAsPng16;
+    struct EncoderOptions {
+        int        jpegHSampling = 2;
+        int        jpegVSampling = 2;
+        bool       jpegProgressive = false;
+        int        jpegRestartRows = 0;
+        enum TiffCompression { TiffNone, TiffLzw, TiffDeflate, TiffZstd };
+        TiffCompression tiffCompression = TiffDeflate;
+        enum BigTiff { BigTiffAuto, BigTiffAlways, BigTiffNever };
+        BigTiff    bigTiff = BigTiffAuto;
+        int        compressionLevel = -1;
+        int        threads = 0;
+        int        jxlEffort = 7;
+        int        webpMethod = 4;
+        OutputFile::SyncPolicy syncPolicy = OutputFile::SyncPerFile;
+        int        syncBatchSize = 16;
+        OutputFile::WriteOptions write;
+        QList<Derivatives::Spec> derivatives;
+        ImagePipeline::Pipeline pipeline;
+        bool       rawCapture = false;
+        int        rawCaptureLevel = 3;
+    };
+
+    struct ScanMetadata {
+        QString    deviceName;
+        QMap<QString, QString> options;
+        QByteArray iccProfile;
+        QVariantMap page;
+        QList<QRect> regions;
+        bool       detectRegions = false;
+        QDateTime  timestamp;
+    };
+
+    struct Job {
+        QUrl       url;
+        QString    name;
+        QByteArray data;
+        int        width;
+        int        height;
+        int        bpl;
+        int        dpi;
+        int        format;
+        QString    fileFormat;
+        int        quality;
+        bool       savingAsPng16;
+        EncoderOptions options;
+        ScanMetadata   scan;
+        QRect      crop; // part of the data to save, the whole image if not valid
+        QVector<quint16> outputLut; // applied by the 16 bit PNG saving while swapping the bytes
+    };
+
+    // thumbnails and proxies encoded into their temporary files, committed with their page
+    struct EncodedDerivatives {
+        QList<OutputFile *> files;
+        QStringList  errors;
+    };
+
+    // an image encoded into its temporary file, the encoding runs on the thread pool for regions
+    struct Encoded {
+        Job          job;
+        QVariantMap  metadata;
+        OutputFile  *file;
+        bool         ok;
+        qint64       encodeMs;
+        EncodedDerivatives derivatives;
+    };
+
+    QMutex         m_queueMutex;
+    QWaitCondition m_queueNotEmpty;
+    QQueue<Job>    m_queue;
+    bool           m_stop = false;
+    EncoderOptions m_options;
+    ScanMetadata   m_scan;
+    int            m_fileMode = 0644;
+
+    // images written but waiting for the group commit, only used by the worker thread
+    struct Written {
+        Job          job;
+        QVariantMap  metadata;
+        OutputFile  *file;
+        EncodedDerivatives derivatives;
+    };
+    QList<Written> m_uncommitted;
 
     KSaneImageSaver *q;
 
-    bool saveQImage();
-    bool save16BitPng();
+    void enqueue(const Job &job);
+    QList<Job> splitRegions(const Job &job);
+    static void crop(Job &job);
+    void encode(Encoded &image);
+    QVariantMap pageMetadata(const Job &job);
+    void addFileMetadata(const Job &job, const OutputFile &output, QVariantMap &metadata);
+    void commitBatch();
+    void finishImage(const Job &job, OutputFile *file, bool success, QVariantMap &metadata);
+    EncodedDerivatives encodeDerivatives(const Job &job);
+    void finishDerivatives(const Job &job, EncodedDerivatives &derivatives, bool pageSaved, QVariantMap &metadata);
+    QVariantMap saveRawCapture(const Job &job);
+    static QByteArray softwareName();
+    static QByteArray optionsText(const Job &job);
+    static QByteArray xmpPacket(const Job &job, bool withOptions);
+    static bool iccProfileFits(const Job &job);
+    bool saveQImage(Job &job, OutputFile &file);
+    bool saveJpeg(Job &job, OutputFile &file);
+    struct TiffLayout {
+        int    samplesPerPixel;
+        int    bitsPerSample;
+        qint64 rowBytes;
+        int    rowsPerStrip;
+        bool   predictor;
+        EncoderOptions::TiffCompression compression;
+    };
+
+    bool saveTiff(Job &job, OutputFile &file);
+    static QByteArray compressTiffStrip(const Job &job, const TiffLayout &layout, int strip);
+    bool saveJxl(Job &job, OutputFile &file);
+    bool saveWebp(Job &job, OutputFile &file);
+    bool save16BitPng(Job &job, OutputFile &file);
 };
 
 // ------------------------------------------------------------------------
 KSaneImageSaver::KSaneImageSaver(QObject *parent) : QThread(parent), d(new Private)
 {
     d->q = this;
+
+    // mkstemp() creates the temporary files with 0600, the saved images get the usual permissions
+    mode_t mask = umask(0);
+    umask(mask);
+    d->m_fileMode = 0666 & ~mask;
 }
 
 // ------------------------------------------------------------------------
 KSaneImageSaver::~KSaneImageSaver()
 {
+    // finish the pending images before quitting
+    d->m_queueMutex.lock();
+    d->m_stop = true;
+    d->m_queueNotEmpty.wakeAll();
+    d->m_queueMutex.unlock();
+    wait();
+
     delete d;
 }
 
-bool KSaneImageSaver::saveQImage(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality)
+void KSaneImageSaver::saveQImage(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality)
+{
+    d->enqueue({url, name, data, width, height, bpl, dpi, format, fileFormat, quality, false});
+}
+
+void KSaneImageSaver::save16BitPng(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality)
+{
+    d->enqueue({url, name, data, width, height, bpl, dpi, format, fileFormat, quality, true});
+}
+
+int KSaneImageSaver::pendingImages()
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    return d->m_queue.size();
+}
+
+void KSaneImageSaver::setJpegOptions(const QString &subsampling, bool progressive, int restartRows)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    if (subsampling == QLatin1String("4:4:4")) {
+        d->m_options.jpegHSampling = 1;
+        d->m_options.jpegVSampling = 1;
+    }
+    else if (subsampling == QLatin1String("4:2:2")) {
+        d->m_options.jpegHSampling = 2;
+        d->m_options.jpegVSampling = 1;
+    }
+    else {
+        d->m_options.jpegHSampling = 2;
+        d->m_options.jpegVSampling = 2;
+    }
+    d->m_options.jpegProgressive = progressive;
+    d->m_options.jpegRestartRows = restartRows;
+}
+
+void KSaneImageSaver::setEncoderOptions(int threads, int jxlEffort, int webpMethod)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_options.threads = (threads > 0) ? threads : QThread::idealThreadCount();
+    d->m_options.jxlEffort = qBound(1, jxlEffort, 9);
+    d->m_options.webpMethod = qBound(0, webpMethod, 6);
+}
+
+void KSaneImageSaver::setTiffOptions(const QString &compression, const QString &bigTiff, int level)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    if (compression == QLatin1String("none")) {
+        d->m_options.tiffCompression = Private::EncoderOptions::TiffNone;
+    }
+    else if (compression == QLatin1String("lzw")) {
+        d->m_options.tiffCompression = Private::EncoderOptions::TiffLzw;
+    }
+#ifdef HAVE_ZSTD
+    else if (compression == QLatin1String("zstd")) {
+        d->m_options.tiffCompression = Private::EncoderOptions::TiffZstd;
+    }
+#endif
+    else {
+        d->m_options.tiffCompression = Private::EncoderOptions::TiffDeflate;
+    }
+
+    if (bigTiff == QLatin1String("always")) {
+        d->m_options.bigTiff = Private::EncoderOptions::BigTiffAlways;
+    }
+    else if (bigTiff == QLatin1String("never")) {
+        d->m_options.bigTiff = Private::EncoderOptions::BigTiffNever;
+    }
+    else {
+        d->m_options.bigTiff = Private::EncoderOptions::BigTiffAuto;
+    }
+    d->m_options.compressionLevel = level;
+}
+
+void KSaneImageSaver::setScanMetadata(const QString &deviceName, const QMap<QString, QString> &options, const QByteArray &iccProfile)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_scan.deviceName = deviceName;
+    d->m_scan.options = options;
+    d->m_scan.iccProfile = iccProfile;
+}
+
+void KSaneImageSaver::setPageMetadata(const QVariantMap &metadata)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_scan.page = metadata;
+}
+
+void KSaneImageSaver::setScanRegions(const QList<QRect> &regions, bool detect)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_scan.regions = regions;
+    d->m_scan.detectRegions = detect;
+}
+
+void KSaneImageSaver::setSyncPolicy(const QString &policy, int batchSize)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    if (policy == QLatin1String("none")) {
+        d->m_options.syncPolicy = OutputFile::SyncNone;
+    }
+    else if (policy == QLatin1String("batch")) {
+        d->m_options.syncPolicy = OutputFile::SyncBatched;
+    }
+    else {
+        d->m_options.syncPolicy = OutputFile::SyncPerFile;
+    }
+    d->m_options.syncBatchSize = qMax(1, batchSize);
+}
+
+void KSaneImageSaver::setDerivatives(const QMap<QString, QString> &derivatives)
 {
-    if (!d->m_runMutex.tryLock()) {
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_options.derivatives = Derivatives::parse(derivatives);
+}
+
+bool KSaneImageSaver::setPipeline(const QString &spec, QString *error)
+{
+    QString parseError;
+    const ImagePipeline::Pipeline pipeline = ImagePipeline::parse(spec, &parseError);
+    if (error) {
+        *error = parseError;
+    }
+    if (!parseError.isEmpty()) {
         return false;
     }
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_options.pipeline = pipeline;
+    return true;
+}
+
+void KSaneImageSaver::setRawCapture(bool enabled, int level)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_options.rawCapture = enabled;
+    d->m_options.rawCaptureLevel = level;
+}
+
+void KSaneImageSaver::setWriteOptions(bool directIo, bool asyncIo, bool dropPageCache)
+{
+    QMutexLocker locker(&d->m_queueMutex);
+    d->m_options.write.directIo = directIo;
+    d->m_options.write.asyncIo = asyncIo;
+    d->m_options.write.dropPageCache = dropPageCache;
+}
+
+QStringList KSaneImageSaver::nativeMimeTypes()
+{
+    QStringList mimeTypes;
+#ifdef HAVE_JXL
+    mimeTypes << QStringLiteral("image/jxl");
+#endif
+#ifdef HAVE_WEBP
+    mimeTypes << QStringLiteral("image/webp");
+#endif
+    return mimeTypes;
+}
+
+QStringList KSaneImageSaver::suffixes16Bit()
+{
+    QStringList suffixes;
+    suffixes << QStringLiteral("png");
+#ifdef HAVE_TIFF
+    suffixes << QStringLiteral("tif") << QStringLiteral("tiff");
+#endif
+#ifdef HAVE_JXL
+    suffixes << QStringLiteral("jxl");
+#endif
+    return suffixes;
+}
+
+void KSaneImageSaver::Private::enqueue(const Job &job)
+{
+    QMutexLocker locker(&m_queueMutex);
+    m_queue.enqueue(job);
+    m_queue.last().options = m_options;
+    m_queue.last().scan = m_scan;
+    m_queue.last().scan.timestamp = QDateTime::currentDateTime();
+    m_queueNotEmpty.wakeOne();
+    if (!q->isRunning()) {
+        q->start();
+    }
+}
 
-    d->m_url    = url;
-    d->m_name   = name;
-    d->m_data   = data;
-    d->m_width  = width;
-    d->m_height = height;
-    d->m_bpl    = bpl;
-    d->m_dpi    = dpi;
-    d->m_format = format;
-    d->m_fileFormat = fileFormat;
-    d->m_quality = quality;
-    d->m_savingAsPng16 = false;
+void KSaneImageSaver::run()
+{
+    // The images are saved in the order they were scanned, a new scan does not
+    // have to wait for the previous image to be written.
+    forever {
+        d->m_queueMutex.lock();
+        while (d->m_queue.isEmpty() && !d->m_stop) {
+            d->m_queueNotEmpty.wait(&d->m_queueMutex);
+        }
+        if (d->m_queue.isEmpty()) {
+            d->m_queueMutex.unlock();
+            // the saver is stopped, nothing may stay uncommitted
+            d->commitBatch();
+            return;
+        }
+        Private::Job job = d->m_queue.dequeue();
+        const bool lastQueued = d->m_queue.isEmpty();
+        d->m_queueMutex.unlock();
+        TraceSpan pageSpan("save", "page", job.name);
+
+        if (job.options.syncPolicy != OutputFile::SyncBatched) {
+            d->commitBatch();
+        }
+
+        // the scanned data is kept as it came from the scanner, written while the page is encoded
+        QFuture<QVariantMap> rawCapture;
+        if (job.options.rawCapture && job.url.isLocalFile()) {
+            rawCapture = QtConcurrent::run(d, &Private::saveRawCapture, job);
+        }
 
-    start();
+        // the regions of a page are cut from the same data and encoded in parallel
+        QList<Private::Encoded> images;
+        foreach (const Private::Job &part, d->splitRegions(job)) {
+            images.append({part, QVariantMap(), nullptr, false, 0, Private::EncodedDerivatives()});
+        }
+        if (images.size() == 1) {
+            d->encode(images[0]);
+        }
+        else {
+            QtConcurrent::blockingMap(images, [this](Private::Encoded &image) { d->encode(image); });
+        }
+        if (rawCapture.isStarted()) {
+            const QVariantMap rawMetadata = rawCapture.result();
+            for (int i = 0; i < images.size(); ++i) {
+                for (QVariantMap::const_iterator it = rawMetadata.constBegin(); it != rawMetadata.constEnd(); ++it) {
+                    images[i].metadata.insert(it.key(), it.value());
+                }
+            }
+        }
+
+        for (int i = 0; i < images.size(); ++i) {
+            Private::Encoded &image = images[i];
+            OutputFile *file = image.file;
+            QVariantMap &metadata = image.metadata;
+            bool savedOk = image.ok;
+            QElapsedTimer commitTimer;
+            commitTimer.start();
+            TraceSpan commitSpan("commit", "io", image.job.name);
+            switch (image.job.options.syncPolicy) {
+            case OutputFile::SyncNone:
+                savedOk = savedOk && file->commit(false);
+                break;
+            case OutputFile::SyncPerFile:
+                savedOk = savedOk && file->sync() && file->commit(true);
+                break;
+            case OutputFile::SyncBatched:
+                // A page that failed joins the batch too, it is not committed but
+                // reported in its place, and the pages before it are still committed.
+                metadata[QStringLiteral("encodeMs")] = image.encodeMs;
+                d->m_uncommitted.append({image.job, metadata, file, image.derivatives});
+                // commit when the batch is full or nothing else is waiting
+                if (d->m_uncommitted.size() >= image.job.options.syncBatchSize ||
+                    (lastQueued && i == images.size() - 1)) {
+                    d->commitBatch();
+                }
+                continue;
+            }
+            d->finishDerivatives(image.job, image.derivatives, savedOk, metadata);
+            metadata[QStringLiteral("encodeMs")] = image.encodeMs + commitTimer.elapsed();
+            d->finishImage(image.job, file, savedOk, metadata);
+        }
+    }
+}
+
+QList<KSaneImageSaver::Private::Job> KSaneImageSaver::Private::splitRegions(const Job &job)
+{
+    QList<Job> parts;
+    if ((job.scan.regions.isEmpty() && !job.scan.detectRegions) || !job.url.isLocalFile()) {
+        parts.append(job);
+        return parts;
+    }
+
+    const QList<QRect> regions = job.scan.detectRegions ?
+        PageAnalysis::detectRegions(job.data, job.width, job.height, job.bpl, job.format, job.dpi) :
+        job.scan.regions;
+    const QRect page(0, 0, job.width, job.height);
+    const QFileInfo info(job.name);
+    foreach (const QRect &region, regions) {
+        const QRect rect = region & page;
+        if (rect.isEmpty()) {
+            continue;
+        }
+        const int number = parts.size() + 1;
+        Job part = job;
+        part.crop = rect;
+        part.name = QDir(info.path()).filePath(info.completeBaseName() + QStringLiteral("-%1.").arg(number) + info.suffix());
+        part.url = QUrl::fromLocalFile(part.name);
+        part.scan.page[QStringLiteral("region")] = number;
+        part.scan.page[QStringLiteral("regionOf")] = job.url.toString();
+        part.scan.page[QStringLiteral("regionRect")] = QStringLiteral("%1,%2,%3,%4")
+            .arg(rect.x()).arg(rect.y()).arg(rect.width()).arg(rect.height());
+        parts.append(part);
+    }
+    if (parts.isEmpty()) {
+        qWarning() << "No scan region found in" << job.name << "saving the whole page";
+        parts.append(job);
+    }
+    else {
+        for (int i = 0; i < parts.size(); ++i) {
+            parts[i].scan.page[QStringLiteral("regionCount")] = parts.size();
+        }
+    }
+    return parts;
+}
+
+void KSaneImageSaver::Private::crop(Job &job)
+{
+    QRect rect = job.crop;
+    int offset;
+    int rowBytes;
+    if (job.format == KSaneIface::KSaneWidget::FormatBlackWhite) {
+        // the rows of line art are bits, the region starts at a byte
+        rect.setLeft(rect.left() & ~7);
+        offset = rect.left() / 8;
+        rowBytes = (rect.width() + 7) / 8;
+    }
+    else {
+        const int bytesPerPixel = PageAnalysis::bytesPerPixel(job.format);
+        if (bytesPerPixel == 0) {
+            return;
+        }
+        offset = rect.left() * bytesPerPixel;
+        rowBytes = rect.width() * bytesPerPixel;
+    }
+
+    QByteArray data(qint64(rowBytes) * rect.height(), Qt::Uninitialized);
+    for (int y = 0; y < rect.height(); ++y) {
+        memcpy(data.data() + qint64(y) * rowBytes, job.data.constData() + qint64(rect.top() + y) * job.bpl + offset, rowBytes);
+    }
+    job.data = data;
+    job.width = rect.width();
+    job.height = rect.height();
+    job.bpl = rowBytes;
+    job.crop = QRect();
+}
+
+void KSaneImageSaver::Private::encode(Encoded &image)
+{
+    Job &job = image.job;
+    if (job.crop.isValid()) {
+        crop(job);
+    }
+
+    // The 16 bit PNG saving converts every row to big endian anyway, the
+    // corrections at the end of the pipeline are done in the same step instead
+    // of a pass of their own. Not with derivatives, they are made from the
+    // corrected data.
+    ImagePipeline::Pipeline pipeline = job.options.pipeline;
+    if (job.savingAsPng16 && job.options.derivatives.isEmpty()) {
+        const int channels = (job.format == KSaneIface::KSaneWidget::FormatRGB_16_C) ? 3 : 1;
+        job.outputLut = ImagePipeline::outputTable16(pipeline, channels, pipeline);
+    }
+    // the post-processing detaches the job from the shared scan data
+    {
+        TraceSpan span("pipeline");
+        ImagePipeline::apply(pipeline, job.data, job.width, job.height, job.bpl, job.format);
+    }
+
+    image.metadata = pageMetadata(job);
+
+    // the encoders write to a temporary file that is renamed when complete
+    // The thumbnails and proxies are made from the scanned data on another
+    // thread while the page is encoded, the job copy shares the data.
+    QFuture<EncodedDerivatives> derivatives;
+    if (!job.options.derivatives.isEmpty() && job.url.isLocalFile()) {
+        derivatives = QtConcurrent::run(this, &Private::encodeDerivatives, job);
+    }
+
+    QElapsedTimer encodeTimer;
+    encodeTimer.start();
+    TraceSpan span("encode", "page", job.name);
+    image.file = new OutputFile(job.name);
+    image.ok = image.file->open(m_fileMode, job.options.write) &&
+               (job.savingAsPng16 ? save16BitPng(job, *image.file) : saveQImage(job, *image.file)) &&
+               image.file->finish();
+    if (!image.ok) {
+        image.file->setError(QStringLiteral("Encoding %1 failed").arg(job.name));
+    }
+    if (derivatives.isStarted()) {
+        image.derivatives = derivatives.result();
+    }
+    image.encodeMs = encodeTimer.elapsed();
+}
+
+void KSaneImageSaver::Private::commitBatch()
+{
+    if (m_uncommitted.isEmpty()) {
+        return;
+    }
+    // the thumbnails and proxies of a page are synced in the same batch
+    QList<OutputFile *> files;
+    foreach (const Written &written, m_uncommitted) {
+        files.append(written.file);
+        if (written.file->errorString().isEmpty()) {
+            files.append(written.derivatives.files);
+        }
+    }
+    OutputFile::commitBatch(files);
+
+    QList<Written> batch;
+    batch.swap(m_uncommitted);
+    for (int i = 0; i < batch.size(); ++i) {
+        const bool success = batch[i].file->errorString().isEmpty();
+        finishDerivatives(batch[i].job, batch[i].derivatives, success, batch[i].metadata);
+        finishImage(batch[i].job, batch[i].file, success, batch[i].metadata);
+    }
+}
+
+void KSaneImageSaver::Private::finishImage(const Job &job, OutputFile *file, bool success, QVariantMap &metadata)
+{
+    if (success) {
+        addFileMetadata(job, *file, metadata);
+    }
+    else {
+        metadata[QStringLiteral("error")] = file->errorString();
+        // the caller still needs to know which page failed
+        for (QVariantMap::const_iterator it = job.scan.page.constBegin(); it != job.scan.page.constEnd(); ++it) {
+            if (!metadata.contains(it.key())) {
+                metadata.insert(it.key(), it.value());
+            }
+        }
+    }
+    delete file;
+    emit q->imageSaved(job.url, job.name, success, metadata);
+}
+
+KSaneImageSaver::Private::EncodedDerivatives KSaneImageSaver::Private::encodeDerivatives(const Job &job)
+{
+    TraceSpan span("derivatives");
+    EncodedDerivatives encoded;
+    const QList<Derivatives::Image> images = Derivatives::downsample(job.data, job.width, job.height, job.bpl,
+                                                                     job.format, job.dpi, job.options.derivatives);
+    for (int i = 0; i < images.size(); ++i) {
+        const Derivatives::Spec &spec = job.options.derivatives[i];
+        const Derivatives::Image &image = images[i];
+
+        // the derivative goes through the same encoders as the page
+        Job derivative = job;
+        derivative.name = Derivatives::fileName(job.name, spec);
+        derivative.url = QUrl::fromLocalFile(derivative.name);
+        derivative.data = image.data;
+        derivative.width = image.width;
+        derivative.height = image.height;
+        derivative.bpl = image.bpl;
+        derivative.dpi = image.dpi;
+        derivative.format = image.format;
+        derivative.fileFormat = spec.format;
+        derivative.quality = spec.quality;
+        derivative.savingAsPng16 = false;
+
+        // committed by finishDerivatives() once the page is saved
+        OutputFile *file = new OutputFile(derivative.name);
+        if (file->open(m_fileMode, job.options.write) && saveQImage(derivative, *file) && file->finish()) {
+            encoded.files.append(file);
+        }
+        else {
+            encoded.errors << (file->errorString().isEmpty() ? QStringLiteral("Encoding %1 failed").arg(derivative.name) : file->errorString());
+            delete file;
+        }
+    }
+    return encoded;
+}
+
+void KSaneImageSaver::Private::finishDerivatives(const Job &job, EncodedDerivatives &derivatives, bool pageSaved, QVariantMap &metadata)
+{
+    if (job.options.derivatives.isEmpty() || !job.url.isLocalFile()) {
+        return;
+    }
+
+    // The derivatives are only kept with their page. In a batch they were
+    // committed together with it, otherwise they are committed here the same
+    // way as the page.
+    QStringList saved;
+    QStringList errors = derivatives.errors;
+    const OutputFile::SyncPolicy policy = job.options.syncPolicy;
+    foreach (OutputFile *file, derivatives.files) {
+        bool ok;
+        if (!pageSaved) {
+            file->discard();
+            ok = false;
+        }
+        else if (policy == OutputFile::SyncBatched) {
+            ok = file->errorString().isEmpty();
+        }
+        else {
+            const bool sync = (policy != OutputFile::SyncNone);
+            ok = (!sync || file->sync()) && file->commit(sync);
+        }
+        if (ok) {
+            saved << file->fileName();
+        }
+        else if (pageSaved) {
+            errors << file->errorString();
+        }
+        delete file;
+    }
+    derivatives.files.clear();
+
+    metadata[QStringLiteral("derivatives")] = saved;
+    if (!errors.isEmpty()) {
+        qWarning() << "Saving derivatives failed:" << errors;
+        metadata[QStringLiteral("derivativeErrors")] = errors;
+    }
+}
+
+QVariantMap KSaneImageSaver::Private::saveRawCapture(const Job &job)
+{
+    TraceSpan span("raw capture", "io");
+    RawCapture::Capture capture;
+    capture.data = job.data;
+    capture.width = job.width;
+    capture.height = job.height;
+    capture.bpl = job.bpl;
+    capture.format = job.format;
+    capture.dpi = job.dpi;
+    capture.deviceName = job.scan.deviceName;
+    capture.options = job.scan.options;
+    capture.iccProfile = job.scan.iccProfile;
+    capture.timestamp = job.scan.timestamp;
+
+    // written and synced like the images
+    const QString name = RawCapture::fileName(job.name);
+    OutputFile file(name);
+    QString error;
+    const bool sync = (job.options.syncPolicy != OutputFile::SyncNone);
+    const bool ok = file.open(m_fileMode, OutputFile::WriteOptions()) &&
+                    RawCapture::write(file.device(), capture, job.options.rawCaptureLevel, job.options.threads, &error) &&
+                    file.finish() && (!sync || file.sync()) && file.commit(sync);
+
+    QVariantMap metadata;
+    if (ok) {
+        metadata[QStringLiteral("rawCapture")] = name;
+    }
+    else {
+        metadata[QStringLiteral("rawCaptureError")] = error.isEmpty() ? file.errorString() : error;
+        qWarning() << "Could not keep the raw capture of" << job.name << metadata.value(QStringLiteral("rawCaptureError"));
+    }
+    return metadata;
+}
+
+QVariantMap KSaneImageSaver::Private::pageMetadata(const Job &job)
+{
+    const PageAnalysis::Result analysis = PageAnalysis::analyze(job.data, job.width, job.height, job.bpl, job.format);
+
+    QVariantMap metadata;
+    metadata[QStringLiteral("width")] = job.width;
+    metadata[QStringLiteral("height")] = job.height;
+    metadata[QStringLiteral("dpi")] = job.dpi;
+    metadata[QStringLiteral("pixelFormat")] = PageAnalysis::formatName(job.format);
+    metadata[QStringLiteral("blankScore")] = analysis.blankScore;
+    metadata[QStringLiteral("colorMode")] = analysis.colorMode;
+    for (QVariantMap::const_iterator it = job.scan.page.constBegin(); it != job.scan.page.constEnd(); ++it) {
+        metadata.insert(it.key(), it.value());
+    }
+    return metadata;
+}
+
+void KSaneImageSaver::Private::addFileMetadata(const Job &job, const OutputFile &output, QVariantMap &metadata)
+{
+    metadata[QStringLiteral("fileFormat")] = QFileInfo(job.url.fileName()).suffix().toLower();
+    metadata[QStringLiteral("writeBackend")] = output.backendName();
+    metadata[QStringLiteral("fileSize")] = output.size();
+
+    // the hash is computed while writing unless the encoder went back to patch the file
+    QByteArray sha256 = output.sha256();
+    if (sha256.isEmpty()) {
+        QFile file(job.name);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        hash.addData(&file);
+        sha256 = hash.result();
+        if (job.options.write.dropPageCache || job.options.write.directIo) {
+            // do not keep the file in the cache just because of the hash
+            posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+        }
+    }
+    metadata[QStringLiteral("sha256")] = QString::fromLatin1(sha256.toHex());
+}
+
+QByteArray KSaneImageSaver::Private::softwareName()
+{
+    return QByteArray("Skanlite ") + skanlite_version;
+}
+
+QByteArray KSaneImageSaver::Private::optionsText(const Job &job)
+{
+    // one "name=value" line per scanner option, the same form as the saved options
+    QByteArray text;
+    QMap<QString, QString>::const_iterator it;
+    for (it = job.scan.options.constBegin(); it != job.scan.options.constEnd(); ++it) {
+        text += it.key().toUtf8() + '=' + it.value().toUtf8() + '\n';
+    }
+    return text;
+}
+
+QByteArray KSaneImageSaver::Private::xmpPacket(const Job &job, bool withOptions)
+{
+    QString xmp;
+    xmp += QStringLiteral("<?xpacket begin=\"\xFEFF\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>\n"
+                          "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+                          " <rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+                          "  <rdf:Description rdf:about=\"\"\n"
+                          "    xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\"\n"
+                          "    xmlns:tiff=\"http://ns.adobe.com/tiff/1.0/\"\n"
+                          "    xmlns:dc=\"http://purl.org/dc/elements/1.1/\">\n");
+    xmp += QStringLiteral("   <xmp:CreatorTool>%1</xmp:CreatorTool>\n").arg(QString::fromLatin1(softwareName()).toHtmlEscaped());
+    xmp += QStringLiteral("   <xmp:CreateDate>%1</xmp:CreateDate>\n").arg(job.scan.timestamp.toString(Qt::ISODate));
+    if (!job.scan.deviceName.isEmpty()) {
+        xmp += QStringLiteral("   <tiff:Model>%1</tiff:Model>\n").arg(job.scan.deviceName.toHtmlEscaped());
+    }
+    xmp += QStringLiteral("   <tiff:XResolution>%1/1</tiff:XResolution>\n"
+                          "   <tiff:YResolution>%1/1</tiff:YResolution>\n"
+                          "   <tiff:ResolutionUnit>2</tiff:ResolutionUnit>\n").arg(job.dpi);
+    if (withOptions && !job.scan.options.isEmpty()) {
+        xmp += QStringLiteral("   <dc:description><rdf:Alt><rdf:li xml:lang=\"x-default\">%1</rdf:li></rdf:Alt></dc:description>\n")
+               .arg(QString::fromUtf8(optionsText(job)).toHtmlEscaped());
+    }
+    xmp += QStringLiteral("  </rdf:Description>\n"
+                          " </rdf:RDF>\n"
+                          "</x:xmpmeta>\n"
+                          "<?xpacket end=\"w\"?>");
+    return xmp.toUtf8();
+}
+
+bool KSaneImageSaver::Private::iccProfileFits(const Job &job)
+{
+    // the color space of the profile has to match the image, "GRAY" or "RGB "
+    if (job.scan.iccProfile.size() < 128) {
+        return false;
+    }
+    const QByteArray space = job.scan.iccProfile.mid(16, 4);
+    const bool gray = (job.format == KSaneIface::KSaneWidget::FormatGrayScale8 ||
+                       job.format == KSaneIface::KSaneWidget::FormatGrayScale16);
+    return space == (gray ? "GRAY" : "RGB ");
+}
+
+bool KSaneImageSaver::Private::saveQImage(Job &job, OutputFile &file)
+{
+    const QString suffix = job.fileFormat.isEmpty() ? QFileInfo(job.name).suffix().toLower() : job.fileFormat.toLower();
+#ifdef HAVE_JPEG
+    if ((suffix == QLatin1String("jpg") || suffix == QLatin1String("jpeg") || suffix == QLatin1String("jpe")) &&
+        (job.format == KSaneIface::KSaneWidget::FormatGrayScale8 || job.format == KSaneIface::KSaneWidget::FormatRGB_8_C)) {
+        return saveJpeg(job, file);
+    }
+#endif
+#ifdef HAVE_TIFF
+    if (suffix == QLatin1String("tif") || suffix == QLatin1String("tiff")) {
+        return saveTiff(job, file);
+    }
+#endif
+#ifdef HAVE_JXL
+    if (suffix == QLatin1String("jxl")) {
+        return saveJxl(job, file);
+    }
+#endif
+#ifdef HAVE_WEBP
+    if (suffix == QLatin1String("webp") &&
+        (job.format == KSaneIface::KSaneWidget::FormatGrayScale8 || job.format == KSaneIface::KSaneWidget::FormatRGB_8_C)) {
+        return saveWebp(job, file);
+    }
+#endif
+    QImage img;
+    {
+        TraceSpan span("convert");
+        img = KSaneIface::KSaneWidget::toQImageSilent(job.data, job.width, job.height, job.bpl, job.dpi, (KSaneIface::KSaneWidget::ImageFormat) job.format);
+    }
+    // the image plugins write the text keys where the format has room for them (PNG, JPEG, TIFF)
+    img.setText(QStringLiteral("Software"), QString::fromLatin1(softwareName()));
+    img.setText(QStringLiteral("Creation Time"), job.scan.timestamp.toString(Qt::ISODate));
+    if (!job.scan.deviceName.isEmpty()) {
+        img.setText(QStringLiteral("Source"), job.scan.deviceName);
+    }
+    if (!job.scan.options.isEmpty()) {
+        img.setText(QStringLiteral("Comment"), QString::fromUtf8(optionsText(job)));
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    if (iccProfileFits(job)) {
+        img.setColorSpace(QColorSpace::fromIccProfile(job.scan.iccProfile));
+    }
+#endif
+
+    // the Qt image plugins write to the temporary file through the device of the output sink
+    QImageWriter writer(file.device(), suffix.toLatin1());
+    writer.setQuality(job.quality);
+    if (!writer.write(img)) {
+        file.setError(QStringLiteral("Encoding %1 failed: %2").arg(job.name, writer.errorString()));
+        return false;
+    }
     return true;
 }
 
-bool KSaneImageSaver::save16BitPng(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality)
+#ifdef HAVE_JPEG
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf        jumpBuffer;
+    char           message[JMSG_LENGTH_MAX];
+};
+
+static void jpegErrorExit(j_common_ptr cinfo)
 {
-    if (!d->m_runMutex.tryLock()) {
+    // the default handler would exit() the application
+    JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jumpBuffer, 1);
+}
+#endif
+
+bool KSaneImageSaver::Private::saveJpeg(Job &job, OutputFile &file)
+{
+#ifdef HAVE_JPEG
+    // The scanned rows are fed to the encoder as they are, without the QImage
+    // conversion to 32 bit pixels the Qt JPEG plugin would need.
+    FILE *stream = file.stream();
+    if (!stream) {
+        return false;
+    }
+
+    // The markers are prepared before the setjmp(), a longjmp() must not skip
+    // their destructors. They have to fit in 64 kB, the option list is left out
+    // of the XMP packet if it does not fit.
+    const int maxMarker = 65533;
+    const QByteArray comment = (softwareName() + ", " + job.scan.deviceName.toUtf8()).left(maxMarker);
+    QByteArray xmp = QByteArray("http://ns.adobe.com/xap/1.0/", 29) + xmpPacket(job, true);
+    if (xmp.size() > maxMarker) {
+        xmp = QByteArray("http://ns.adobe.com/xap/1.0/", 29) + xmpPacket(job, false);
+    }
+    QList<QByteArray> iccMarkers;
+    if (iccProfileFits(job)) {
+        // APP2 "ICC_PROFILE" markers, larger profiles are split over several markers
+        const int chunkSize = maxMarker - 14;
+        const QByteArray &icc = job.scan.iccProfile;
+        const int chunks = (icc.size() + chunkSize - 1) / chunkSize;
+        for (int i = 0; i < chunks && chunks < 256; ++i) {
+            QByteArray marker("ICC_PROFILE", 12);
+            marker += char(i + 1);
+            marker += char(chunks);
+            marker += icc.mid(i * chunkSize, chunkSize);
+            iccMarkers.append(marker);
+        }
+    }
+
+    jpeg_compress_struct cinfo;
+    JpegErrorManager     jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.jumpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        file.setError(QStringLiteral("JPEG encoder: %1").arg(QString::fromLocal8Bit(jerr.message)));
         return false;
     }
 
-    d->m_url    = url;
-    d->m_name   = name;
-    d->m_data   = data;
-    d->m_width  = width;
-    d->m_height = height;
-    d->m_bpl    = bpl;
-    d->m_dpi    = dpi;
-    d->m_format = format;
-    d->m_fileFormat = fileFormat;
-    d->m_quality = quality;
-    d->m_savingAsPng16 = true;
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, stream);
+
+    cinfo.image_width = job.width;
+    cinfo.image_height = job.height;
+    if (job.format == KSaneIface::KSaneWidget::FormatRGB_8_C) {
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+    }
+    else {
+        cinfo.input_components = 1;
+        cinfo.in_color_space = JCS_GRAYSCALE;
+    }
+    jpeg_set_defaults(&cinfo);
+    // same default as the Qt JPEG plugin
+    jpeg_set_quality(&cinfo, job.quality < 0 ? 75 : job.quality, TRUE);
+
+    if (cinfo.num_components == 3) {
+        cinfo.comp_info[0].h_samp_factor = job.options.jpegHSampling;
+        cinfo.comp_info[0].v_samp_factor = job.options.jpegVSampling;
+    }
+    if (job.options.jpegProgressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+    cinfo.restart_in_rows = job.options.jpegRestartRows;
+
+    cinfo.density_unit = 1; // dots per inch
+    cinfo.X_density = job.dpi;
+    cinfo.Y_density = job.dpi;
 
-    start();
+    jpeg_start_compress(&cinfo, TRUE);
+
+    jpeg_write_marker(&cinfo, JPEG_COM, reinterpret_cast<const JOCTET *>(comment.constData()), comment.size());
+    jpeg_write_marker(&cinfo, JPEG_APP0 + 1, reinterpret_cast<const JOCTET *>(xmp.constData()), xmp.size());
+    for (int i = 0; i < iccMarkers.size(); ++i) {
+        jpeg_write_marker(&cinfo, JPEG_APP0 + 2, reinterpret_cast<const JOCTET *>(iccMarkers[i].constData()), iccMarkers[i].size());
+    }
+
+    // the encoder does not modify the rows, no need to detach the shared data
+    JSAMPROW rows[16];
+    const uchar *bits = reinterpret_cast<const uchar *>(job.data.constData());
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int count = qMin<int>(16, cinfo.image_height - cinfo.next_scanline);
+        for (int i = 0; i < count; ++i) {
+            rows[i] = const_cast<JSAMPROW>(bits + qint64(cinfo.next_scanline + i) * job.bpl);
+        }
+        jpeg_write_scanlines(&cinfo, rows, count);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
     return true;
+#else
+    Q_UNUSED(job);
+    Q_UNUSED(file);
+    return false;
+#endif
 }
 
-void KSaneImageSaver::run()
+#if defined(HAVE_JXL) || defined(HAVE_WEBP)
+static bool writeAll(FILE *file, const void *data, size_t size)
+{
+    return fwrite(data, 1, size, file) == size;
+}
+#endif
+
+#ifdef HAVE_TIFF
+// Packs the rows of one strip, applies the horizontal predictor and compresses
+// the strip, so that the strips can be compressed in parallel and written raw.
+QByteArray KSaneImageSaver::Private::compressTiffStrip(const Job &job, const TiffLayout &layout, int strip)
+{
+    const int firstRow = strip * layout.rowsPerStrip;
+    const int rows = qMin(layout.rowsPerStrip, job.height - firstRow);
+    const qint64 size = layout.rowBytes * rows;
+
+    QByteArray packed(size, Qt::Uninitialized);
+    for (int i = 0; i < rows; ++i) {
+        uchar *dst = reinterpret_cast<uchar *>(packed.data()) + layout.rowBytes * i;
+        memcpy(dst, job.data.constData() + qint64(firstRow + i) * job.bpl, layout.rowBytes);
+
+        if (!layout.predictor) {
+            continue;
+        }
+        // TIFF predictor 2: every sample is stored as the difference to the same
+        // sample of the previous pixel, the samples stay in host byte order
+        const int spp = layout.samplesPerPixel;
+        const int samples = job.width * spp;
+        if (layout.bitsPerSample == 16) {
+            quint16 *row = reinterpret_cast<quint16 *>(dst);
+            for (int x = samples - 1; x >= spp; --x) {
+                row[x] -= row[x - spp];
+            }
+        }
+        else {
+            for (int x = samples - 1; x >= spp; --x) {
+                dst[x] -= dst[x - spp];
+            }
+        }
+    }
+
+    QByteArray compressed;
+    switch (layout.compression) {
+#ifdef HAVE_ZSTD
+    case EncoderOptions::TiffZstd: {
+        compressed.resize(ZSTD_compressBound(size));
+        const int level = job.options.compressionLevel < 0 ? 9 : job.options.compressionLevel;
+        size_t length = ZSTD_compress(compressed.data(), compressed.size(), packed.constData(), size, level);
+        if (ZSTD_isError(length)) {
+            return QByteArray();
+        }
+        compressed.resize(length);
+        break;
+    }
+#endif
+    default: {
+        uLongf length = compressBound(size);
+        compressed.resize(length);
+        const int level = job.options.compressionLevel < 0 ? Z_DEFAULT_COMPRESSION : job.options.compressionLevel;
+        if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &length,
+                      reinterpret_cast<const Bytef *>(packed.constData()), size, level) != Z_OK) {
+            return QByteArray();
+        }
+        compressed.resize(length);
+        break;
+    }
+    }
+    return compressed;
+}
+#endif
+
+#ifdef HAVE_TIFF
+struct TiffOutput {
+    OutputFile *file;
+    qint64      position;
+};
+
+static tmsize_t tiffRead(thandle_t, void *, tmsize_t)
+{
+    return -1;
+}
+
+static tmsize_t tiffWrite(thandle_t handle, void *data, tmsize_t size)
+{
+    TiffOutput *output = static_cast<TiffOutput *>(handle);
+    if (!output->file->writeAt(output->position, static_cast<const char *>(data), size)) {
+        return -1;
+    }
+    output->position += size;
+    return size;
+}
+
+static toff_t tiffSeek(thandle_t handle, toff_t offset, int whence)
+{
+    TiffOutput *output = static_cast<TiffOutput *>(handle);
+    switch (whence) {
+    case SEEK_CUR: output->position += qint64(offset); break;
+    case SEEK_END: output->position = output->file->size() + qint64(offset); break;
+    default:       output->position = qint64(offset); break;
+    }
+    return output->position;
+}
+
+static int tiffClose(thandle_t)
+{
+    return 0;
+}
+
+static toff_t tiffSize(thandle_t handle)
+{
+    return static_cast<TiffOutput *>(handle)->file->size();
+}
+
+static int tiffMap(thandle_t, void **, toff_t *)
+{
+    return 0;
+}
+
+static void tiffUnmap(thandle_t, void *, toff_t)
+{
+}
+#endif
+
+bool KSaneImageSaver::Private::saveTiff(Job &job, OutputFile &file)
+{
+#ifdef HAVE_TIFF
+    TiffLayout layout;
+    int photometric;
+    switch ((KSaneIface::KSaneWidget::ImageFormat)job.format) {
+    case KSaneIface::KSaneWidget::FormatBlackWhite:
+        // SANE line art uses 1 for black
+        layout.samplesPerPixel = 1; layout.bitsPerSample = 1; photometric = PHOTOMETRIC_MINISWHITE;
+        break;
+    case KSaneIface::KSaneWidget::FormatGrayScale8:
+        layout.samplesPerPixel = 1; layout.bitsPerSample = 8; photometric = PHOTOMETRIC_MINISBLACK;
+        break;
+    case KSaneIface::KSaneWidget::FormatGrayScale16:
+        layout.samplesPerPixel = 1; layout.bitsPerSample = 16; photometric = PHOTOMETRIC_MINISBLACK;
+        break;
+    case KSaneIface::KSaneWidget::FormatRGB_8_C:
+        layout.samplesPerPixel = 3; layout.bitsPerSample = 8; photometric = PHOTOMETRIC_RGB;
+        break;
+    case KSaneIface::KSaneWidget::FormatRGB_16_C:
+        layout.samplesPerPixel = 3; layout.bitsPerSample = 16; photometric = PHOTOMETRIC_RGB;
+        break;
+    default:
+        return false;
+    }
+    layout.rowBytes = (qint64(job.width) * layout.samplesPerPixel * layout.bitsPerSample + 7) / 8;
+    if (layout.rowBytes > job.bpl || job.data.size() < qint64(job.bpl) * job.height) {
+        return false;
+    }
+    // about 1 MB per strip gives enough strips to keep all threads busy
+    layout.rowsPerStrip = qBound<qint64>(1, (1024 * 1024) / qMax<qint64>(1, layout.rowBytes), job.height);
+
+    EncoderOptions::TiffCompression compression = job.options.tiffCompression;
+#ifndef COMPRESSION_ZSTD
+    // libtiff older than 4.0.10
+    if (compression == EncoderOptions::TiffZstd) {
+        compression = EncoderOptions::TiffDeflate;
+    }
+#endif
+    layout.compression = compression;
+    layout.predictor = (compression != EncoderOptions::TiffNone) && (layout.bitsPerSample >= 8);
+
+    // classic TIFF uses 32 bit offsets, leave room for incompressible data
+    const qint64 rawSize = layout.rowBytes * job.height;
+    bool bigTiff = (job.options.bigTiff == EncoderOptions::BigTiffAlways) ||
+                   (job.options.bigTiff == EncoderOptions::BigTiffAuto && rawSize + rawSize / 64 + (1 << 20) > Q_INT64_C(0xFFFFFFFF));
+
+    // libtiff writes through the output sink, it only reads when appending to a file
+    TiffOutput output = {&file, 0};
+    TIFF *tif = TIFFClientOpen(qPrintable(job.name), bigTiff ? "w8" : "w", &output,
+                               tiffRead, tiffWrite, tiffSeek, tiffClose, tiffSize, tiffMap, tiffUnmap);
+    if (!tif) {
+        file.setError(QStringLiteral("TIFF encoder: could not start %1").arg(job.name));
+        return false;
+    }
+
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, uint32_t(job.width));
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, uint32_t(job.height));
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, uint16_t(layout.bitsPerSample));
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, uint16_t(layout.samplesPerPixel));
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, uint16_t(photometric));
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, uint16_t(PLANARCONFIG_CONTIG));
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, uint32_t(layout.rowsPerStrip));
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, double(job.dpi));
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, double(job.dpi));
+    TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, uint16_t(RESUNIT_INCH));
+    TIFFSetField(tif, TIFFTAG_SOFTWARE, softwareName().constData());
+    TIFFSetField(tif, TIFFTAG_DATETIME, qPrintable(job.scan.timestamp.toString(QStringLiteral("yyyy:MM:dd HH:mm:ss"))));
+    if (!job.scan.deviceName.isEmpty()) {
+        TIFFSetField(tif, TIFFTAG_MODEL, job.scan.deviceName.toUtf8().constData());
+    }
+    if (!job.scan.options.isEmpty()) {
+        TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, optionsText(job).constData());
+    }
+    const QByteArray xmp = xmpPacket(job, false);
+    TIFFSetField(tif, TIFFTAG_XMLPACKET, uint32_t(xmp.size()), xmp.constData());
+    if (iccProfileFits(job)) {
+        TIFFSetField(tif, TIFFTAG_ICCPROFILE, uint32_t(job.scan.iccProfile.size()), job.scan.iccProfile.constData());
+    }
+
+    uint16_t tiffCompression = COMPRESSION_NONE;
+    switch (compression) {
+    case EncoderOptions::TiffLzw:     tiffCompression = COMPRESSION_LZW; break;
+    case EncoderOptions::TiffDeflate: tiffCompression = COMPRESSION_ADOBE_DEFLATE; break;
+#ifdef COMPRESSION_ZSTD
+    case EncoderOptions::TiffZstd:    tiffCompression = COMPRESSION_ZSTD; break;
+#else
+    case EncoderOptions::TiffZstd:    break;
+#endif
+    case EncoderOptions::TiffNone:    break;
+    }
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, tiffCompression);
+    if (layout.predictor) {
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, uint16_t(PREDICTOR_HORIZONTAL));
+    }
+
+    const int strips = (job.height + layout.rowsPerStrip - 1) / layout.rowsPerStrip;
+    bool ok = true;
+
+    if (compression == EncoderOptions::TiffDeflate || compression == EncoderOptions::TiffZstd) {
+        // Compress a window of strips in parallel and write them in order, the
+        // window keeps the memory use bounded for very large images.
+        const int window = qMax(1, job.options.threads) * 4;
+        QVector<int> stripIndexes;
+        QVector<QByteArray> compressed;
+        for (int first = 0; ok && first < strips; first += window) {
+            const int count = qMin(window, strips - first);
+            stripIndexes.resize(count);
+            compressed.fill(QByteArray(), count);
+            for (int i = 0; i < count; ++i) {
+                stripIndexes[i] = i;
+            }
+            QtConcurrent::blockingMap(stripIndexes, [&](int i) {
+                compressed[i] = compressTiffStrip(job, layout, first + i);
+            });
+            for (int i = 0; ok && i < count; ++i) {
+                ok = !compressed[i].isEmpty() &&
+                     TIFFWriteRawStrip(tif, first + i, compressed[i].data(), compressed[i].size()) >= 0;
+            }
+        }
+    }
+    else {
+        // libtiff may modify the buffer it encodes, so each strip is copied first
+        QByteArray strip;
+        for (int s = 0; ok && s < strips; ++s) {
+            const int firstRow = s * layout.rowsPerStrip;
+            const int rows = qMin(layout.rowsPerStrip, job.height - firstRow);
+            strip.resize(layout.rowBytes * rows);
+            for (int i = 0; i < rows; ++i) {
+                memcpy(strip.data() + layout.rowBytes * i, job.data.constData() + qint64(firstRow + i) * job.bpl, layout.rowBytes);
+            }
+            ok = TIFFWriteEncodedStrip(tif, s, strip.data(), strip.size()) >= 0;
+        }
+    }
+
+    ok = ok && TIFFFlush(tif);
+    TIFFClose(tif);
+    if (!ok) {
+        file.setError(QStringLiteral("TIFF encoder: writing %1 failed").arg(job.name));
+    }
+    return ok;
+#else
+    Q_UNUSED(job);
+    Q_UNUSED(file);
+    return false;
+#endif
+}
+
+bool KSaneImageSaver::Private::saveJxl(Job &job, OutputFile &file)
 {
-    d->m_savedOk = d->m_savingAsPng16 ? d->save16BitPng() : d->saveQImage();
-    emit imageSaved(d->m_url, d->m_name, d->m_savedOk);
+#ifdef HAVE_JXL
+    uint32_t     channels;
+    JxlDataType  dataType;
+    uint32_t     bitsPerSample;
+    switch ((KSaneIface::KSaneWidget::ImageFormat)job.format) {
+    case KSaneIface::KSaneWidget::FormatGrayScale8:
+        channels = 1; dataType = JXL_TYPE_UINT8; bitsPerSample = 8;
+        break;
+    case KSaneIface::KSaneWidget::FormatGrayScale16:
+        channels = 1; dataType = JXL_TYPE_UINT16; bitsPerSample = 16;
+        break;
+    case KSaneIface::KSaneWidget::FormatRGB_8_C:
+        channels = 3; dataType = JXL_TYPE_UINT8; bitsPerSample = 8;
+        break;
+    case KSaneIface::KSaneWidget::FormatRGB_16_C:
+        channels = 3; dataType = JXL_TYPE_UINT16; bitsPerSample = 16;
+        break;
+    default:
+        return false;
+    }
+
+    // Lossless unless a lower quality was asked for explicitly
+    const bool lossless = (job.quality < 0 || job.quality >= 100);
+
+    JxlEncoder *encoder = JxlEncoderCreate(nullptr);
+    void *runner = JxlThreadParallelRunnerCreate(nullptr, job.options.threads);
+    bool ok = encoder && runner &&
+              JxlEncoderSetParallelRunner(encoder, JxlThreadParallelRunner, runner) == JXL_ENC_SUCCESS;
+
+    if (ok) {
+        JxlBasicInfo info;
+        JxlEncoderInitBasicInfo(&info);
+        info.xsize = job.width;
+        info.ysize = job.height;
+        info.bits_per_sample = bitsPerSample;
+        info.num_color_channels = channels;
+        info.uses_original_profile = lossless ? JXL_TRUE : JXL_FALSE;
+        ok = JxlEncoderSetBasicInfo(encoder, &info) == JXL_ENC_SUCCESS;
+    }
+    if (ok) {
+        bool profileSet = iccProfileFits(job) &&
+                          JxlEncoderSetICCProfile(encoder, reinterpret_cast<const uint8_t *>(job.scan.iccProfile.constData()),
+                                                  job.scan.iccProfile.size()) == JXL_ENC_SUCCESS;
+        if (!profileSet) {
+            JxlColorEncoding colorEncoding;
+            JxlColorEncodingSetToSRGB(&colorEncoding, channels == 1 ? JXL_TRUE : JXL_FALSE);
+            ok = JxlEncoderSetColorEncoding(encoder, &colorEncoding) == JXL_ENC_SUCCESS;
+        }
+    }
+    if (ok) {
+        // the scan information goes into an XMP box
+        const QByteArray xmp = xmpPacket(job, true);
+        ok = JxlEncoderUseBoxes(encoder) == JXL_ENC_SUCCESS &&
+             JxlEncoderAddBox(encoder, "xml ", reinterpret_cast<const uint8_t *>(xmp.constData()), xmp.size(), JXL_FALSE) == JXL_ENC_SUCCESS;
+    }
+
+    JxlEncoderFrameSettings *settings = ok ? JxlEncoderFrameSettingsCreate(encoder, nullptr) : nullptr;
+    if (settings) {
+        JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT, job.options.jxlEffort);
+        if (lossless) {
+            ok = JxlEncoderSetFrameLossless(settings, JXL_TRUE) == JXL_ENC_SUCCESS;
+        }
+        else {
+            // the quality to distance mapping of cjxl
+            const float q = job.quality;
+            const float distance = (q >= 30) ? 0.1f + (100 - q) * 0.09f : 53.0f / 3000.0f * q * q - 23.0f / 20.0f * q + 25.0f;
+            ok = JxlEncoderSetFrameDistance(settings, distance) == JXL_ENC_SUCCESS;
+        }
+    }
+    else {
+        ok = false;
+    }
 
-    d->m_runMutex.unlock();
+    if (ok) {
+        // the rows are passed as they are, 16 bit samples in host byte order
+        JxlPixelFormat pixelFormat = {channels, dataType, JXL_NATIVE_ENDIAN, size_t(job.bpl)};
+        ok = JxlEncoderAddImageFrame(settings, &pixelFormat, job.data.constData(), size_t(job.bpl) * job.height) == JXL_ENC_SUCCESS;
+        JxlEncoderCloseInput(encoder);
+    }
+
+    FILE *stream = ok ? file.stream() : nullptr;
+    if (stream) {
+        // write the output in chunks instead of collecting the whole file in memory
+        QByteArray chunk(1024 * 1024, Qt::Uninitialized);
+        JxlEncoderStatus status;
+        do {
+            uint8_t *next = reinterpret_cast<uint8_t *>(chunk.data());
+            size_t available = chunk.size();
+            status = JxlEncoderProcessOutput(encoder, &next, &available);
+            ok = ok && writeAll(stream, chunk.constData(), chunk.size() - available);
+        } while (ok && status == JXL_ENC_NEED_MORE_OUTPUT);
+        ok = ok && (status == JXL_ENC_SUCCESS);
+    }
+    else {
+        ok = false;
+    }
+    if (!ok) {
+        file.setError(QStringLiteral("JPEG XL encoder: encoding %1 failed").arg(job.name));
+    }
+
+    if (runner) {
+        JxlThreadParallelRunnerDestroy(runner);
+    }
+    if (encoder) {
+        JxlEncoderDestroy(encoder);
+    }
+    return ok;
+#else
+    Q_UNUSED(job);
+    Q_UNUSED(file);
+    return false;
+#endif
 }
 
-bool KSaneImageSaver::Private::saveQImage()
+bool KSaneImageSaver::Private::saveWebp(Job &job, OutputFile &file)
 {
-    QImage img = KSaneIface::KSaneWidget::toQImageSilent(m_data, m_width, m_height, m_bpl, m_dpi, (KSaneIface::KSaneWidget::ImageFormat) m_format);
-    return img.save(m_name, qPrintable(m_fileFormat), m_quality);
+#ifdef HAVE_WEBP
+    WebPConfig config;
+    if (!WebPConfigInit(&config)) {
+        return false;
+    }
+    // Lossless unless a lower quality was asked for explicitly
+    config.lossless = (job.quality < 0 || job.quality >= 100) ? 1 : 0;
+    if (!config.lossless) {
+        config.quality = job.quality;
+    }
+    config.method = job.options.webpMethod;
+    config.thread_level = (job.options.threads > 1) ? 1 : 0;
+    if (!WebPValidateConfig(&config)) {
+        return false;
+    }
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) {
+        return false;
+    }
+    picture.width = job.width;
+    picture.height = job.height;
+    picture.use_argb = 1;
+    if (!WebPPictureAlloc(&picture)) {
+        return false;
+    }
+
+    // fill the ARGB buffer of the encoder directly, no intermediate RGB copy
+    const bool gray = (job.format == KSaneIface::KSaneWidget::FormatGrayScale8);
+    const uchar *bits = reinterpret_cast<const uchar *>(job.data.constData());
+    for (int y = 0; y < job.height; ++y) {
+        const uchar *src = bits + qint64(y) * job.bpl;
+        uint32_t *dst = picture.argb + qint64(y) * picture.argb_stride;
+        for (int x = 0; x < job.width; ++x) {
+            if (gray) {
+                dst[x] = 0xff000000u | (uint32_t(src[x]) * 0x010101u);
+            }
+            else {
+                dst[x] = 0xff000000u | (uint32_t(src[x * 3]) << 16) | (uint32_t(src[x * 3 + 1]) << 8) | src[x * 3 + 2];
+            }
+        }
+    }
+
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    bool ok = WebPEncode(&config, &picture);
+    if (!ok) {
+        file.setError(QStringLiteral("WebP encoder: error %1").arg(picture.error_code));
+    }
+    WebPPictureFree(&picture);
+
+    if (ok) {
+        FILE *stream = file.stream();
+        ok = stream && writeAll(stream, writer.mem, writer.size);
+    }
+    WebPMemoryWriterClear(&writer);
+    return ok;
+#else
+    Q_UNUSED(job);
+    Q_UNUSED(file);
+    return false;
+#endif
+}
+
+static void pngError(png_structp png_ptr, png_const_charp message)
+{
+    // keep the message for the report and return to the setjmp() in save16BitPng()
+    OutputFile *file = static_cast<OutputFile *>(png_get_error_ptr(png_ptr));
+    file->setError(QStringLiteral("PNG encoder: %1").arg(QString::fromLatin1(message)));
+    png_longjmp(png_ptr, 1);
 }
 
-bool KSaneImageSaver::Private::save16BitPng()
+bool KSaneImageSaver::Private::save16BitPng(Job &job, OutputFile &file)
 {
-    FILE        *file;
+    FILE        *stream;
     png_structp  png_ptr;
     png_infop    info_ptr;
     png_color_8  sig_bit;
-    png_bytep    row_ptr;
     int          bytesPerPixel;
 
     // open the file
-    file = fopen(qPrintable(m_name), "wb");
-    if (!file) {
+    stream = file.stream();
+    if (!stream) {
         return false;
     }
 
     // create the png struct
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, &file, pngError, nullptr);
     if (!png_ptr) {
-        fclose(file);
+        file.setError(QStringLiteral("PNG encoder: out of memory"));
         return false;
     }
 
     // create the image information srtuct
     info_ptr = png_create_info_struct(png_ptr);
-    if (!png_ptr) {
-        fclose(file);
+    if (!info_ptr) {
         png_destroy_write_struct(&png_ptr, (png_infopp)nullptr);
+        file.setError(QStringLiteral("PNG encoder: out of memory"));
+        return false;
+    }
+
+    // The scan information written into the image, libpng copies the strings.
+    // Prepared here, the objects must not be created after the setjmp().
+    const QByteArray software = softwareName();
+    const QByteArray creationTime = job.scan.timestamp.toString(Qt::ISODate).toLatin1();
+    const QByteArray source = job.scan.deviceName.toUtf8();
+    const QByteArray comment = optionsText(job);
+    // a band of rows converted to big endian at a time, the scan data is not changed
+    const qint64 rowBytes = qint64(job.width) * qMax(1, PageAnalysis::bytesPerPixel(job.format));
+    const int bandRows = int(qBound<qint64>(1, (256 * 1024) / qMax<qint64>(1, rowBytes), 32));
+    QByteArray band(rowBytes * bandRows, Qt::Uninitialized);
+    QVector<png_bytep> bandPointers(bandRows);
+    for (int i = 0; i < bandRows; ++i) {
+        bandPointers[i] = reinterpret_cast<png_bytep>(band.data() + i * rowBytes);
+    }
+
+    // libpng errors (including failed writes) end up here
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
         return false;
     }
 
     // initialize IO
-    png_init_io(png_ptr, file);
+    png_init_io(png_ptr, stream);
 
     // set the image attributes
-    switch ((KSaneIface::KSaneWidget::ImageFormat)m_format) {
+    switch ((KSaneIface::KSaneWidget::ImageFormat)job.format) {
     case KSaneIface::KSaneWidget::FormatGrayScale16:
-        png_set_IHDR(png_ptr, info_ptr, m_width, m_height, 16, PNG_COLOR_TYPE_GRAY,
+        png_set_IHDR(png_ptr, info_ptr, job.width, job.height, 16, PNG_COLOR_TYPE_GRAY,
                      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
         sig_bit.gray = 16;
         bytesPerPixel = 2;
         break;
     case KSaneIface::KSaneWidget::FormatRGB_16_C:
-        png_set_IHDR(png_ptr, info_ptr, m_width, m_height, 16, PNG_COLOR_TYPE_RGB,
+        png_set_IHDR(png_ptr, info_ptr, job.width, job.height, 16, PNG_COLOR_TYPE_RGB,
                      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
         sig_bit.red = 16;
         sig_bit.green = 16;
@@ -174,27 +1577,45 @@ bool KSaneImageSaver::Private::save16BitPng()
         bytesPerPixel = 6;
         break;
     default:
-        fclose(file);
-        png_destroy_write_struct(&png_ptr, (png_infopp)nullptr);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        file.setError(QStringLiteral("PNG encoder: unsupported image format"));
         return false;
     }
 
     png_set_sBIT(png_ptr, info_ptr, &sig_bit);
 
-    png_uint_32 dpm = m_dpi * (1000.0 / 25.4);
+    png_uint_32 dpm = job.dpi * (1000.0 / 25.4);
     png_set_pHYs(png_ptr, info_ptr, dpm, dpm, 1);
 
-    /* Optionally write comments into the image */
-//     text_ptr[0].key = "Title";
-//     text_ptr[0].text = "Mona Lisa";
-//     text_ptr[0].compression = PNG_TEXT_COMPRESSION_NONE;
-//     text_ptr[1].key = "Author";
-//     text_ptr[1].text = "Leonardo DaVinci";
-//     text_ptr[1].compression = PNG_TEXT_COMPRESSION_NONE;
-//     text_ptr[2].key = "Description";
-//     text_ptr[2].text = "<long text>";
-//     text_ptr[2].compression = PNG_TEXT_COMPRESSION_zTXt;
-//     png_set_text(png_ptr, info_ptr, text_ptr, 2);
+    // Write the scan information into the image
+    png_text text_ptr[4];
+    memset(text_ptr, 0, sizeof(text_ptr));
+    int numText = 0;
+    text_ptr[numText].key = const_cast<char *>("Software");
+    text_ptr[numText].text = const_cast<char *>(software.constData());
+    text_ptr[numText++].compression = PNG_TEXT_COMPRESSION_NONE;
+    text_ptr[numText].key = const_cast<char *>("Creation Time");
+    text_ptr[numText].text = const_cast<char *>(creationTime.constData());
+    text_ptr[numText++].compression = PNG_TEXT_COMPRESSION_NONE;
+    if (!source.isEmpty()) {
+        // iTXt, the device name is UTF-8
+        text_ptr[numText].key = const_cast<char *>("Source");
+        text_ptr[numText].text = const_cast<char *>(source.constData());
+        text_ptr[numText++].compression = PNG_ITXT_COMPRESSION_NONE;
+    }
+    if (!comment.isEmpty()) {
+        text_ptr[numText].key = const_cast<char *>("Comment");
+        text_ptr[numText].text = const_cast<char *>(comment.constData());
+        text_ptr[numText++].compression = PNG_ITXT_COMPRESSION_zTXt;
+    }
+    png_set_text(png_ptr, info_ptr, text_ptr, numText);
+
+    if (iccProfileFits(job)) {
+        // a profile libpng does not like is reported as a warning, not as an error
+        png_set_benign_errors(png_ptr, 1);
+        png_set_iCCP(png_ptr, info_ptr, "ICC Profile", PNG_COMPRESSION_TYPE_BASE,
+                     reinterpret_cast<png_const_bytep>(job.scan.iccProfile.constData()), job.scan.iccProfile.size());
+    }
 
     /* Write the file header information. */
     png_write_info(png_ptr, info_ptr);
@@ -204,30 +1625,36 @@ bool KSaneImageSaver::Private::save16BitPng()
 
     png_set_compression_level(png_ptr, 9);
 
-    // This is not nice :( swap bytes in the 16 bit color....
-    char tmp;
-    // Make sure we have a buffer size that is divisible by 2
-    int dataSize = m_data.size();
-    if ((dataSize % 2) > 0) {
-        dataSize--;
-    }
-    for (int i = 0; i < dataSize; i += 2) {
-        tmp = m_data[i];
-        m_data[i] = m_data[i + 1];
-        m_data[i + 1] = tmp;
-    }
-
-    row_ptr = (png_bytep)m_data.data();
-
-    for (int i = 0; i < m_height; i++) {
-        png_write_rows(png_ptr, &row_ptr, 1);
-        row_ptr += m_width * bytesPerPixel;
+    // PNG stores the samples big endian, with the output tables applied on the way.
+    // The trace times are taken by hand, a longjmp() must not skip a TraceSpan.
+    const int channels = bytesPerPixel / 2;
+    const qint64 samples = qint64(job.width) * channels;
+    const bool trace = Trace::isEnabled();
+    for (int y = 0; y < job.height; y += bandRows) {
+        const int rows = qMin(bandRows, job.height - y);
+        const qint64 swapStart = trace ? Trace::now() : 0;
+        for (int i = 0; i < rows; ++i) {
+            const quint16 *src = reinterpret_cast<const quint16 *>(job.data.constData() + qint64(y + i) * job.bpl);
+            quint16 *dst = reinterpret_cast<quint16 *>(bandPointers[i]);
+            if (job.outputLut.isEmpty()) {
+                SampleLut::swapBytes16(src, dst, samples);
+            }
+            else {
+                SampleLut::map16(job.outputLut.constData(), channels, src, dst, samples, true);
+            }
+        }
+        if (trace) {
+            Trace::complete("swap", "png", swapStart);
+        }
+        const qint64 deflateStart = trace ? Trace::now() : 0;
+        png_write_rows(png_ptr, bandPointers.data(), rows);
+        if (trace) {
+            Trace::complete("deflate", "png", deflateStart);
+        }
     }
 
     png_write_end(png_ptr, info_ptr);
-    png_destroy_write_struct(&png_ptr, (png_infopp) & info_ptr);
-    png_destroy_info_struct(png_ptr, (png_infopp) & info_ptr);
-    fclose(file);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
 
     return true;
 }
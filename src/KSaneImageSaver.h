@@ -27,8 +27,13 @@
 #define KSaneImageSaver_h
 
 #include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QRect>
 #include <QThread>
 #include <QString>
+#include <QStringList>
+#include <QVariantMap>
 
 class KSaneImageSaver : public QThread
 {
@@ -37,10 +42,93 @@ public:
     explicit KSaneImageSaver(QObject *parent = nullptr);
     ~KSaneImageSaver();
 
-    bool saveQImage(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality);
-    bool save16BitPng(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality);
+    // Queue an image for saving, the result is reported with imageSaved()
+    void saveQImage(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality);
+    void save16BitPng(const QUrl &url, const QString &name, const QByteArray &data, int width, int height, int bpl, int dpi, int format, const QString& fileFormat, int quality);
+
+    // Number of images queued but not yet being saved
+    int pendingImages();
+
+    // Options of the built-in JPEG encoder that is used for 8 bit gray and color images.
+    // subsampling is "4:4:4", "4:2:2" or "4:2:0", restartRows = 0 disables restart markers.
+    // The options apply to the images queued after the call.
+    void setJpegOptions(const QString &subsampling, bool progressive, int restartRows);
+
+    // Options of the JPEG XL and WebP encoders. threads = 0 uses one thread per core,
+    // jxlEffort goes from 1 (fastest) to 9, webpMethod from 0 (fastest) to 6.
+    void setEncoderOptions(int threads, int jxlEffort, int webpMethod);
+
+    // Options of the TIFF writer. compression is "none", "lzw", "deflate" or "zstd",
+    // bigTiff is "auto" (only for files that could exceed 4 GB), "always" or "never",
+    // level is the deflate or zstd compression level, -1 for the library default.
+    void setTiffOptions(const QString &compression, const QString &bigTiff, int level);
+
+    // When the saved images are synced to disk, every image is first written to a
+    // temporary file in the target directory and renamed when complete.
+    // policy is "none" (left to the kernel), "file" (fsync of every file and its
+    // directory before imageSaved) or "batch" (one sync for up to batchSize files,
+    // imageSaved is emitted when the batch is on disk).
+    void setSyncPolicy(const QString &policy, int batchSize);
+
+    // How the encoded data is written: directIo bypasses the page cache with O_DIRECT,
+    // asyncIo keeps several blocks in flight with io_uring, dropPageCache writes the
+    // file back and drops it from the cache when it is complete. Unavailable back
+    // ends fall back to plain writes.
+    void setWriteOptions(bool directIo, bool asyncIo, bool dropPageCache);
+
+    // Thumbnails and proxies saved next to every page, one entry per derivative:
+    // "<tag>=<size>,<format>[,<quality>]" with size "<n>px" (longest side) or "<n>dpi",
+    // e.g. "thumbnail=256px,jpg,80" gives "Image-0001.thumbnail.jpg".
+    // They are committed and synced with their page and only kept when the page is
+    // saved. Only for images saved to local files.
+    void setDerivatives(const QMap<QString, QString> &derivatives);
+
+    // Keeps the scanned data of every page as it came from the scanner, before regions
+    // and post-processing, in "Image-0001.skraw" next to the image (see RawCapture.h),
+    // so that skanlite-replay can save it again with other settings. level is the
+    // zstd compression level. Only for local files, applies to the images queued after the call.
+    void setRawCapture(bool enabled, int level);
+
+    // Post-processing run on the scanned data before it is encoded, see ImagePipeline.h
+    // for the stages, e.g. "levels=10:245;unsharp=0.8:2". The stages run on the saver
+    // thread (on the thread pool for regions) and apply to the images queued after the
+    // call. An invalid spec keeps the previous pipeline and returns false.
+    bool setPipeline(const QString &spec, QString *error = nullptr);
+
+    // Scan information written into the saved files: PNG text and iCCP chunks,
+    // TIFF tags, JPEG COM and XMP markers, JPEG XL boxes or QImage text keys.
+    // options are the values from KSaneWidget::getOptVals(), iccProfile may be empty.
+    // The values apply to the images queued after the call, the timestamp is
+    // taken when the image is queued.
+    void setScanMetadata(const QString &deviceName, const QMap<QString, QString> &options, const QByteArray &iccProfile);
+
+    // Entries added to the imageSaved metadata of the images queued after the call
+    void setPageMetadata(const QVariantMap &metadata);
+
+    // Parts of the page saved as separate images instead of the whole page, like several
+    // photos scanned in one pass. regions are in pixels of the scanned image, with detect
+    // the items on the bed are found by PageAnalysis::detectRegions() instead.
+    // Region n of "Image-0001.png" is saved as "Image-0001-n.png", the regions of a page
+    // are cut from the one buffer and encoded in parallel. Only for local files, the
+    // regions apply to the images queued after the call.
+    void setScanRegions(const QList<QRect> &regions, bool detect);
+
+    // Mime types of the formats encoded by the saver itself, in addition to the Qt image plugins
+    static QStringList nativeMimeTypes();
+    // File suffixes of the formats that keep 16 bit per channel
+    static QStringList suffixes16Bit();
+
 Q_SIGNALS:
-    void imageSaved(const QUrl &url, const QString &name, bool success);
+    // metadata contains the image properties (width, height, dpi, pixelFormat),
+    // the file properties (fileFormat, fileSize, sha256), the time spent on
+    // encoding and writing (encodeMs), the write back end (writeBackend) and the page
+    // analysis (blankScore, colorMode), the saved thumbnails and proxies (derivatives)
+    // and the raw capture (rawCapture, or rawCaptureError if it could not be written).
+    // An image cut from a page has its number (region), the number of images cut from
+    // the page (regionCount), the URL of the page (regionOf) and its rectangle in the
+    // page (regionRect, "x,y,width,height").
+    // If saving failed, "error" describes the failing step and the system error.
+    void imageSaved(const QUrl &url, const QString &name, bool success, const QVariantMap &metadata);
 
 protected:
     void run() Q_DECL_OVERRIDE;
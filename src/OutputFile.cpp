@@ -0,0 +1,394 @@
+/* ============================================================
+ * Description : Crash safe output file, written under a temporary
+ *               name and renamed when complete.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "OutputFile.h"
+#include "OutputSink.h"
+
+#include "config-skanlite.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QSet>
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct OutputFile::StreamCookie {
+    OutputFile *file;
+    qint64      position;
+};
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+// stdio stream functions for fopencookie() or funopen()
+static qint64 streamWrite(void *cookie, const char *data, qint64 size)
+{
+    OutputFile::StreamCookie *stream = static_cast<OutputFile::StreamCookie *>(cookie);
+    if (!stream->file->writeAt(stream->position, data, size)) {
+        errno = EIO;
+        return -1;
+    }
+    stream->position += size;
+    return size;
+}
+
+static qint64 streamSeek(void *cookie, qint64 offset, int whence)
+{
+    OutputFile::StreamCookie *stream = static_cast<OutputFile::StreamCookie *>(cookie);
+    qint64 position = offset;
+    if (whence == SEEK_CUR) {
+        position += stream->position;
+    }
+    else if (whence == SEEK_END) {
+        position += stream->file->size();
+    }
+    if (position < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    stream->position = position;
+    return position;
+}
+
+static int streamClose(void *)
+{
+    // the OutputFile closes the file
+    return 0;
+}
+
+#if defined(HAVE_FOPENCOOKIE)
+static ssize_t cookieWrite(void *cookie, const char *data, size_t size)
+{
+    return streamWrite(cookie, data, size);
+}
+
+static int cookieSeek(void *cookie, off64_t *offset, int whence)
+{
+    const qint64 position = streamSeek(cookie, *offset, whence);
+    if (position < 0) {
+        return -1;
+    }
+    *offset = position;
+    return 0;
+}
+#else
+static int cookieWrite(void *cookie, const char *data, int size)
+{
+    return streamWrite(cookie, data, size);
+}
+
+static fpos_t cookieSeek(void *cookie, fpos_t offset, int whence)
+{
+    return streamSeek(cookie, offset, whence);
+}
+#endif
+#endif
+
+// Random access device for the Qt image plugins, QIODevice keeps the position
+class OutputDevice : public QIODevice
+{
+public:
+    explicit OutputDevice(OutputFile *file) : m_file(file)
+    {
+        open(QIODevice::WriteOnly);
+    }
+
+    qint64 size() const Q_DECL_OVERRIDE
+    {
+        return m_file->size();
+    }
+
+protected:
+    qint64 readData(char *, qint64) Q_DECL_OVERRIDE
+    {
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 size) Q_DECL_OVERRIDE
+    {
+        return m_file->writeAt(pos(), data, size) ? size : -1;
+    }
+
+private:
+    OutputFile *m_file;
+};
+
+OutputFile::OutputFile(const QString &fileName)
+    : m_fileName(fileName)
+{
+}
+
+OutputFile::~OutputFile()
+{
+    close();
+    if (!m_committed && !m_tempName.isEmpty()) {
+        ::unlink(QFile::encodeName(m_tempName).constData());
+    }
+}
+
+bool OutputFile::open(int fileMode, const WriteOptions &options)
+{
+    const QFileInfo info(m_fileName);
+    QByteArray name = QFile::encodeName(info.absolutePath() + QLatin1String("/.") + info.fileName() + QLatin1String(".XXXXXX"));
+    m_fd = mkostemp(name.data(), O_CLOEXEC);
+    if (m_fd < 0) {
+        return setSystemError(QStringLiteral("Could not create a temporary file in %1").arg(info.absolutePath()));
+    }
+    m_tempName = QFile::decodeName(name);
+    if (fchmod(m_fd, fileMode) != 0) {
+        return setSystemError(QStringLiteral("Could not set the permissions of %1").arg(m_tempName));
+    }
+    m_options = options;
+    m_sink = OutputSink::create(m_fd, m_tempName, options.directIo, options.asyncIo);
+    if (!m_sink->errorString().isEmpty()) {
+        setError(QStringLiteral("%1 (%2)").arg(m_sink->errorString(), m_tempName));
+        return false;
+    }
+    return true;
+}
+
+FILE *OutputFile::stream()
+{
+    if (!m_stream && m_sink) {
+        m_cookie = new StreamCookie{this, 0};
+#if defined(HAVE_FOPENCOOKIE)
+        cookie_io_functions_t functions = {nullptr, cookieWrite, cookieSeek, streamClose};
+        m_stream = fopencookie(m_cookie, "wb", functions);
+#elif defined(HAVE_FUNOPEN)
+        m_stream = funopen(m_cookie, nullptr, cookieWrite, cookieSeek, streamClose);
+#else
+        // the encoders that need a stream fail, the Qt image plugins use device()
+        errno = ENOTSUP;
+#endif
+        if (!m_stream) {
+            setSystemError(QStringLiteral("Could not open a stream on %1").arg(m_tempName));
+        }
+        else {
+            // the sink collects the data in large blocks anyway
+            setvbuf(m_stream, nullptr, _IOFBF, 64 * 1024);
+        }
+    }
+    return m_stream;
+}
+
+QIODevice *OutputFile::device()
+{
+    if (!m_device && m_sink) {
+        m_device = new OutputDevice(this);
+    }
+    return m_device;
+}
+
+bool OutputFile::writeAt(qint64 offset, const char *data, qint64 size)
+{
+    if (!m_sink || !m_sink->writeAt(offset, data, size)) {
+        if (m_sink) {
+            setError(QStringLiteral("%1 (%2)").arg(m_sink->errorString(), m_tempName));
+        }
+        return false;
+    }
+    return true;
+}
+
+qint64 OutputFile::size() const
+{
+    return m_sink ? m_sink->size() : 0;
+}
+
+QByteArray OutputFile::sha256() const
+{
+    return m_sink ? m_sink->sha256() : QByteArray();
+}
+
+QString OutputFile::backendName() const
+{
+    return m_sink ? QString::fromLatin1(m_sink->name()) : QString();
+}
+
+bool OutputFile::finish()
+{
+    if (!m_sink) {
+        return false;
+    }
+    if (m_stream && (fflush(m_stream) != 0 || ferror(m_stream))) {
+        return setSystemError(QStringLiteral("Writing %1 failed").arg(m_tempName));
+    }
+    if (!m_sink->finish()) {
+        setError(QStringLiteral("%1 (%2)").arg(m_sink->errorString(), m_tempName));
+        return false;
+    }
+    if (m_options.dropPageCache && m_error.isEmpty()) {
+        // Only clean pages can be dropped: start the write back now and wait for
+        // it, then the multi-hundred-MB image does not push other data out of the cache.
+#ifdef SYNC_FILE_RANGE_WRITE
+        sync_file_range(m_fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+        fdatasync(m_fd);
+#endif
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return m_error.isEmpty();
+}
+
+bool OutputFile::sync()
+{
+    if (fdatasync(m_fd) != 0) {
+        return setSystemError(QStringLiteral("Syncing %1 failed").arg(m_tempName));
+    }
+    return true;
+}
+
+bool OutputFile::commit(bool syncDir)
+{
+    // close first, some file systems only report write back errors on close
+    if (!close()) {
+        return false;
+    }
+    if (::rename(QFile::encodeName(m_tempName).constData(), QFile::encodeName(m_fileName).constData()) != 0) {
+        return setSystemError(QStringLiteral("Renaming %1 to %2 failed").arg(m_tempName, m_fileName));
+    }
+    m_committed = true;
+    if (syncDir) {
+        return syncDirectory(QFileInfo(m_fileName).absolutePath(), m_error);
+    }
+    return true;
+}
+
+bool OutputFile::commitBatch(const QList<OutputFile *> &files)
+{
+    bool ok = true;
+#ifdef HAVE_SYNCFS
+    // one syncfs() writes back all files of the batch on the same file system
+    QSet<dev_t> synced;
+    foreach (OutputFile *file, files) {
+        struct stat st;
+        if (!file->m_error.isEmpty() || file->m_fd < 0 || fstat(file->m_fd, &st) != 0 || synced.contains(st.st_dev)) {
+            continue;
+        }
+        if (syncfs(file->m_fd) != 0) {
+            file->setSystemError(QStringLiteral("Syncing the file system of %1 failed").arg(file->m_tempName));
+            ok = false;
+            continue;
+        }
+        synced.insert(st.st_dev);
+    }
+#else
+    foreach (OutputFile *file, files) {
+        ok = file->m_error.isEmpty() && file->sync() && ok;
+    }
+#endif
+
+    QSet<QString> directories;
+    foreach (OutputFile *file, files) {
+        if (file->m_error.isEmpty() && file->commit(false)) {
+            directories.insert(QFileInfo(file->m_fileName).absolutePath());
+        }
+        else {
+            ok = false;
+        }
+    }
+    foreach (const QString &dir, directories) {
+        QString error;
+        if (!syncDirectory(dir, error)) {
+            foreach (OutputFile *file, files) {
+                if (file->m_committed && QFileInfo(file->m_fileName).absolutePath() == dir) {
+                    file->setError(error);
+                }
+            }
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void OutputFile::discard()
+{
+    close();
+    const QString &name = m_committed ? m_fileName : m_tempName;
+    if (!name.isEmpty()) {
+        ::unlink(QFile::encodeName(name).constData());
+    }
+    m_committed = false;
+    m_tempName.clear();
+}
+
+void OutputFile::setError(const QString &error)
+{
+    // keep the first error, it is the cause of the following ones
+    if (m_error.isEmpty()) {
+        m_error = error;
+    }
+}
+
+bool OutputFile::setSystemError(const QString &step)
+{
+    setError(QStringLiteral("%1: %2").arg(step, QString::fromLocal8Bit(strerror(errno))));
+    return false;
+}
+
+bool OutputFile::close()
+{
+    bool ok = true;
+    if (m_stream) {
+        // everything was flushed in finish(), a failure here means an earlier error
+        fclose(m_stream);
+        m_stream = nullptr;
+    }
+    delete m_cookie;
+    m_cookie = nullptr;
+    delete m_device;
+    m_device = nullptr;
+    // waits for the writes that are still in flight
+    delete m_sink;
+    m_sink = nullptr;
+    if (m_fd >= 0) {
+        ok = (::close(m_fd) == 0);
+    }
+    m_fd = -1;
+    if (!ok) {
+        return setSystemError(QStringLiteral("Closing %1 failed").arg(m_tempName));
+    }
+    return m_error.isEmpty();
+}
+
+bool OutputFile::syncDirectory(const QString &dir, QString &error)
+{
+    int fd = ::open(QFile::encodeName(dir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (error.isEmpty()) {
+            error = QStringLiteral("Syncing the directory %1 failed: %2").arg(dir, QString::fromLocal8Bit(strerror(errno)));
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
@@ -0,0 +1,117 @@
+/* ============================================================
+ * Description : Crash safe output file, written under a temporary
+ *               name and renamed when complete.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef OutputFile_h
+#define OutputFile_h
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+#include <stdio.h>
+
+class OutputSink;
+class QIODevice;
+
+// The encoders write to a hidden temporary file in the target directory, which
+// is renamed over the final name only when it is complete. A crash or a full
+// disk leaves at most a stale ".name.XXXXXX" file, never a truncated image
+// under the final name.
+//
+// The encoders write through a stdio stream, a QIODevice or writeAt(), all of
+// them end in an OutputSink that does the actual writing.
+class OutputFile
+{
+public:
+    struct WriteOptions {
+        bool directIo = false;      // O_DIRECT, bypasses the page cache
+        bool asyncIo = false;       // io_uring, several blocks in flight
+        bool dropPageCache = false; // write back and drop the cached pages when the file is complete
+    };
+
+    enum SyncPolicy {
+        SyncNone,     // leave the write back to the kernel
+        SyncPerFile,  // the file and its directory are on disk when the image is reported saved
+        SyncBatched   // group commit, one sync for a batch of files
+    };
+
+    explicit OutputFile(const QString &fileName);
+    // removes the temporary file if it was not committed
+    ~OutputFile();
+
+    // Creates the temporary file, fileMode is applied instead of the 0600 of mkstemp
+    bool open(int fileMode, const WriteOptions &options);
+
+    const QString &fileName() const { return m_fileName; }
+    // stdio stream on the file, owned by the OutputFile, nullptr on systems
+    // without fopencookie() or funopen()
+    FILE *stream();
+    // device on the file for the Qt image plugins, owned by the OutputFile
+    QIODevice *device();
+    bool writeAt(qint64 offset, const char *data, qint64 size);
+    qint64 size() const;
+
+    // SHA-256 of the written data, empty if it could not be computed while writing
+    QByteArray sha256() const;
+    // the write back end that was used, see OutputSink::name()
+    QString backendName() const;
+
+    // Writes the remaining data and checks for write errors, the file stays open
+    bool finish();
+    // fdatasync() of the file
+    bool sync();
+    // Renames the file to the final name and closes it, syncDirectory makes the rename durable
+    bool commit(bool syncDirectory);
+
+    // Syncs the data of all files with one syncfs() per file system where
+    // available, renames them and syncs each directory once. Files that already
+    // have an error are left out and stay uncommitted.
+    static bool commitBatch(const QList<OutputFile *> &files);
+
+    // Closes and removes the file, also when it was already committed
+    void discard();
+
+    // Errors are remembered with the failing step and the system error
+    void setError(const QString &error);
+    const QString &errorString() const { return m_error; }
+
+    // state of the stdio stream, used by the fopencookie() or funopen() functions
+    struct StreamCookie;
+
+private:
+    bool setSystemError(const QString &step);
+    bool close();
+    static bool syncDirectory(const QString &dir, QString &error);
+
+    QString       m_fileName;
+    QString       m_tempName;
+    int           m_fd = -1;
+    WriteOptions  m_options;
+    OutputSink   *m_sink = nullptr;
+    StreamCookie *m_cookie = nullptr;
+    FILE         *m_stream = nullptr;
+    QIODevice    *m_device = nullptr;
+    bool          m_committed = false;
+    QString       m_error;
+};
+
+#endif
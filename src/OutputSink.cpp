@@ -0,0 +1,339 @@
+/* ============================================================
+ * Description : Write back ends of the image saver: buffered
+ *               pwrite(), O_DIRECT and io_uring.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "OutputSink.h"
+#include "Trace.h"
+
+#include "config-skanlite.h"
+
+#include <QFile>
+#include <QDebug>
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// O_DIRECT needs the buffers, sizes and offsets aligned to the logical block
+// size of the device, 4 kB covers the common 512 byte and 4 kB devices.
+static const int DirectAlignment = 4096;
+
+#ifdef HAVE_LIBURING
+class UringOutputSink : public OutputSink
+{
+public:
+    UringOutputSink(int fd, int dataFd, int alignment, io_uring *ring)
+        : OutputSink(fd, dataFd, alignment, BufferCount), m_ring(ring)
+    {
+        m_inFlight.fill(0, BufferCount);
+    }
+
+    ~UringOutputSink()
+    {
+        drain();
+        io_uring_queue_exit(m_ring);
+        delete m_ring;
+    }
+
+    const char *name() const Q_DECL_OVERRIDE
+    {
+        return (m_dataFd != m_fd) ? "io_uring+direct" : "io_uring";
+    }
+
+    static const int BufferCount = 4;
+
+protected:
+    bool submit(int index, qint64 size, qint64 offset) Q_DECL_OVERRIDE
+    {
+        io_uring_sqe *sqe = io_uring_get_sqe(m_ring);
+        if (!sqe) {
+            // the ring holds one entry per buffer, it cannot be full
+            return OutputSink::submit(index, size, offset);
+        }
+        io_uring_prep_write(sqe, m_dataFd, m_buffers[index], size, offset);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(quintptr(index)));
+        m_inFlight[index] = size;
+        m_offsets[index] = offset;
+        const int ret = io_uring_submit(m_ring);
+        if (ret < 0) {
+            m_inFlight[index] = 0;
+            return setSystemError(QStringLiteral("Submitting a write"), -ret);
+        }
+        return true;
+    }
+
+    bool waitFor(int index) Q_DECL_OVERRIDE
+    {
+        while (m_inFlight[index] > 0) {
+            if (!reapOne()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool drain() Q_DECL_OVERRIDE
+    {
+        bool ok = true;
+        for (int i = 0; i < BufferCount; ++i) {
+            ok = waitFor(i) && ok;
+        }
+        return ok;
+    }
+
+private:
+    bool reapOne()
+    {
+        io_uring_cqe *cqe = nullptr;
+        const qint64 waitStart = Trace::isEnabled() ? Trace::now() : 0;
+        int ret = io_uring_wait_cqe(m_ring, &cqe);
+        if (Trace::isEnabled()) {
+            Trace::complete("write wait", "io", waitStart);
+        }
+        if (ret < 0) {
+            // nothing can be known about the pending writes anymore
+            m_inFlight.fill(0);
+            return setSystemError(QStringLiteral("Waiting for a write"), -ret);
+        }
+        const int index = int(quintptr(io_uring_cqe_get_data(cqe)));
+        const int res = cqe->res;
+        io_uring_cqe_seen(m_ring, cqe);
+
+        const qint64 size = m_inFlight[index];
+        m_inFlight[index] = 0;
+        if (res < 0) {
+            return setSystemError(QStringLiteral("Writing"), -res);
+        }
+        if (res < size) {
+            // a short write, the rest goes through the buffered descriptor
+            return pwriteAll(m_fd, m_buffers[index] + res, size - res, m_offsets[index] + res);
+        }
+        return true;
+    }
+
+    io_uring        *m_ring;
+    QVector<qint64>  m_inFlight;
+    qint64           m_offsets[BufferCount] = {};
+};
+#endif
+
+OutputSink *OutputSink::create(int fd, const QString &fileName, bool directIo, bool asyncIo)
+{
+    int dataFd = fd;
+    int alignment = 1;
+    if (directIo) {
+        // a second descriptor on the same file, the buffered one stays for the out of order writes
+        dataFd = ::open(QFile::encodeName(fileName).constData(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        if (dataFd < 0) {
+            // e.g. tmpfs does not support O_DIRECT
+            qDebug() << "Direct I/O not available for" << fileName << strerror(errno);
+            dataFd = fd;
+        }
+        else {
+            alignment = DirectAlignment;
+        }
+    }
+
+#ifdef HAVE_LIBURING
+    if (asyncIo) {
+        io_uring *ring = new io_uring;
+        const int ret = io_uring_queue_init(UringOutputSink::BufferCount, ring, 0);
+        if (ret == 0) {
+            return new UringOutputSink(fd, dataFd, alignment, ring);
+        }
+        // disabled in the kernel or by a seccomp filter
+        qDebug() << "io_uring not available:" << strerror(-ret);
+        delete ring;
+    }
+#else
+    Q_UNUSED(asyncIo);
+#endif
+    return new OutputSink(fd, dataFd, alignment, 1);
+}
+
+OutputSink::OutputSink(int fd, int dataFd, int alignment, int bufferCount)
+    : m_fd(fd)
+    , m_dataFd(dataFd)
+    , m_alignment(alignment)
+    , m_hash(QCryptographicHash::Sha256)
+{
+    for (int i = 0; i < bufferCount; ++i) {
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, DirectAlignment, BlockSize) != 0) {
+            buffer = nullptr;
+        }
+        m_buffers.append(static_cast<char *>(buffer));
+    }
+    if (m_buffers.contains(nullptr)) {
+        setSystemError(QStringLiteral("Allocating the write buffers"), ENOMEM);
+    }
+}
+
+OutputSink::~OutputSink()
+{
+    foreach (char *buffer, m_buffers) {
+        free(buffer);
+    }
+    if (m_dataFd != m_fd) {
+        ::close(m_dataFd);
+    }
+}
+
+bool OutputSink::writeAt(qint64 offset, const char *data, qint64 size)
+{
+    if (!m_error.isEmpty()) {
+        return false;
+    }
+    const qint64 appendOffset = m_blockOffset + m_fill;
+    if (offset >= appendOffset) {
+        // a seek past the end leaves a hole, fill it like the file system would
+        static const char zeros[4096] = {};
+        for (qint64 gap = offset - appendOffset; gap > 0; gap -= sizeof(zeros)) {
+            if (!append(zeros, qMin<qint64>(gap, sizeof(zeros)))) {
+                return false;
+            }
+        }
+        return append(data, size);
+    }
+
+    // overwriting data that was already written, the hash of the stream is of no use anymore
+    m_hashValid = false;
+    const qint64 end = offset + size;
+    if (offset < m_blockOffset) {
+        // the block may still be in flight, the buffered write must not overtake it
+        const qint64 length = qMin(end, m_blockOffset) - offset;
+        if (!drain() || !pwriteAll(m_fd, data, length, offset)) {
+            return false;
+        }
+    }
+    if (end > m_blockOffset) {
+        const qint64 first = qMax(offset, m_blockOffset);
+        const qint64 last = qMin(end, appendOffset);
+        memcpy(m_buffers[m_current] + (first - m_blockOffset), data + (first - offset), last - first);
+        if (end > appendOffset) {
+            return append(data + (appendOffset - offset), end - appendOffset);
+        }
+    }
+    return true;
+}
+
+bool OutputSink::append(const char *data, qint64 size)
+{
+    if (m_hashValid) {
+        m_hash.addData(data, size);
+    }
+    while (size > 0) {
+        const qint64 length = qMin(size, BlockSize - m_fill);
+        memcpy(m_buffers[m_current] + m_fill, data, length);
+        m_fill += length;
+        data += length;
+        size -= length;
+        m_size = qMax(m_size, m_blockOffset + m_fill);
+
+        if (m_fill == BlockSize) {
+            if (!submit(m_current, m_fill, m_blockOffset)) {
+                return false;
+            }
+            m_blockOffset += m_fill;
+            m_fill = 0;
+            m_current = (m_current + 1) % m_buffers.size();
+            if (!waitFor(m_current)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool OutputSink::finish()
+{
+    if (!m_error.isEmpty()) {
+        return false;
+    }
+    bool ok = true;
+    if (m_fill > 0) {
+        // direct I/O writes whole blocks, the padding is cut off again below
+        const qint64 padded = (m_fill + m_alignment - 1) / m_alignment * m_alignment;
+        memset(m_buffers[m_current] + m_fill, 0, padded - m_fill);
+        ok = submit(m_current, padded, m_blockOffset);
+    }
+    ok = drain() && ok;
+    if (ok && m_alignment > 1 && ftruncate(m_fd, m_size) != 0) {
+        return setSystemError(QStringLiteral("Truncating the padding"), errno);
+    }
+    return ok;
+}
+
+QByteArray OutputSink::sha256() const
+{
+    return m_hashValid ? m_hash.result() : QByteArray();
+}
+
+bool OutputSink::submit(int index, qint64 size, qint64 offset)
+{
+    return pwriteAll(m_dataFd, m_buffers[index], size, offset);
+}
+
+bool OutputSink::waitFor(int index)
+{
+    Q_UNUSED(index);
+    return true;
+}
+
+bool OutputSink::drain()
+{
+    return m_error.isEmpty();
+}
+
+bool OutputSink::pwriteAll(int fd, const char *data, qint64 size, qint64 offset)
+{
+    TraceSpan span("write", "io");
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return setSystemError(QStringLiteral("Writing"), errno);
+        }
+        data += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool OutputSink::setSystemError(const QString &step, int error)
+{
+    if (m_error.isEmpty()) {
+        m_error = QStringLiteral("%1: %2").arg(step, QString::fromLocal8Bit(strerror(error)));
+    }
+    return false;
+}
@@ -0,0 +1,92 @@
+/* ============================================================
+ * Description : Write back ends of the image saver: buffered
+ *               pwrite(), O_DIRECT and io_uring.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef OutputSink_h
+#define OutputSink_h
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <QVector>
+
+// Collects the encoder output in large aligned blocks and hands the full
+// blocks to the write back end. The encoders mostly append; the few writes
+// to an earlier offset (TIFF and some Qt plugins patch their headers) go
+// into the current block or through a buffered pwrite().
+//
+// The base class writes the blocks synchronously with pwrite(). With direct
+// I/O the blocks bypass the page cache, with io_uring several blocks are in
+// flight while the encoder fills the next one.
+class OutputSink
+{
+public:
+    // Creates the requested back end for the open file, falls back to plain
+    // writes where O_DIRECT or io_uring are not available. The sink does not
+    // own fd.
+    static OutputSink *create(int fd, const QString &fileName, bool directIo, bool asyncIo);
+    virtual ~OutputSink();
+
+    bool writeAt(qint64 offset, const char *data, qint64 size);
+    // Writes the remaining data and waits for all writes to complete
+    bool finish();
+
+    qint64 size() const { return m_size; }
+    // SHA-256 of the file, computed while writing; empty if the file was not written front to back
+    QByteArray sha256() const;
+    // "pwrite", "direct", "io_uring" or "io_uring+direct"
+    virtual const char *name() const { return (m_dataFd != m_fd) ? "direct" : "pwrite"; }
+
+    const QString &errorString() const { return m_error; }
+
+protected:
+    OutputSink(int fd, int dataFd, int alignment, int bufferCount);
+
+    // Writes a block, the data stays valid until drained
+    virtual bool submit(int index, qint64 size, qint64 offset);
+    // Waits until the block can be filled again
+    virtual bool waitFor(int index);
+    // Waits for all blocks
+    virtual bool drain();
+
+    bool pwriteAll(int fd, const char *data, qint64 size, qint64 offset);
+    bool setSystemError(const QString &step, int error);
+
+    static const qint64 BlockSize = 1024 * 1024;
+
+    int              m_fd;        // buffered descriptor, used for the out of order writes
+    int              m_dataFd;    // descriptor for the blocks, O_DIRECT with direct I/O
+    int              m_alignment; // size alignment the blocks need
+    QVector<char *>  m_buffers;
+    QString          m_error;
+
+private:
+    bool append(const char *data, qint64 size);
+
+    int                m_current = 0;
+    qint64             m_fill = 0;
+    qint64             m_blockOffset = 0; // file offset of the current block
+    qint64             m_size = 0;
+    QCryptographicHash m_hash;
+    bool               m_hashValid = true;
+};
+
+#endif
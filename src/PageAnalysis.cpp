@@ -0,0 +1,294 @@
+/* ============================================================
+ * Description : Cheap analysis of the raw scan data.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "PageAnalysis.h"
+
+#include <QVector>
+#include <QtMath>
+
+#include <algorithm>
+#include <string.h>
+
+#include <KSaneWidget>
+
+using namespace KSaneIface;
+
+// roughly this many pixels are looked at per page
+static const int targetSamples = 512 * 512;
+// channels differing more than this (8-bit scale) count as a colored pixel
+static const int chromaThreshold = 32;
+
+QString PageAnalysis::formatName(int format)
+{
+    switch (format) {
+    case KSaneWidget::FormatBlackWhite:  return QStringLiteral("BlackWhite");
+    case KSaneWidget::FormatGrayScale8:  return QStringLiteral("Gray8");
+    case KSaneWidget::FormatGrayScale16: return QStringLiteral("Gray16");
+    case KSaneWidget::FormatRGB_8_C:     return QStringLiteral("RGB8");
+    case KSaneWidget::FormatRGB_16_C:    return QStringLiteral("RGB16");
+    default:                             return QStringLiteral("Unknown");
+    }
+}
+
+int PageAnalysis::bytesPerPixel(int format)
+{
+    switch (format) {
+    case KSaneWidget::FormatGrayScale8:  return 1;
+    case KSaneWidget::FormatGrayScale16: return 2;
+    case KSaneWidget::FormatRGB_8_C:     return 3;
+    case KSaneWidget::FormatRGB_16_C:    return 6;
+    default:                             return 0;
+    }
+}
+
+void PageAnalysis::sample(const uchar *row, int x, int format, int &gray, int &chroma)
+{
+    // 16 bit samples are in host (little endian) byte order, the high byte is enough here
+    int r, g, b;
+    switch (format) {
+    case KSaneWidget::FormatBlackWhite:
+        gray = (row[x / 8] & (0x80 >> (x % 8))) ? 0 : 255;
+        chroma = 0;
+        return;
+    case KSaneWidget::FormatGrayScale8:
+        gray = row[x];
+        chroma = 0;
+        return;
+    case KSaneWidget::FormatGrayScale16:
+        gray = row[x * 2 + 1];
+        chroma = 0;
+        return;
+    case KSaneWidget::FormatRGB_8_C:
+        r = row[x * 3];
+        g = row[x * 3 + 1];
+        b = row[x * 3 + 2];
+        break;
+    case KSaneWidget::FormatRGB_16_C:
+        r = row[x * 6 + 1];
+        g = row[x * 6 + 3];
+        b = row[x * 6 + 5];
+        break;
+    default:
+        gray = 255;
+        chroma = 0;
+        return;
+    }
+    gray = (r * 77 + g * 150 + b * 29) >> 8;
+    chroma = qMax(r, qMax(g, b)) - qMin(r, qMin(g, b));
+}
+
+quint64 PageAnalysis::perceptualHash(const QByteArray &data, int width, int height, int bpl, int format)
+{
+    if (width < 9 || height < 8 || data.size() < bpl * height) {
+        return 0;
+    }
+
+    // average of up to 16x16 samples per cell, enough for a hash of a 9x8 image
+    int cells[8][9];
+    const uchar *bits = reinterpret_cast<const uchar *>(data.constData());
+    for (int cy = 0; cy < 8; ++cy) {
+        const int top = qint64(cy) * height / 8;
+        const int bottom = qint64(cy + 1) * height / 8;
+        const int stepY = qMax(1, (bottom - top) / 16);
+        for (int cx = 0; cx < 9; ++cx) {
+            const int left = qint64(cx) * width / 9;
+            const int right = qint64(cx + 1) * width / 9;
+            const int stepX = qMax(1, (right - left) / 16);
+            int sum = 0;
+            int count = 0;
+            for (int y = top + stepY / 2; y < bottom; y += stepY) {
+                const uchar *row = bits + qint64(y) * bpl;
+                for (int x = left + stepX / 2; x < right; x += stepX) {
+                    int gray, chroma;
+                    sample(row, x, format, gray, chroma);
+                    sum += gray;
+                    count++;
+                }
+            }
+            cells[cy][cx] = count ? sum / count : 255;
+        }
+    }
+
+    quint64 hash = 0;
+    for (int cy = 0; cy < 8; ++cy) {
+        for (int cx = 0; cx < 8; ++cx) {
+            hash = (hash << 1) | (cells[cy][cx] > cells[cy][cx + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+PageAnalysis::Result PageAnalysis::analyze(const QByteArray &data, int width, int height, int bpl, int format)
+{
+    Result result;
+    result.colorMode = (format == KSaneWidget::FormatBlackWhite) ? QStringLiteral("bw") : QStringLiteral("gray");
+    if (width <= 0 || height <= 0 || data.size() < bpl * height) {
+        return result;
+    }
+
+    // sample on a regular grid
+    const int step = qMax(1, int(qSqrt(qreal(width) * height / targetSamples)));
+    int histogram[256] = {};
+    int samples = 0;
+    int colored = 0;
+    const uchar *bits = reinterpret_cast<const uchar *>(data.constData());
+    for (int y = step / 2; y < height; y += step) {
+        const uchar *row = bits + qint64(y) * bpl;
+        for (int x = step / 2; x < width; x += step) {
+            int gray, chroma;
+            sample(row, x, format, gray, chroma);
+            histogram[gray]++;
+            if (chroma > chromaThreshold) {
+                colored++;
+            }
+            samples++;
+        }
+    }
+    if (samples == 0) {
+        return result;
+    }
+
+    // The paper is the bright majority of the page, everything clearly darker is content.
+    int paper = 255;
+    for (int count = 0; paper > 0; --paper) {
+        count += histogram[paper];
+        if (count * 20 >= samples) {
+            break;
+        }
+    }
+    const int inkThreshold = paper * 3 / 4;
+    int ink = 0;
+    for (int i = 0; i < inkThreshold; ++i) {
+        ink += histogram[i];
+    }
+    result.blankScore = 1.0 - qreal(ink) / samples;
+
+    // a few colored pixels are scanner noise or dust
+    if (format == KSaneWidget::FormatRGB_8_C || format == KSaneWidget::FormatRGB_16_C) {
+        result.colorMode = (colored * 1000 > samples) ? QStringLiteral("color") : QStringLiteral("gray");
+    }
+    return result;
+}
+
+QList<QRect> PageAnalysis::detectRegions(const QByteArray &data, int width, int height, int bpl, int format, int dpi)
+{
+    QList<QRect> regions;
+    if (width <= 0 || height <= 0 || data.size() < bpl * height) {
+        return regions;
+    }
+    if (dpi <= 0) {
+        dpi = 300;
+    }
+
+    // sample on a regular grid, one cell per step x step pixels
+    const int step = qMax(1, int(qSqrt(qreal(width) * height / targetSamples)));
+    const int gridWidth = (width + step - 1) / step;
+    const int gridHeight = (height + step - 1) / step;
+    QVector<uchar> grays(gridWidth * gridHeight);
+    QVector<uchar> colored(gridWidth * gridHeight);
+    int histogram[256] = {};
+    const uchar *bits = reinterpret_cast<const uchar *>(data.constData());
+    for (int gy = 0; gy < gridHeight; ++gy) {
+        const uchar *row = bits + qint64(qMin(height - 1, gy * step + step / 2)) * bpl;
+        for (int gx = 0; gx < gridWidth; ++gx) {
+            int gray, chroma;
+            sample(row, qMin(width - 1, gx * step + step / 2), format, gray, chroma);
+            grays[gy * gridWidth + gx] = gray;
+            colored[gy * gridWidth + gx] = (chroma > chromaThreshold);
+            histogram[gray]++;
+        }
+    }
+
+    // The background (lid or bed) is the most common gray level, everything
+    // clearly different from it belongs to an item.
+    int background = 0;
+    for (int i = 1; i < 256; ++i) {
+        if (histogram[i] > histogram[background]) {
+            background = i;
+        }
+    }
+    const int cells = gridWidth * gridHeight;
+    QVector<uchar> mask(cells);
+    for (int i = 0; i < cells; ++i) {
+        mask[i] = (qAbs(grays[i] - background) > 40 || colored[i]);
+    }
+
+    // bridge small gaps so that a light part of a photo does not split it
+    const qreal cellsPerMm = qreal(dpi) / 25.4 / step;
+    const int radius = qMax(1, qRound(2 * cellsPerMm));
+    QVector<uchar> grown(cells);
+    for (int gy = 0; gy < gridHeight; ++gy) {
+        for (int gx = 0; gx < gridWidth; ++gx) {
+            if (!mask[gy * gridWidth + gx]) {
+                continue;
+            }
+            for (int y = qMax(0, gy - radius); y <= qMin(gridHeight - 1, gy + radius); ++y) {
+                memset(grown.data() + y * gridWidth + qMax(0, gx - radius), 1,
+                       qMin(gridWidth - 1, gx + radius) - qMax(0, gx - radius) + 1);
+            }
+        }
+    }
+
+    // bounding boxes of the connected areas
+    const int minSize = qMax(1, qRound(10 * cellsPerMm));
+    QVector<int> stack;
+    for (int start = 0; start < cells; ++start) {
+        if (grown[start] != 1) {
+            continue;
+        }
+        int left = gridWidth, top = gridHeight, right = -1, bottom = -1;
+        grown[start] = 2;
+        stack.append(start);
+        while (!stack.isEmpty()) {
+            const int cell = stack.takeLast();
+            const int gx = cell % gridWidth;
+            const int gy = cell / gridWidth;
+            left = qMin(left, gx);
+            right = qMax(right, gx);
+            top = qMin(top, gy);
+            bottom = qMax(bottom, gy);
+            const int neighbours[4] = { gx > 0 ? cell - 1 : -1, gx < gridWidth - 1 ? cell + 1 : -1,
+                                        gy > 0 ? cell - gridWidth : -1, gy < gridHeight - 1 ? cell + gridWidth : -1 };
+            for (int n : neighbours) {
+                if (n >= 0 && grown[n] == 1) {
+                    grown[n] = 2;
+                    stack.append(n);
+                }
+            }
+        }
+
+        // undo the growing, except at the borders of the bed
+        left = (left > 0) ? left + radius : 0;
+        top = (top > 0) ? top + radius : 0;
+        right = (right < gridWidth - 1) ? right - radius : gridWidth - 1;
+        bottom = (bottom < gridHeight - 1) ? bottom - radius : gridHeight - 1;
+        if (right - left + 1 < minSize || bottom - top + 1 < minSize) {
+            continue;
+        }
+        regions.append(QRect(QPoint(left * step, top * step),
+                             QPoint(qMin(width, (right + 1) * step) - 1, qMin(height, (bottom + 1) * step) - 1)));
+    }
+
+    std::sort(regions.begin(), regions.end(), [](const QRect &a, const QRect &b) {
+        return (a.top() != b.top()) ? a.top() < b.top() : a.left() < b.left();
+    });
+    return regions;
+}
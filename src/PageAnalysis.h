@@ -0,0 +1,64 @@
+/* ============================================================
+ * Description : Cheap analysis of the raw scan data.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef PageAnalysis_h
+#define PageAnalysis_h
+
+#include <QByteArray>
+#include <QList>
+#include <QRect>
+#include <QString>
+
+// The functions work directly on the image data delivered by KSaneWidget::imageReady()
+// and only look at a sparse grid of samples, so they are cheap even for large scans.
+namespace PageAnalysis
+{
+    struct Result {
+        // 1.0 for an empty page, goes towards 0.0 the more of the page is covered
+        double  blankScore = 1.0;
+        // "color", "gray" or "bw"
+        QString colorMode;
+    };
+
+    Result analyze(const QByteArray &data, int width, int height, int bpl, int format);
+
+    // 64 bit difference hash (dHash) of the page: the page is reduced to 9x8 gray
+    // cells and every bit tells whether a cell is brighter than its right neighbour.
+    // Similar pages give hashes with a small Hamming distance.
+    quint64 perceptualHash(const QByteArray &data, int width, int height, int bpl, int format);
+
+    // Bounding rectangles (in pixels) of the separate items on the scanner bed, like
+    // photos or cards scanned together. Items are connected areas that differ from
+    // the background, gaps below 2 mm are bridged and areas smaller than 10x10 mm
+    // are ignored as dust. The rectangles are ordered top to bottom, left to right.
+    QList<QRect> detectRegions(const QByteArray &data, int width, int height, int bpl, int format, int dpi);
+
+    // Short name of a KSaneWidget::ImageFormat, like "RGB8" or "Gray16"
+    QString formatName(int format);
+
+    // Bytes per pixel of the format, 0 for the 1-bit black and white format
+    int bytesPerPixel(int format);
+
+    // 8-bit gray value and chroma (max - min of the channels) of one pixel
+    void sample(const uchar *row, int x, int format, int &gray, int &chroma);
+}
+
+#endif
@@ -0,0 +1,185 @@
+/* ============================================================
+ * Description : Index of the perceptual hashes of the recently
+ *               saved pages of a directory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "PageHashIndex.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+
+static const QLatin1String indexFileName(".skanlite-hashes");
+
+// Other Skanlite instances saving to the same directory append to the same
+// index, the lock keeps a compaction from dropping their lines. The lock
+// belongs to the process, a second descriptor of the file must not be closed
+// while it is held.
+static void lockFile(int fd, short type)
+{
+    struct flock lock = {};
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    int result;
+    do {
+        result = fcntl(fd, F_SETLKW, &lock);
+    } while (result < 0 && errno == EINTR);
+}
+
+PageHashIndex::PageHashIndex(int history)
+    : m_history(qMax(1, history))
+{
+}
+
+void PageHashIndex::setHistory(int history)
+{
+    m_history = qMax(1, history);
+    while (m_entries.size() > m_history) {
+        m_entries.removeFirst();
+    }
+}
+
+QString PageHashIndex::hashToString(quint64 hash)
+{
+    return QStringLiteral("%1").arg(hash, 16, 16, QLatin1Char('0'));
+}
+
+quint64 PageHashIndex::hashFromString(const QString &hash, bool *ok)
+{
+    return hash.toULongLong(ok, 16);
+}
+
+QString PageHashIndex::findSimilar(const QString &dir, quint64 hash, int maxDistance)
+{
+    load(dir);
+    QString similar;
+    int best = maxDistance + 1;
+    foreach (const Entry &entry, m_entries) {
+        const int distance = qPopulationCount(entry.hash ^ hash);
+        if (distance < best) {
+            best = distance;
+            similar = entry.fileName;
+        }
+    }
+    return similar;
+}
+
+void PageHashIndex::add(const QString &dir, quint64 hash, const QString &fileName)
+{
+    load(dir);
+    m_entries.append({hash, fileName});
+    while (m_entries.size() > m_history) {
+        m_entries.removeFirst();
+    }
+
+    // appending keeps the index consistent with other Skanlite instances saving to the same directory
+    QFile file(indexFile(dir));
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Could not update" << file.fileName() << file.errorString();
+        return;
+    }
+    lockFile(file.handle(), F_WRLCK);
+    file.seek(file.size());
+    file.write(hashToString(hash).toLatin1() + ' ' + fileName.toUtf8() + '\n');
+    m_lines++;
+
+    // the file only keeps the recent pages
+    if (m_lines > 2 * m_history) {
+        compact(file);
+    }
+    file.close();
+    m_modified = QFileInfo(file.fileName()).lastModified();
+}
+
+QString PageHashIndex::indexFile(const QString &dir) const
+{
+    return QDir(dir).filePath(indexFileName);
+}
+
+void PageHashIndex::load(const QString &dir)
+{
+    const QFileInfo info(indexFile(dir));
+    if (dir == m_dir && info.lastModified() == m_modified) {
+        return;
+    }
+    m_dir = dir;
+    m_modified = info.lastModified();
+    m_entries.clear();
+    m_lines = 0;
+
+    QFile file(info.filePath());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+    // not in the middle of a compaction
+    lockFile(file.handle(), F_RDLCK);
+    QTextStream stream(&file);
+    stream.setCodec("UTF-8");
+    QString line;
+    while (stream.readLineInto(&line)) {
+        m_lines++;
+        const int space = line.indexOf(QLatin1Char(' '));
+        bool ok = false;
+        const quint64 hash = hashFromString(line.left(space), &ok);
+        if (space <= 0 || !ok) {
+            continue;
+        }
+        m_entries.append({hash, line.mid(space + 1)});
+        if (m_entries.size() > m_history) {
+            m_entries.removeFirst();
+        }
+    }
+}
+
+void PageHashIndex::compact(QFile &file)
+{
+    // the file is read again under the lock, it has the lines of the other writers too
+    file.seek(0);
+    QList<Entry> entries;
+    foreach (const QByteArray &line, file.readAll().split('\n')) {
+        const int space = line.indexOf(' ');
+        bool ok = false;
+        const quint64 hash = hashFromString(QString::fromLatin1(line.left(space)), &ok);
+        if (space <= 0 || !ok) {
+            continue;
+        }
+        entries.append({hash, QString::fromUtf8(line.mid(space + 1))});
+        if (entries.size() > m_history) {
+            entries.removeFirst();
+        }
+    }
+
+    QByteArray data;
+    foreach (const Entry &entry, entries) {
+        data += hashToString(entry.hash).toLatin1() + ' ' + entry.fileName.toUtf8() + '\n';
+    }
+    file.seek(0);
+    if (file.write(data) != data.size() || !file.resize(data.size())) {
+        qWarning() << "Could not compact" << file.fileName() << file.errorString();
+        return;
+    }
+    m_entries = entries;
+    m_lines = entries.size();
+}
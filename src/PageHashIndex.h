@@ -0,0 +1,70 @@
+/* ============================================================
+ * Description : Index of the perceptual hashes of the recently
+ *               saved pages of a directory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef PageHashIndex_h
+#define PageHashIndex_h
+
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+// Keeps the hashes of the last pages saved to a directory in a
+// ".skanlite-hashes" file in that directory, one "hash file-name" line per
+// page. Only a bounded number of recent pages is compared, so a lookup costs
+// the same no matter how large the archive grows.
+class PageHashIndex
+{
+public:
+    // history is the number of recent pages a new page is compared with
+    explicit PageHashIndex(int history = 1000);
+
+    void setHistory(int history);
+
+    // File name of the most similar recent page in dir with at most maxDistance
+    // differing bits, or an empty string
+    QString findSimilar(const QString &dir, quint64 hash, int maxDistance);
+
+    void add(const QString &dir, quint64 hash, const QString &fileName);
+
+    static QString hashToString(quint64 hash);
+    static quint64 hashFromString(const QString &hash, bool *ok = nullptr);
+
+private:
+    struct Entry {
+        quint64 hash;
+        QString fileName;
+    };
+
+    QString indexFile(const QString &dir) const;
+    void load(const QString &dir);
+    // rewrites the locked index file with its recent lines
+    void compact(QFile &file);
+
+    int          m_history;
+    QString      m_dir;
+    QDateTime    m_modified; // of the index file when it was read, to notice other writers
+    QList<Entry> m_entries;
+    int          m_lines = 0;
+};
+
+#endif
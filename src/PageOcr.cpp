@@ -0,0 +1,324 @@
+/* ============================================================
+ * Description : Text recognition of the scanned pages on a thread
+ *               pool of its own.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "PageOcr.h"
+#include "Derivatives.h"
+#include "ImagePipeline.h"
+
+#include "config-skanlite.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThreadStorage>
+#include <QtConcurrent>
+#include <QDebug>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+#include <KSaneWidget>
+
+#ifdef HAVE_TESSERACT
+#include <tesseract/baseapi.h>
+#endif
+
+using namespace KSaneIface;
+
+PageOcr::PageOcr(QObject *parent)
+    : QObject(parent)
+{
+    m_settings.dpi = 300;
+    m_settings.language = QStringLiteral("eng");
+    m_settings.sidecars << QStringLiteral("hocr");
+}
+
+PageOcr::~PageOcr()
+{
+    m_pool.waitForDone();
+}
+
+bool PageOcr::isSupported()
+{
+#ifdef HAVE_TESSERACT
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PageOcr::readSettings()
+{
+    KConfigGroup ocr(KSharedConfig::openConfig(), "OCR");
+    m_enabled = ocr.readEntry("Enabled", false);
+    m_settings.language = ocr.readEntry("Language", "eng");
+    m_settings.dataPath = ocr.readEntry("DataPath", QString());
+    m_settings.dpi = qBound(70, ocr.readEntry("Dpi", 300), 600);
+    m_settings.sidecars = ocr.readEntry("Sidecars", QStringList(QStringLiteral("hocr")));
+    m_pool.setMaxThreadCount(qMax(1, ocr.readEntry("Threads", 1)));
+
+    if (m_enabled && !isSupported()) {
+        qWarning() << "OCR is enabled, but Skanlite was built without Tesseract";
+    }
+}
+
+void PageOcr::recognize(const QString &fileName, const QByteArray &data, int width, int height, int bpl,
+                        int format, int dpi, int rotation)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    // the data is shared with the saver, it is not copied
+    const Page page = { fileName, data, width, height, bpl, format, dpi, rotation };
+    const Settings settings = m_settings;
+    m_recognizing.insert(fileName);
+    QtConcurrent::run(&m_pool, [this, page, settings]() { run(page, settings); });
+}
+
+void PageOcr::imageSaved(const QString &fileName, bool success)
+{
+    if (!m_recognizing.contains(fileName)) {
+        return;
+    }
+    bool recognized;
+    {
+        QMutexLocker locker(&m_resultsMutex);
+        recognized = m_results.contains(fileName);
+    }
+    if (recognized) {
+        finish(fileName, success);
+    }
+    else {
+        m_saved[fileName] = success;
+    }
+}
+
+void PageOcr::recognized(const QString &fileName)
+{
+    // imageSaved() may have come first and already finished the page
+    if (m_recognizing.contains(fileName) && m_saved.contains(fileName)) {
+        finish(fileName, m_saved.take(fileName));
+    }
+}
+
+void PageOcr::finish(const QString &fileName, bool saved)
+{
+    m_recognizing.remove(fileName);
+    Result result;
+    {
+        QMutexLocker locker(&m_resultsMutex);
+        result = m_results.take(fileName);
+    }
+    if (!saved) {
+        // no sidecars without their image
+        emit textReady(fileName, result.text, QStringList(), QStringLiteral("The image was not saved"));
+        return;
+    }
+
+    // the sidecars are complete or not there at all, like the images
+    QStringList sidecars;
+    QString error = result.error;
+    for (int i = 0; i < result.sidecars.size(); ++i) {
+        QSaveFile file(result.sidecars[i].first);
+        const QByteArray &content = result.sidecars[i].second;
+        if (file.open(QIODevice::WriteOnly) && file.write(content) == content.size() && file.commit()) {
+            sidecars << file.fileName();
+        }
+        else if (error.isEmpty()) {
+            error = QStringLiteral("Writing %1 failed: %2").arg(file.fileName(), file.errorString());
+        }
+    }
+    emit textReady(fileName, result.text, sidecars, error);
+}
+
+#ifdef HAVE_TESSERACT
+namespace
+{
+// Initializing Tesseract loads the language data, which takes a while. Every
+// thread of the pool keeps its instance until the thread ends.
+struct Engine {
+    tesseract::TessBaseAPI api;
+    QString                language;
+    QString                dataPath;
+    bool                   ready = false;
+};
+QThreadStorage<Engine *> engines;
+
+Engine *engine(const QString &language, const QString &dataPath)
+{
+    if (!engines.hasLocalData()) {
+        engines.setLocalData(new Engine);
+    }
+    Engine *engine = engines.localData();
+    if (!engine->ready || engine->language != language || engine->dataPath != dataPath) {
+        engine->api.End();
+        const QByteArray path = QFile::encodeName(dataPath);
+        engine->ready = (engine->api.Init(dataPath.isEmpty() ? nullptr : path.constData(),
+                                          language.toLatin1().constData()) == 0);
+        engine->language = language;
+        engine->dataPath = dataPath;
+    }
+    return engine->ready ? engine : nullptr;
+}
+}
+
+// Otsu threshold of an 8 bit gray image, the ink becomes 0 and the paper 255
+static void binarize(Derivatives::Image &image)
+{
+    int histogram[256] = {};
+    for (int y = 0; y < image.height; ++y) {
+        const uchar *row = reinterpret_cast<const uchar *>(image.data.constData()) + qint64(y) * image.bpl;
+        for (int x = 0; x < image.width; ++x) {
+            histogram[row[x]]++;
+        }
+    }
+    const qint64 total = qint64(image.width) * image.height;
+    qint64 sum = 0;
+    for (int i = 0; i < 256; ++i) {
+        sum += qint64(i) * histogram[i];
+    }
+    qint64 backgroundSum = 0;
+    qint64 background = 0;
+    double best = -1;
+    int threshold = 127;
+    for (int i = 0; i < 256; ++i) {
+        background += histogram[i];
+        if (background == 0 || background == total) {
+            continue;
+        }
+        backgroundSum += qint64(i) * histogram[i];
+        const double meanLow = double(backgroundSum) / background;
+        const double meanHigh = double(sum - backgroundSum) / (total - background);
+        const double variance = double(background) * (total - background) * (meanLow - meanHigh) * (meanLow - meanHigh);
+        if (variance > best) {
+            best = variance;
+            threshold = i;
+        }
+    }
+
+    uchar *bits = reinterpret_cast<uchar *>(image.data.data());
+    for (int y = 0; y < image.height; ++y) {
+        uchar *row = bits + qint64(y) * image.bpl;
+        for (int x = 0; x < image.width; ++x) {
+            row[x] = (row[x] > threshold) ? 255 : 0;
+        }
+    }
+}
+#endif
+
+void PageOcr::run(const Page &page, const Settings &settings)
+{
+    const QString &fileName = page.fileName;
+    Result result;
+    // handed to the GUI thread, which writes the sidecars once the image is saved
+    auto done = [this, &fileName, &result]() {
+        {
+            QMutexLocker locker(&m_resultsMutex);
+            m_results.insert(fileName, result);
+        }
+        QMetaObject::invokeMethod(this, "recognized", Qt::QueuedConnection, Q_ARG(QString, fileName));
+    };
+#ifdef HAVE_TESSERACT
+    // a gray copy at the OCR resolution, turned like the saved image
+    Derivatives::Spec spec;
+    spec.dpi = settings.dpi;
+    spec.format = QStringLiteral("ocr");
+    const QList<Derivatives::Image> images = Derivatives::downsample(page.data, page.width, page.height, page.bpl, page.format, page.dpi, QList<Derivatives::Spec>() << spec);
+    if (images.isEmpty()) {
+        result.error = QStringLiteral("Unsupported image format");
+        done();
+        return;
+    }
+    Derivatives::Image image = images.first();
+    if (image.format == KSaneWidget::FormatRGB_8_C) {
+        QByteArray gray(qint64(image.width) * image.height, Qt::Uninitialized);
+        for (int y = 0; y < image.height; ++y) {
+            const uchar *src = reinterpret_cast<const uchar *>(image.data.constData()) + qint64(y) * image.bpl;
+            uchar *dst = reinterpret_cast<uchar *>(gray.data()) + qint64(y) * image.width;
+            for (int x = 0; x < image.width; ++x) {
+                dst[x] = (src[x * 3] * 77 + src[x * 3 + 1] * 150 + src[x * 3 + 2] * 29) >> 8;
+            }
+        }
+        image.data = gray;
+        image.bpl = image.width;
+        image.format = KSaneWidget::FormatGrayScale8;
+    }
+    if (page.rotation != 0) {
+        ImagePipeline::Stage stage;
+        stage.op = ImagePipeline::Rotate;
+        stage.args << page.rotation;
+        ImagePipeline::apply(ImagePipeline::Pipeline() << stage, image.data, image.width, image.height, image.bpl, image.format);
+    }
+    binarize(image);
+
+    Engine *ocr = engine(settings.language, settings.dataPath);
+    if (!ocr) {
+        result.error = QStringLiteral("Could not load the Tesseract data for %1").arg(settings.language);
+        done();
+        return;
+    }
+    ocr->api.SetImage(reinterpret_cast<const unsigned char *>(image.data.constData()), image.width, image.height, 1, image.bpl);
+    ocr->api.SetSourceResolution(image.dpi);
+    if (ocr->api.Recognize(nullptr) != 0) {
+        ocr->api.Clear();
+        result.error = QStringLiteral("Text recognition failed");
+        done();
+        return;
+    }
+    char *utf8 = ocr->api.GetUTF8Text();
+    const QString text = QString::fromUtf8(utf8);
+    delete[] utf8;
+    QByteArray hocr;
+    if (settings.sidecars.contains(QStringLiteral("hocr"))) {
+        char *page = ocr->api.GetHOCRText(0);
+        hocr = page;
+        delete[] page;
+    }
+    ocr->api.Clear();
+
+    result.text = text;
+    const QFileInfo info(fileName);
+    foreach (const QString &sidecar, settings.sidecars) {
+        QByteArray content;
+        if (sidecar == QLatin1String("hocr")) {
+            content = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<html xmlns=\"http://www.w3.org/1999/xhtml\">\n<head>\n"
+                      "<meta http-equiv=\"Content-Type\" content=\"text/html;charset=utf-8\"/>\n"
+                      "<meta name=\"ocr-system\" content=\"tesseract\"/>\n"
+                      "<meta name=\"ocr-capabilities\" content=\"ocr_page ocr_carea ocr_par ocr_line ocrx_word\"/>\n"
+                      "</head>\n<body>\n" + hocr + "</body>\n</html>\n";
+        }
+        else if (sidecar == QLatin1String("txt")) {
+            content = text.toUtf8();
+        }
+        else {
+            continue;
+        }
+        result.sidecars.append(qMakePair(info.dir().filePath(info.completeBaseName() + QLatin1Char('.') + sidecar), content));
+    }
+    done();
+#else
+    Q_UNUSED(settings);
+    result.error = QStringLiteral("Built without Tesseract");
+    done();
+#endif
+}
@@ -0,0 +1,117 @@
+/* ============================================================
+ * Description : Text recognition of the scanned pages on a thread
+ *               pool of its own.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#ifndef PageOcr_h
+#define PageOcr_h
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+// Recognizes the text of a page with Tesseract while the page is encoded, on
+// a downsampled and binarized copy of the scanned data, so the saved file is
+// never read back. The text is written to sidecar files next to the saved
+// image, "Image-0001.hocr" (hOCR, which ocrmypdf or hocr2pdf merge with the
+// image into a searchable PDF) and/or "Image-0001.txt". They are only written
+// once the image is saved, see imageSaved().
+//
+// The settings are read from the "OCR" config group:
+//   Enabled    false
+//   Language   Tesseract languages, "eng" or "deu+eng"
+//   DataPath   tessdata directory, empty for the default
+//   Dpi        resolution the page is reduced to, 300
+//   Threads    pages recognized at the same time, 1
+//   Sidecars   "hocr", "txt" or "hocr,txt"
+class PageOcr : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PageOcr(QObject *parent = nullptr);
+    // waits for the pages being recognized
+    ~PageOcr();
+
+    // false if Skanlite was built without Tesseract
+    static bool isSupported();
+
+    void readSettings();
+    bool isEnabled() const { return m_enabled && isSupported(); }
+
+    // Starts recognizing the page that is saved as fileName. rotation is the
+    // clockwise rotation (0, 90, 180 or 270) applied to the saved image.
+    void recognize(const QString &fileName, const QByteArray &data, int width, int height, int bpl,
+                   int format, int dpi, int rotation);
+
+    // The saving of fileName is done, the sidecars of a failed image are not written
+    void imageSaved(const QString &fileName, bool success);
+
+Q_SIGNALS:
+    // sidecars are the written files, error is empty on success
+    void textReady(const QString &fileName, const QString &text, const QStringList &sidecars, const QString &error);
+
+private:
+    struct Settings {
+        QString     language;
+        QString     dataPath;
+        int         dpi;
+        QStringList sidecars;
+    };
+
+    struct Page {
+        QString    fileName;
+        QByteArray data;
+        int        width;
+        int        height;
+        int        bpl;
+        int        format;
+        int        dpi;
+        int        rotation;
+    };
+
+    // the recognized text waiting for the image to be saved
+    struct Result {
+        QString                           text;
+        QList<QPair<QString, QByteArray>> sidecars; // file name, content
+        QString                           error;
+    };
+
+    void run(const Page &page, const Settings &settings);
+    Q_INVOKABLE void recognized(const QString &fileName);
+    void finish(const QString &fileName, bool saved);
+
+    QThreadPool             m_pool;
+    bool                    m_enabled = false;
+    Settings                m_settings;
+    QMutex                  m_resultsMutex;
+    QHash<QString, Result>  m_results;     // filled by the pool
+    QSet<QString>           m_recognizing; // pages without sidecars yet
+    QHash<QString, bool>    m_saved;       // pages saved before their text was recognized
+};
+
+#endif
@@ -0,0 +1,94 @@
+/* ============================================================
+ * Description : Last preview of the scanner bed, reused while the
+ *               options it depends on do not change.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "PreviewCache.h"
+#include "PageAnalysis.h"
+
+#include <QCryptographicHash>
+
+// the selection and the resolution do not change what is on the bed
+static const QStringList ignoredOptions = { QLatin1String("tl-x"), QLatin1String("tl-y"),
+                                            QLatin1String("br-x"), QLatin1String("br-y"),
+                                            QLatin1String("resolution"), QLatin1String("x-resolution"),
+                                            QLatin1String("y-resolution"), QLatin1String("preview") };
+
+PreviewCache::PreviewCache(int maxAge)
+    : m_maxAge(maxAge)
+{
+}
+
+QByteArray PreviewCache::optionHash(const QMap<QString, QString> &options)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QMap<QString, QString>::const_iterator it;
+    for (it = options.constBegin(); it != options.constEnd(); ++it) {
+        if (!ignoredOptions.contains(it.key())) {
+            hash.addData(it.key().toUtf8() + '=' + it.value().toUtf8() + '\n');
+        }
+    }
+    return hash.result();
+}
+
+void PreviewCache::store(const QMap<QString, QString> &options)
+{
+    m_optionHash = optionHash(options);
+    m_timestamp = QDateTime::currentDateTimeUtc();
+    m_data.clear();
+    m_regions.clear();
+}
+
+void PreviewCache::store(const QMap<QString, QString> &options, const QByteArray &data, int width, int height,
+                         int bpl, int format, int dpi, const QPointF &originMm)
+{
+    store(options);
+    m_data = data;
+
+    // a low resolution preview is small, the items are found right away
+    const qreal mmPerPixel = 25.4 / qMax(1, dpi);
+    foreach (const QRect &rect, PageAnalysis::detectRegions(data, width, height, bpl, format, dpi)) {
+        m_regions << QStringLiteral("%1,%2,%3,%4")
+                         .arg(originMm.x() + rect.left() * mmPerPixel, 0, 'f', 1)
+                         .arg(originMm.y() + rect.top() * mmPerPixel, 0, 'f', 1)
+                         .arg(originMm.x() + (rect.right() + 1) * mmPerPixel, 0, 'f', 1)
+                         .arg(originMm.y() + (rect.bottom() + 1) * mmPerPixel, 0, 'f', 1);
+    }
+}
+
+void PreviewCache::clear()
+{
+    m_optionHash.clear();
+    m_timestamp = QDateTime();
+    m_data.clear();
+    m_regions.clear();
+}
+
+bool PreviewCache::isValid(const QMap<QString, QString> &options) const
+{
+    if (m_optionHash.isEmpty()) {
+        return false;
+    }
+    if (m_maxAge > 0 && m_timestamp.secsTo(QDateTime::currentDateTimeUtc()) > m_maxAge) {
+        return false;
+    }
+    return m_optionHash == optionHash(options);
+}
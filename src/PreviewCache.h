@@ -0,0 +1,72 @@
+/* ============================================================
+ * Description : Last preview of the scanner bed, reused while the
+ *               options it depends on do not change.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#ifndef PreviewCache_h
+#define PreviewCache_h
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QMap>
+#include <QPointF>
+#include <QString>
+#include <QStringList>
+
+// A preview stays valid until it is invalidated, it is older than the maximum
+// age or an option other than the selection and the resolution changes, like
+// the scan source or the mode. Several final scans of different regions of the
+// bed can then be made from one preview.
+class PreviewCache
+{
+public:
+    // maxAge in seconds, 0 keeps the preview until the options change
+    explicit PreviewCache(int maxAge = 600);
+
+    void setMaxAge(int maxAge) { m_maxAge = maxAge; }
+
+    // Remembers a preview taken with options. The image data is optional (the
+    // preview of KSaneWidget is not accessible), originMm is the top left
+    // corner of the scanned area on the bed.
+    void store(const QMap<QString, QString> &options);
+    void store(const QMap<QString, QString> &options, const QByteArray &data, int width, int height,
+               int bpl, int format, int dpi, const QPointF &originMm);
+    void clear();
+
+    bool isValid(const QMap<QString, QString> &options) const;
+    bool hasImage() const { return !m_data.isEmpty(); }
+    const QDateTime &timestamp() const { return m_timestamp; }
+
+    // The items found on the bed in the preview image, "tl-x,tl-y,br-x,br-y" in mm
+    const QStringList &regions() const { return m_regions; }
+
+    // Hash of the options a preview depends on
+    static QByteArray optionHash(const QMap<QString, QString> &options);
+
+private:
+    int         m_maxAge;
+    QByteArray  m_optionHash;
+    QDateTime   m_timestamp;
+    QByteArray  m_data;
+    QStringList m_regions;
+};
+
+#endif
@@ -0,0 +1,265 @@
+/* ============================================================
+ * Description : Raw scan data with the scan settings, kept to
+ *               save the page again without the scanner.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "RawCapture.h"
+#include "PageAnalysis.h"
+
+#include "config-skanlite.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+
+#include <KSaneWidget>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <limits.h>
+#include <string.h>
+
+using namespace KSaneIface;
+
+static const char magic[8] = {'S', 'K', 'A', 'N', 'R', 'A', 'W', 1};
+
+QString RawCapture::fileName(const QString &imageName)
+{
+    const QFileInfo info(imageName);
+    return QStringLiteral("%1/%2.skraw").arg(info.path(), info.completeBaseName());
+}
+
+static bool fail(QString *error, const QString &message)
+{
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+static bool writeAll(QIODevice *device, const char *data, qint64 size, QString *error)
+{
+    if (device->write(data, size) != size) {
+        return fail(error, QStringLiteral("Writing the capture failed: %1").arg(device->errorString()));
+    }
+    return true;
+}
+
+static bool readAll(QIODevice *device, char *data, qint64 size, QString *error)
+{
+    if (device->read(data, size) != size) {
+        return fail(error, QStringLiteral("The capture is truncated"));
+    }
+    return true;
+}
+
+bool RawCapture::write(QIODevice *device, const Capture &capture, int level, int threads, QString *error)
+{
+    const qint64 size = qint64(capture.bpl) * capture.height;
+    if (capture.data.size() < size) {
+        return fail(error, QStringLiteral("The capture has less data than its size"));
+    }
+
+    QJsonObject options;
+    for (QMap<QString, QString>::const_iterator it = capture.options.constBegin(); it != capture.options.constEnd(); ++it) {
+        options.insert(it.key(), it.value());
+    }
+    QJsonObject header;
+    header[QStringLiteral("width")] = capture.width;
+    header[QStringLiteral("height")] = capture.height;
+    header[QStringLiteral("bytesPerLine")] = capture.bpl;
+    header[QStringLiteral("format")] = PageAnalysis::formatName(capture.format);
+    header[QStringLiteral("dpi")] = capture.dpi;
+    header[QStringLiteral("byteOrder")] = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? QStringLiteral("little") : QStringLiteral("big");
+    header[QStringLiteral("device")] = capture.deviceName;
+    header[QStringLiteral("options")] = options;
+    header[QStringLiteral("iccProfile")] = QString::fromLatin1(capture.iccProfile.toBase64());
+    header[QStringLiteral("timestamp")] = capture.timestamp.toString(Qt::ISODate);
+#ifdef HAVE_ZSTD
+    header[QStringLiteral("compression")] = QStringLiteral("zstd");
+#else
+    header[QStringLiteral("compression")] = QStringLiteral("none");
+#endif
+    header[QStringLiteral("dataSize")] = double(size);
+
+    const QByteArray json = QJsonDocument(header).toJson(QJsonDocument::Compact);
+    uchar headerSize[4];
+    qToLittleEndian<quint32>(json.size(), headerSize);
+    if (!writeAll(device, magic, sizeof(magic), error) ||
+        !writeAll(device, reinterpret_cast<const char *>(headerSize), 4, error) ||
+        !writeAll(device, json.constData(), json.size(), error)) {
+        return false;
+    }
+
+#ifdef HAVE_ZSTD
+    // streamed in chunks, the compressed page is never held in memory
+    ZSTD_CCtx *context = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+    if (threads > 0) {
+        // fails without multithreading support in libzstd, which is fine
+        ZSTD_CCtx_setParameter(context, ZSTD_c_nbWorkers, threads);
+    }
+    ZSTD_CCtx_setPledgedSrcSize(context, size);
+    QByteArray out(int(ZSTD_CStreamOutSize()), Qt::Uninitialized);
+    ZSTD_inBuffer input = {capture.data.constData(), size_t(size), 0};
+    bool ok = true;
+    size_t remaining;
+    do {
+        ZSTD_outBuffer output = {out.data(), size_t(out.size()), 0};
+        remaining = ZSTD_compressStream2(context, &output, &input, ZSTD_e_end);
+        if (ZSTD_isError(remaining)) {
+            ok = fail(error, QStringLiteral("Compressing the capture failed: %1").arg(QString::fromLatin1(ZSTD_getErrorName(remaining))));
+            break;
+        }
+        if (!writeAll(device, out.constData(), output.pos, error)) {
+            ok = false;
+            break;
+        }
+    } while (remaining != 0);
+    ZSTD_freeCCtx(context);
+    return ok;
+#else
+    Q_UNUSED(level);
+    Q_UNUSED(threads);
+    return writeAll(device, capture.data.constData(), size, error);
+#endif
+}
+
+bool RawCapture::read(QIODevice *device, Capture &capture, QString *error)
+{
+    char fileMagic[sizeof(magic)];
+    uchar headerSize[4];
+    if (!readAll(device, fileMagic, sizeof(fileMagic), error) || memcmp(fileMagic, magic, sizeof(magic)) != 0) {
+        return fail(error, QStringLiteral("Not a Skanlite raw capture"));
+    }
+    if (!readAll(device, reinterpret_cast<char *>(headerSize), 4, error)) {
+        return false;
+    }
+    const quint32 jsonSize = qFromLittleEndian<quint32>(headerSize);
+    if (jsonSize > 16 * 1024 * 1024) {
+        return fail(error, QStringLiteral("The capture header is damaged"));
+    }
+    QByteArray json(int(jsonSize), Qt::Uninitialized);
+    if (!readAll(device, json.data(), json.size(), error)) {
+        return false;
+    }
+    QJsonParseError parseError;
+    const QJsonObject header = QJsonDocument::fromJson(json, &parseError).object();
+    if (parseError.error != QJsonParseError::NoError) {
+        return fail(error, QStringLiteral("The capture header is damaged: %1").arg(parseError.errorString()));
+    }
+
+    capture.width = header.value(QStringLiteral("width")).toInt();
+    capture.height = header.value(QStringLiteral("height")).toInt();
+    capture.bpl = header.value(QStringLiteral("bytesPerLine")).toInt();
+    capture.dpi = header.value(QStringLiteral("dpi")).toInt();
+    capture.deviceName = header.value(QStringLiteral("device")).toString();
+    capture.iccProfile = QByteArray::fromBase64(header.value(QStringLiteral("iccProfile")).toString().toLatin1());
+    capture.timestamp = QDateTime::fromString(header.value(QStringLiteral("timestamp")).toString(), Qt::ISODate);
+    capture.options.clear();
+    const QJsonObject options = header.value(QStringLiteral("options")).toObject();
+    for (QJsonObject::const_iterator it = options.constBegin(); it != options.constEnd(); ++it) {
+        capture.options[it.key()] = it.value().toString();
+    }
+
+    // the format is stored by name, the numbers of KSaneWidget::ImageFormat are not fixed
+    const QString formatName = header.value(QStringLiteral("format")).toString();
+    const int formats[] = {KSaneWidget::FormatBlackWhite, KSaneWidget::FormatGrayScale8, KSaneWidget::FormatGrayScale16,
+                           KSaneWidget::FormatRGB_8_C, KSaneWidget::FormatRGB_16_C};
+    capture.format = -1;
+    for (int format : formats) {
+        if (PageAnalysis::formatName(format) == formatName) {
+            capture.format = format;
+        }
+    }
+    const qint64 size = qint64(capture.bpl) * capture.height;
+    if (capture.format < 0 || capture.width <= 0 || capture.height <= 0 || capture.bpl <= 0 ||
+        size != qint64(header.value(QStringLiteral("dataSize")).toDouble()) || size > INT_MAX) {
+        return fail(error, QStringLiteral("The capture header is damaged"));
+    }
+
+    capture.data.resize(int(size));
+    const QString compression = header.value(QStringLiteral("compression")).toString();
+    if (compression == QLatin1String("none")) {
+        if (!readAll(device, capture.data.data(), size, error)) {
+            return false;
+        }
+    }
+#ifdef HAVE_ZSTD
+    else if (compression == QLatin1String("zstd")) {
+        ZSTD_DCtx *context = ZSTD_createDCtx();
+        QByteArray in(int(ZSTD_DStreamInSize()), Qt::Uninitialized);
+        ZSTD_outBuffer output = {capture.data.data(), size_t(size), 0};
+        size_t status = 1;
+        bool ok = true;
+        while (status != 0 && ok) {
+            const qint64 read = device->read(in.data(), in.size());
+            if (read <= 0) {
+                ok = fail(error, QStringLiteral("The capture is truncated"));
+                break;
+            }
+            ZSTD_inBuffer input = {in.constData(), size_t(read), 0};
+            while (input.pos < input.size && status != 0) {
+                status = ZSTD_decompressStream(context, &output, &input);
+                if (ZSTD_isError(status)) {
+                    ok = fail(error, QStringLiteral("The capture data is damaged: %1").arg(QString::fromLatin1(ZSTD_getErrorName(status))));
+                    break;
+                }
+            }
+        }
+        ZSTD_freeDCtx(context);
+        if (!ok) {
+            return false;
+        }
+        if (output.pos != output.size) {
+            return fail(error, QStringLiteral("The capture is truncated"));
+        }
+    }
+#endif
+    else {
+        return fail(error, QStringLiteral("Unsupported capture compression \"%1\"").arg(compression));
+    }
+
+    // the 16 bit samples are in the byte order of the scanning host
+    const QString byteOrder = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? QStringLiteral("little") : QStringLiteral("big");
+    if ((capture.format == KSaneWidget::FormatGrayScale16 || capture.format == KSaneWidget::FormatRGB_16_C) &&
+        header.value(QStringLiteral("byteOrder")).toString() != byteOrder) {
+        uchar *bytes = reinterpret_cast<uchar *>(capture.data.data());
+        for (qint64 i = 0; i + 1 < size; i += 2) {
+            qSwap(bytes[i], bytes[i + 1]);
+        }
+    }
+    return true;
+}
+
+bool RawCapture::read(const QString &fileName, Capture &capture, QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(error, QStringLiteral("Could not open %1: %2").arg(fileName, file.errorString()));
+    }
+    return read(&file, capture, error);
+}
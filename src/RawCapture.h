@@ -0,0 +1,72 @@
+/* ============================================================
+ * Description : Raw scan data with the scan settings, kept to
+ *               save the page again without the scanner.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef RawCapture_h
+#define RawCapture_h
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QMap>
+#include <QString>
+
+class QIODevice;
+
+// The data delivered by KSaneWidget::imageReady, before any post-processing,
+// with everything needed to save the page again: ".skraw" files that
+// skanlite-replay runs through KSaneImageSaver, e.g. after the encoder or
+// pipeline settings changed, or as a benchmark of the saving without a scanner.
+//
+// The file is the magic "SKANRAW" and a version byte, the size of the header
+// as a 32 bit little endian number, the header as UTF-8 JSON and the data,
+// Zstandard compressed if Skanlite was built with libzstd. The header has
+// "width", "height", "bytesPerLine", "format" (see PageAnalysis::formatName),
+// "dpi", "byteOrder" of the 16 bit samples, "device", "options" (the values
+// from KSaneWidget::getOptVals), "iccProfile" (base64), "timestamp",
+// "compression" ("zstd" or "none") and "dataSize".
+namespace RawCapture
+{
+    struct Capture {
+        QByteArray data;
+        int        width = 0;
+        int        height = 0;
+        int        bpl = 0;
+        int        format = 0; // KSaneWidget::ImageFormat
+        int        dpi = 0;
+        QString    deviceName;
+        QMap<QString, QString> options;
+        QByteArray iccProfile;
+        QDateTime  timestamp;
+    };
+
+    // "Image-0001.skraw" next to "Image-0001.png"
+    QString fileName(const QString &imageName);
+
+    // level is the zstd compression level, threads the number of compression
+    // threads if libzstd supports them, 0 for none
+    bool write(QIODevice *device, const Capture &capture, int level, int threads, QString *error);
+
+    // The 16 bit samples are converted to the byte order of the host
+    bool read(QIODevice *device, Capture &capture, QString *error);
+    bool read(const QString &fileName, Capture &capture, QString *error);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/* ============================================================
+ * Description : Lookup table mapping and byte swapping of 16 bit
+ *               samples, with an AVX2 version chosen at run time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#include "SampleLut.h"
+
+#include "config-skanlite.h"
+
+#ifdef HAVE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+static inline quint16 swapped(quint16 value)
+{
+    return quint16((value << 8) | (value >> 8));
+}
+
+void SampleLut::map16Generic(const quint16 *table, int channels, const quint16 *src, quint16 *dst, qint64 count, bool swapBytes)
+{
+    if (channels == 1) {
+        for (qint64 i = 0; i < count; ++i) {
+            const quint16 value = table[src[i]];
+            dst[i] = swapBytes ? swapped(value) : value;
+        }
+        return;
+    }
+    int channel = 0;
+    for (qint64 i = 0; i < count; ++i) {
+        const quint16 value = table[channel * SampleLut::tableSize + src[i]];
+        dst[i] = swapBytes ? swapped(value) : value;
+        channel = (channel + 1 == channels) ? 0 : channel + 1;
+    }
+}
+
+static void swapBytes16Generic(const quint16 *src, quint16 *dst, qint64 count)
+{
+    for (qint64 i = 0; i < count; ++i) {
+        dst[i] = swapped(src[i]);
+    }
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+
+// The gathers read 32 bits at table + 2 * index, the low half is the entry on
+// x86 and the high half is the next entry, or the padding entry at the end.
+__attribute__((target("avx2")))
+static inline __m256i gather8(const quint16 *table, __m128i samples, __m256i offsets)
+{
+    const __m256i indexes = _mm256_add_epi32(_mm256_cvtepu16_epi32(samples), offsets);
+    const __m256i values = _mm256_i32gather_epi32(reinterpret_cast<const int *>(table), indexes, 2);
+    return _mm256_and_si256(values, _mm256_set1_epi32(0xffff));
+}
+
+__attribute__((target("avx2")))
+static void map16Avx2(const quint16 *table, int channels, const quint16 *src, quint16 *dst, qint64 count, bool swapBytes)
+{
+    // table offsets of 8 interleaved samples, for the 3 channels the pattern
+    // repeats every 3 blocks: the block starting at channel p uses offsets[p]
+    __m256i offsets[3];
+    for (int p = 0; p < 3; ++p) {
+        alignas(32) int lanes[8];
+        for (int lane = 0; lane < 8; ++lane) {
+            lanes[lane] = (channels == 1) ? 0 : ((p + lane) % channels) * SampleLut::tableSize;
+        }
+        offsets[p] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes));
+    }
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+    qint64 i = 0;
+    int phase = 0; // channel of src[i]
+    for (; i + 16 <= count; i += 16) {
+        const __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const __m256i low = gather8(table, _mm256_castsi256_si128(samples), offsets[phase]);
+        const __m256i high = gather8(table, _mm256_extracti128_si256(samples, 1), offsets[(phase + 8) % 3]);
+        // packus works within the 128 bit lanes, the permute restores the order
+        __m256i values = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xd8);
+        if (swapBytes) {
+            values = _mm256_shuffle_epi8(values, swap);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), values);
+        phase = (phase + 16) % 3;
+    }
+    if (channels == 1) {
+        SampleLut::map16Generic(table, 1, src + i, dst + i, count - i, swapBytes);
+    }
+    else {
+        // the tail starts at channel phase
+        for (; i < count; ++i) {
+            const quint16 value = table[phase * SampleLut::tableSize + src[i]];
+            dst[i] = swapBytes ? swapped(value) : value;
+            phase = (phase + 1) % 3;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void swapBytes16Avx2(const quint16 *src, quint16 *dst, qint64 count)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    qint64 i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_shuffle_epi8(values, swap));
+    }
+    swapBytes16Generic(src + i, dst + i, count - i);
+}
+
+static bool hasAvx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#endif
+
+void SampleLut::map16(const quint16 *table, int channels, const quint16 *src, quint16 *dst, qint64 count, bool swapBytes)
+{
+#ifdef HAVE_AVX2_DISPATCH
+    // the vector version handles gray and RGB
+    if ((channels == 1 || channels == 3) && hasAvx2()) {
+        map16Avx2(table, channels, src, dst, count, swapBytes);
+        return;
+    }
+#endif
+    map16Generic(table, channels, src, dst, count, swapBytes);
+}
+
+void SampleLut::swapBytes16(const quint16 *src, quint16 *dst, qint64 count)
+{
+#ifdef HAVE_AVX2_DISPATCH
+    if (hasAvx2()) {
+        swapBytes16Avx2(src, dst, count);
+        return;
+    }
+#endif
+    swapBytes16Generic(src, dst, count);
+}
+
+const char *SampleLut::implementation()
+{
+#ifdef HAVE_AVX2_DISPATCH
+    if (hasAvx2()) {
+        return "avx2";
+    }
+#endif
+    return "generic";
+}
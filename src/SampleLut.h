@@ -0,0 +1,52 @@
+/* ============================================================
+ * Description : Lookup table mapping and byte swapping of 16 bit
+ *               samples, with an AVX2 version chosen at run time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+
+#ifndef SampleLut_h
+#define SampleLut_h
+
+#include <QtGlobal>
+
+// The 16 bit scan data is in host byte order. These functions convert it
+// through per channel lookup tables and/or to the big endian order of PNG in
+// one pass, src and dst may be the same buffer. On x86-64 CPUs with AVX2 the
+// tables are read with vector gathers, 16 samples per step.
+namespace SampleLut
+{
+    // Entries of one channel table, a table for channels interleaved channels has
+    // channels * tableSize entries followed by one padding entry
+    static const int tableSize = 65536;
+
+    // dst[i] = table[channel(i) * tableSize + src[i]], byte swapped if swapBytes
+    void map16(const quint16 *table, int channels, const quint16 *src, quint16 *dst, qint64 count, bool swapBytes);
+
+    // map16() without the vector code, the results of both must be the same
+    void map16Generic(const quint16 *table, int channels, const quint16 *src, quint16 *dst, qint64 count, bool swapBytes);
+
+    // dst[i] = src[i] byte swapped
+    void swapBytes16(const quint16 *src, quint16 *dst, qint64 count);
+
+    // "avx2" or "generic"
+    const char *implementation();
+}
+
+#endif
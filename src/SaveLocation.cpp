@@ -51,7 +51,24 @@ void SaveLocation::updateGui()
     if (sender() != u_numStartFrom) {
         u_numStartFrom->setValue(1); // Reset the counter whenever the directory or the prefix is changed
     }
-    const QString name = QString::fromLatin1("%1%2.%3").arg(u_imgPrefix->text()).arg(u_numStartFrom->value(), 4, 10, QLatin1Char('0')).arg(u_imgFormat->currentText());
+    updatePreview();
+}
+
+void SaveLocation::setNaming(const FileNamer &fileNamer, const FileNamer::Fields &fields)
+{
+    m_fileNamer = fileNamer;
+    m_nameFields = fields;
+    updatePreview();
+}
+
+void SaveLocation::updatePreview()
+{
+    FileNamer::Fields fields = m_nameFields;
+    fields.prefix = u_imgPrefix->text();
+    if (!fields.time.isValid()) {
+        fields.time = QDateTime::currentDateTime();
+    }
+    const QString name = m_fileNamer.expand(fields, u_imgFormat->currentText(), u_numStartFrom->value());
     QString dir = QDir::cleanPath(u_urlRequester->url().toString()).append(QLatin1Char('/')); //make sure whole value is processed as path to directory
     u_resultValue->setText(QUrl(dir).resolved(QUrl(name)).toString(QUrl::PreferLocalFile | QUrl::NormalizePathSegments));
 }
@@ -27,6 +27,7 @@
 #define SAVE_LOCATION_H
 
 #include "ui_SaveLocation.h"
+#include "FileNamer.h"
 
 #include <QDialog>
 
@@ -37,9 +38,18 @@ public:
     explicit SaveLocation(QWidget *parent = nullptr);
     ~SaveLocation();
 
+    // The names the preview is made with, the prefix comes from the dialog
+    void setNaming(const FileNamer &fileNamer, const FileNamer::Fields &fields);
+
 private Q_SLOTS:
     void updateGui();
     void getDir();
+
+private:
+    void updatePreview();
+
+    FileNamer         m_fileNamer;
+    FileNamer::Fields m_nameFields;
 };
 
 #endif
@@ -0,0 +1,83 @@
+/* ============================================================
+ * Description : Export of the raw scan data through shared memory.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "SharedPageExport.h"
+
+#include "config-skanlite.h"
+
+#include <QDBusConnection>
+#include <QDebug>
+
+#ifdef HAVE_MEMFD_CREATE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool SharedPageExport::isSupported()
+{
+#ifdef HAVE_MEMFD_CREATE
+    return QDBusConnection::sessionBus().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing;
+#else
+    return false;
+#endif
+}
+
+int SharedPageExport::createPageFd(const QByteArray &data)
+{
+#ifdef HAVE_MEMFD_CREATE
+    int fd = memfd_create("skanlite-page", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        qDebug() << "memfd_create failed:" << strerror(errno);
+        return -1;
+    }
+
+    const char *ptr = data.constData();
+    qint64 left = data.size();
+    while (left > 0) {
+        ssize_t written = write(fd, ptr, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qDebug() << "Writing the page to shared memory failed:" << strerror(errno);
+            close(fd);
+            return -1;
+        }
+        ptr += written;
+        left -= written;
+    }
+
+    // the consumers can rely on the content not changing under them
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        qDebug() << "Sealing the page failed:" << strerror(errno);
+    }
+    return fd;
+#else
+    Q_UNUSED(data);
+    return -1;
+#endif
+}
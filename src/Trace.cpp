@@ -0,0 +1,196 @@
+/* ============================================================
+ * Description : Spans of the page processing stages, written as
+ *               a Chrome trace / Perfetto JSON file.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "Trace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <QVector>
+#include <QDebug>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> Trace::enabled(false);
+
+namespace
+{
+struct Event {
+    const char *name;
+    const char *category;
+    qint64      start;
+    qint64      duration;
+    qint64      thread;
+    QString     detail;
+};
+
+struct Session {
+    QMutex                 mutex;
+    QString                fileName;
+    qint64                 started = 0; // on the trace clock
+    QVector<Event>         events;
+    QHash<qint64, QString> threadNames;
+    qint64                 dropped = 0;
+};
+
+// a long session is cut off instead of filling the memory
+const int maxEvents = 2 * 1024 * 1024;
+
+Session &session()
+{
+    static Session session;
+    return session;
+}
+
+// Started once and never restarted, so that now() needs no lock
+QElapsedTimer &clock()
+{
+    static QElapsedTimer timer = [] {
+        QElapsedTimer t;
+        t.start();
+        return t;
+    }();
+    return timer;
+}
+
+qint64 threadId()
+{
+#ifdef SYS_gettid
+    static thread_local const qint64 id = syscall(SYS_gettid);
+#else
+    static thread_local const qint64 id = quintptr(QThread::currentThreadId());
+#endif
+    return id;
+}
+
+QString threadName()
+{
+    QThread *thread = QThread::currentThread();
+    if (!thread->objectName().isEmpty()) {
+        return thread->objectName();
+    }
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        return QStringLiteral("GUI");
+    }
+    return QString::fromLatin1(thread->metaObject()->className());
+}
+}
+
+void Trace::start(const QString &fileName)
+{
+    Session &s = session();
+    QMutexLocker locker(&s.mutex);
+    s.fileName = fileName;
+    s.events.clear();
+    s.threadNames.clear();
+    s.dropped = 0;
+    s.started = now();
+    enabled.store(true);
+}
+
+qint64 Trace::now()
+{
+    return clock().nsecsElapsed() / 1000;
+}
+
+void Trace::complete(const char *name, const char *category, qint64 start, const QString &detail)
+{
+    const qint64 end = now();
+    const qint64 thread = threadId();
+    Session &s = session();
+    QMutexLocker locker(&s.mutex);
+    if (!isEnabled() || start < s.started) {
+        return;
+    }
+    if (s.events.size() >= maxEvents) {
+        s.dropped++;
+        return;
+    }
+    if (!s.threadNames.contains(thread)) {
+        s.threadNames[thread] = threadName();
+    }
+    s.events.append({name, category, start - s.started, end - start, thread, detail});
+}
+
+bool Trace::stop(QString *error)
+{
+    Session &s = session();
+    QMutexLocker locker(&s.mutex);
+    if (!isEnabled()) {
+        return true;
+    }
+    enabled.store(false);
+
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    for (QHash<qint64, QString>::const_iterator it = s.threadNames.constBegin(); it != s.threadNames.constEnd(); ++it) {
+        QJsonObject event;
+        event[QStringLiteral("ph")] = QStringLiteral("M");
+        event[QStringLiteral("name")] = QStringLiteral("thread_name");
+        event[QStringLiteral("pid")] = pid;
+        event[QStringLiteral("tid")] = it.key();
+        event[QStringLiteral("args")] = QJsonObject{{QStringLiteral("name"), it.value()}};
+        events.append(event);
+    }
+    foreach (const Event &e, s.events) {
+        QJsonObject event;
+        event[QStringLiteral("ph")] = QStringLiteral("X");
+        event[QStringLiteral("name")] = QLatin1String(e.name);
+        event[QStringLiteral("cat")] = QLatin1String(e.category);
+        event[QStringLiteral("ts")] = e.start;
+        event[QStringLiteral("dur")] = e.duration;
+        event[QStringLiteral("pid")] = pid;
+        event[QStringLiteral("tid")] = e.thread;
+        if (!e.detail.isEmpty()) {
+            event[QStringLiteral("args")] = QJsonObject{{QStringLiteral("detail"), e.detail}};
+        }
+        events.append(event);
+    }
+    QJsonObject trace;
+    trace[QStringLiteral("traceEvents")] = events;
+    trace[QStringLiteral("displayTimeUnit")] = QStringLiteral("ms");
+    if (s.dropped > 0) {
+        trace[QStringLiteral("otherData")] = QJsonObject{{QStringLiteral("droppedEvents"), s.dropped}};
+    }
+    s.events.clear();
+    s.threadNames.clear();
+
+    QSaveFile file(s.fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) < 0 ||
+        !file.commit()) {
+        qWarning() << "Could not write the trace" << s.fileName << file.errorString();
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    qDebug() << "Trace written to" << s.fileName;
+    return true;
+}
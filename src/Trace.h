@@ -0,0 +1,83 @@
+/* ============================================================
+ * Description : Spans of the page processing stages, written as
+ *               a Chrome trace / Perfetto JSON file.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#ifndef Trace_h
+#define Trace_h
+
+#include <QString>
+
+#include <atomic>
+
+// Records how long every stage of a page takes (acquire, convert, swap,
+// deflate, write, upload, D-Bus emit, ...) on which thread, and writes the
+// spans as Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+// Enabled with --trace <file> or the startTrace D-Bus call; when it is off a
+// span costs one relaxed atomic load.
+//
+// The names and categories must be string literals, only the pointers are kept.
+namespace Trace
+{
+    // Starts a new session that is written to fileName by stop()
+    void start(const QString &fileName);
+    // Writes the recorded spans, returns false if the file could not be written
+    bool stop(QString *error = nullptr);
+
+    extern std::atomic<bool> enabled;
+    inline bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Microseconds on the trace clock, which is never restarted
+    qint64 now();
+
+    // A span from start to now(), detail is shown with it, e.g. the file name.
+    // A span that started before the current session is dropped.
+    void complete(const char *name, const char *category, qint64 start, const QString &detail = QString());
+}
+
+// Records the time from its construction to its destruction
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name, const char *category = "page", const QString &detail = QString())
+        : m_name(name), m_category(category), m_start(Trace::isEnabled() ? Trace::now() : -1)
+    {
+        if (m_start >= 0) {
+            m_detail = detail;
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_start >= 0) {
+            Trace::complete(m_name, m_category, m_start, m_detail);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char *m_name;
+    const char *m_category;
+    qint64      m_start;
+    QString     m_detail;
+};
+
+#endif
@@ -0,0 +1,48 @@
+/* ============================================================
+ *
+ * This file is a part of the Skanlite project
+ *
+ * Optional features found by CMake.
+ *
+ * ============================================================ */
+
+#ifndef SKANLITE_CONFIG_H
+#define SKANLITE_CONFIG_H
+
+/* Define to 1 if the system has memfd_create() */
+#cmakedefine HAVE_MEMFD_CREATE 1
+
+/* Define to 1 if the system has syncfs() */
+#cmakedefine HAVE_SYNCFS 1
+
+/* Define to 1 if the system has fopencookie() */
+#cmakedefine HAVE_FOPENCOOKIE 1
+
+/* Define to 1 if the system has funopen(), used where fopencookie() is missing */
+#cmakedefine HAVE_FUNOPEN 1
+
+/* Define to 1 if the compiler can build AVX2 functions chosen at run time */
+#cmakedefine HAVE_AVX2_DISPATCH 1
+
+/* Define to 1 if libjpeg (preferably libjpeg-turbo) is available */
+#cmakedefine HAVE_JPEG 1
+
+/* Define to 1 if libtiff and zlib are available */
+#cmakedefine HAVE_TIFF 1
+
+/* Define to 1 if libzstd is available */
+#cmakedefine HAVE_ZSTD 1
+
+/* Define to 1 if libjxl and libjxl_threads are available */
+#cmakedefine HAVE_JXL 1
+
+/* Define to 1 if libwebp is available */
+#cmakedefine HAVE_WEBP 1
+
+/* Define to 1 if Tesseract is available */
+#cmakedefine HAVE_TESSERACT 1
+
+/* Define to 1 if liburing is available */
+#cmakedefine HAVE_LIBURING 1
+
+#endif
@@ -30,6 +30,7 @@
 #include <Kdelibs4ConfigMigrator>
 
 #include "skanlite.h"
+#include "Trace.h"
 #include "version.h"
 
 int main(int argc, char *argv[])
@@ -90,17 +91,29 @@ int main(int argc, char *argv[])
     parser.addVersionOption();
     QCommandLineOption deviceOption(QStringList() << QLatin1String("d") << QLatin1String("device"), i18n("Sane scanner device name. Use 'test' for test device."), i18n("device"));
     parser.addOption(deviceOption);
+    QCommandLineOption traceOption(QStringList() << QLatin1String("trace"), i18n("Write the time spent in each step of the page processing to a Chrome trace file."), i18n("file"));
+    parser.addOption(traceOption);
     parser.process(app); // the --author and --license is shown anyway but they work only with the following line
     aboutData.processCommandLine(&parser);
 
     const QString deviceName = parser.value(deviceOption);
     qDebug() << QString::fromLatin1("deviceOption value=%1").arg(deviceName);
 
-    Skanlite skanliteDialog(deviceName, nullptr);
-    skanliteDialog.setAboutData(&aboutData);
+    if (parser.isSet(traceOption)) {
+        Trace::start(parser.value(traceOption));
+    }
 
-    skanliteDialog.show();
+    int ret;
+    {
+        Skanlite skanliteDialog(deviceName, nullptr);
+        skanliteDialog.setAboutData(&aboutData);
 
-    return app.exec();
+        skanliteDialog.show();
+
+        ret = app.exec();
+    }
+    // written when the saver thread is done with the last page
+    Trace::stop();
+    return ret;
 }
 
@@ -0,0 +1,217 @@
+/* ============================================================
+ * Description : Saves raw captures again through the Skanlite
+ *               saving code, without a scanner.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ *  by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License.
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * ============================================================ */
+
+#include "KSaneImageSaver.h"
+#include "RawCapture.h"
+#include "Trace.h"
+#include "version.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSet>
+#include <QStringList>
+#include <QUrl>
+
+#include <KConfigGroup>
+#include <KSaneWidget>
+#include <KSharedConfig>
+
+#include <stdio.h>
+
+using namespace KSaneIface;
+
+// The encoder settings of Skanlite, so a capture is saved as Skanlite would save it
+static void readSettings(KSaneImageSaver &saver, QString &format, QString &pipeline)
+{
+    KConfigGroup saving(KSharedConfig::openConfig(QStringLiteral("skanliterc")), "Image Saving");
+    format = saving.readEntry("ImgFormat", "png");
+    pipeline = saving.readEntry("Pipeline", QString());
+    saver.setEncoderOptions(saving.readEntry("EncoderThreads", 0),
+                            saving.readEntry("JxlEffort", 7),
+                            saving.readEntry("WebpMethod", 4));
+    saver.setTiffOptions(saving.readEntry("TiffCompression", "deflate"),
+                         saving.readEntry("TiffBigTiff", "auto"),
+                         saving.readEntry("CompressionLevel", -1));
+    saver.setJpegOptions(saving.readEntry("JpegSubsampling", "4:2:0"),
+                         saving.readEntry("JpegProgressive", false),
+                         saving.readEntry("JpegRestartRows", 0));
+    saver.setSyncPolicy(saving.readEntry("SyncPolicy", "file"),
+                        saving.readEntry("SyncBatchSize", 16));
+    saver.setWriteOptions(saving.readEntry("DirectIO", false),
+                          saving.readEntry("AsyncWrites", false),
+                          saving.readEntry("DropPageCache", false));
+    saver.setDerivatives(KConfigGroup(KSharedConfig::openConfig(QStringLiteral("skanliterc")), "Derivatives").entryMap());
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("skanlite-replay"));
+    QCoreApplication::setApplicationVersion(QLatin1String(skanlite_version));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Saves Skanlite raw captures (.skraw) again with the current or the given "
+                                                    "settings, as fast as the saving allows."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument(QStringLiteral("captures"), QStringLiteral("The .skraw files to save."), QStringLiteral("captures..."));
+    QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+                                    QStringLiteral("Directory of the saved images, the directory of the capture by default."), QStringLiteral("dir"));
+    QCommandLineOption formatOption(QStringList() << QStringLiteral("f") << QStringLiteral("format"),
+                                    QStringLiteral("File suffix of the saved images, like png, jpg or tif."), QStringLiteral("suffix"));
+    QCommandLineOption qualityOption(QStringList() << QStringLiteral("q") << QStringLiteral("quality"),
+                                     QStringLiteral("Quality of lossy formats, 0-100."), QStringLiteral("quality"), QStringLiteral("-1"));
+    QCommandLineOption pipelineOption(QStringLiteral("pipeline"),
+                                      QStringLiteral("Post-processing stages, like \"levels=10:245;unsharp=0.8:2\"."), QStringLiteral("spec"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"),
+                                    QStringLiteral("Save every capture n times, for benchmarking."), QStringLiteral("n"), QStringLiteral("1"));
+    QCommandLineOption defaultsOption(QStringLiteral("defaults"),
+                                      QStringLiteral("Use the default settings instead of the Skanlite settings."));
+    QCommandLineOption overwriteOption(QStringLiteral("overwrite"),
+                                       QStringLiteral("Replace existing images, by default a capture is not saved over an image."));
+    QCommandLineOption traceOption(QStringLiteral("trace"),
+                                   QStringLiteral("Write the time spent in each step of the saving to a Chrome trace file."), QStringLiteral("file"));
+    parser.addOption(outputOption);
+    parser.addOption(formatOption);
+    parser.addOption(qualityOption);
+    parser.addOption(pipelineOption);
+    parser.addOption(repeatOption);
+    parser.addOption(defaultsOption);
+    parser.addOption(overwriteOption);
+    parser.addOption(traceOption);
+    parser.process(app);
+
+    const QStringList captures = parser.positionalArguments();
+    if (captures.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    KSaneImageSaver saver;
+    QString format = QStringLiteral("png");
+    QString pipeline;
+    if (!parser.isSet(defaultsOption)) {
+        readSettings(saver, format, pipeline);
+    }
+    if (parser.isSet(formatOption)) {
+        format = parser.value(formatOption).toLower();
+    }
+    if (parser.isSet(pipelineOption)) {
+        pipeline = parser.value(pipelineOption);
+    }
+    QString error;
+    if (!saver.setPipeline(pipeline, &error)) {
+        fprintf(stderr, "Invalid pipeline: %s\n", qPrintable(error));
+        return 1;
+    }
+    const int quality = parser.value(qualityOption).toInt();
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+    const int total = captures.size() * repeat;
+
+    // Only a few pages are read ahead of the saver, the captures are decompressed
+    // while the previous page is encoded and a large set does not fill the memory.
+    const int readAhead = 2;
+    int next = 0;
+    int inFlight = 0;
+    int saved = 0;
+    int failed = 0;
+    qint64 rawBytes = 0;
+    qint64 fileBytes = 0;
+    QSet<QString> written;
+    QElapsedTimer timer;
+    timer.start();
+    if (parser.isSet(traceOption)) {
+        Trace::start(parser.value(traceOption));
+    }
+
+    auto feed = [&]() {
+        while (next < total && inFlight < readAhead) {
+            const QString captureName = captures[next % captures.size()];
+            next++;
+            RawCapture::Capture capture;
+            TraceSpan span("read capture", "io", captureName);
+            if (!RawCapture::read(captureName, capture, &error)) {
+                fprintf(stderr, "%s: %s\n", qPrintable(captureName), qPrintable(error));
+                failed++;
+                continue;
+            }
+            const QFileInfo info(captureName);
+            const QString dir = parser.isSet(outputOption) ? parser.value(outputOption) : info.path();
+            QString suffix = format;
+            const bool is16Bit = (capture.format == KSaneWidget::FormatGrayScale16 || capture.format == KSaneWidget::FormatRGB_16_C);
+            if (is16Bit && !KSaneImageSaver::suffixes16Bit().contains(suffix)) {
+                suffix = QStringLiteral("png");
+            }
+            const QString name = QDir(dir).filePath(info.completeBaseName() + QLatin1Char('.') + suffix);
+            // the capture is named after the image it was saved as, which is usually still next to it
+            if (!parser.isSet(overwriteOption) && !written.contains(name) && QFileInfo::exists(name)) {
+                fprintf(stderr, "%s exists, use --overwrite or another directory with -o\n", qPrintable(name));
+                failed++;
+                continue;
+            }
+            // --repeat saves over the images of this run
+            written.insert(name);
+
+            saver.setScanMetadata(capture.deviceName, capture.options, capture.iccProfile);
+            rawBytes += capture.data.size();
+            inFlight++;
+            // the same choice as Skanlite::saveImage()
+            if (is16Bit && !(KSaneImageSaver::suffixes16Bit().contains(suffix) && suffix != QLatin1String("png"))) {
+                saver.save16BitPng(QUrl::fromLocalFile(name), name, capture.data, capture.width, capture.height,
+                                   capture.bpl, capture.dpi, capture.format, QString(), quality);
+            }
+            else {
+                saver.saveQImage(QUrl::fromLocalFile(name), name, capture.data, capture.width, capture.height,
+                                 capture.bpl, capture.dpi, capture.format, QString(), quality);
+            }
+        }
+        if (saved + failed == total) {
+            const double seconds = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+            printf("%d pages saved, %d failed in %.2f s: %.1f pages/min, %.1f MB/s of scan data, %.1f MB written\n",
+                   saved, failed, seconds, saved * 60 / seconds, rawBytes / seconds / 1e6, fileBytes / 1e6);
+            QCoreApplication::exit(failed > 0 ? 1 : 0);
+        }
+    };
+
+    QObject::connect(&saver, &KSaneImageSaver::imageSaved, &app,
+                     [&](const QUrl &, const QString &name, bool success, const QVariantMap &metadata) {
+        inFlight--;
+        if (success) {
+            saved++;
+            fileBytes += metadata.value(QStringLiteral("fileSize")).toLongLong();
+            printf("%s %lld ms\n", qPrintable(name), metadata.value(QStringLiteral("encodeMs")).toLongLong());
+        }
+        else {
+            failed++;
+            fprintf(stderr, "%s: %s\n", qPrintable(name), qPrintable(metadata.value(QStringLiteral("error")).toString()));
+        }
+        feed();
+    });
+
+    feed();
+    const int ret = (saved + failed == total) ? (failed > 0 ? 1 : 0) : app.exec();
+    Trace::stop();
+    return ret;
+}
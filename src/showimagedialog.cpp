@@ -65,6 +65,11 @@ void ShowImageDialog::setQImage(QImage *img)
     m_imageViewer->setQImage(img);
 }
 
+void ShowImageDialog::setValidRows(int validRows)
+{
+    m_imageViewer->setValidRows(validRows);
+}
+
 void ShowImageDialog::zoom2Fit()
 {
     m_imageViewer->zoom2Fit();
@@ -37,6 +37,7 @@ public:
     explicit ShowImageDialog(QWidget *parent = nullptr);
 
     void setQImage(QImage *img);
+    void setValidRows(int validRows);
 
 public Q_SLOTS:
     void zoom2Fit();
@@ -26,6 +26,13 @@
 
 #include "SaveLocation.h"
 #include "showimagedialog.h"
+#include "SharedPageExport.h"
+#include "PageAnalysis.h"
+#include "PageOcr.h"
+#include "ImagePipeline.h"
+#include "Barcode.h"
+#include "FileNamer.h"
+#include "Trace.h"
 
 #include <QApplication>
 #include <QScrollArea>
@@ -41,6 +48,11 @@
 #include <QMimeType>
 #include <QMimeDatabase>
 #include <QCloseEvent>
+#include <QTimer>
+#include <QRectF>
+#include <QDBusUnixFileDescriptor>
+#include <QFutureWatcher>
+#include <QtConcurrent>
 
 #include <KAboutApplicationDialog>
 #include <KLocalizedString>
@@ -54,6 +66,7 @@
 #include <KHelpClient>
 
 #include <errno.h>
+#include <unistd.h>
 
 Skanlite::Skanlite(const QString &device, QWidget *parent)
     : QDialog(parent)
@@ -77,15 +90,45 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
     connect(m_ksanew, &KSaneWidget::availableDevices, this, &Skanlite::availableDevices);
     connect(m_ksanew, &KSaneWidget::userMessage, this, &Skanlite::alertUser);
     connect(m_ksanew, &KSaneWidget::buttonPressed, this, &Skanlite::buttonPressed);
-    connect(m_ksanew, &KSaneWidget::scanDone, [this](){
-        if (!m_pendingApplyScanOpts.isEmpty()) {
-            applyScannerOptions(m_pendingApplyScanOpts);
+    connect(m_ksanew, &KSaneWidget::scanDone, this, &Skanlite::scanDone);
+
+    m_convertTimer = new QTimer(this);
+    m_convertTimer->setInterval(0);
+    connect(m_convertTimer, &QTimer::timeout, this, &Skanlite::convertNextRows);
+
+    m_continuousTimer = new QTimer(this);
+    m_continuousTimer->setSingleShot(true);
+    connect(m_continuousTimer, &QTimer::timeout, this, &Skanlite::requestScan);
+
+    m_buttonDispatcher = new ButtonDispatcher(this);
+    connect(m_ksanew, &KSaneWidget::buttonPressed, m_buttonDispatcher, &ButtonDispatcher::buttonPressed);
+    connect(m_ksanew, &KSaneWidget::scanProgress, m_buttonDispatcher, &ButtonDispatcher::scanStarted);
+    // the acquisition of a page is traced from its first progress to imageReady
+    connect(m_ksanew, &KSaneWidget::scanProgress, [this]() {
+        m_scanRunning = true;
+        if (m_acquireStart < 0 && Trace::isEnabled()) {
+            m_acquireStart = Trace::now();
         }
     });
+    connect(m_ksanew, &KSaneWidget::scanDone, [this]() { m_acquireStart = -1; });
+    connect(m_buttonDispatcher, &ButtonDispatcher::scanRequested, this, &Skanlite::requestScan);
+    connect(m_buttonDispatcher, &ButtonDispatcher::cancelRequested, this, &Skanlite::cancelScan);
+    connect(m_buttonDispatcher, &ButtonDispatcher::switchProfileRequested, [this](const QString &profile) {
+        switchToProfile(profile, defaultSelectionFiltering);
+    });
 
     m_imageSaver = new KSaneImageSaver(this);
     connect(m_imageSaver, &KSaneImageSaver::imageSaved, this, &Skanlite::imageSaved);
 
+    m_ocr = new PageOcr(this);
+    connect(m_ocr, &PageOcr::textReady, [this](const QString &fileName, const QString &text, const QStringList &sidecars, const QString &error) {
+        if (!error.isEmpty()) {
+            qWarning() << "OCR of" << fileName << "failed:" << error;
+            return;
+        }
+        emit m_dbusInterface.ocrTextReady(fileName, text, sidecars);
+    });
+
     mainLayout->addWidget(m_ksanew);
     mainLayout->addWidget(dlgButtonBoxBottom);
 
@@ -128,6 +171,13 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
 
         qDebug() << m_filterList;
 
+        // formats the image saver encodes itself
+        foreach (const QString &mimeStr, KSaneImageSaver::nativeMimeTypes()) {
+            if (!m_filterList.contains(mimeStr)) {
+                m_filterList.append(mimeStr);
+            }
+        }
+
         // Put first class citizens at first place
         m_filterList.removeAll(QLatin1String("image/jpeg"));
         m_filterList.removeAll(QLatin1String("image/tiff"));
@@ -136,8 +186,16 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
         m_filterList.insert(1, QLatin1String("image/jpeg"));
         m_filterList.insert(2, QLatin1String("image/tiff"));
 
-        m_filter16BitList << QLatin1String("image/png");
-        //m_filter16BitList << QLatin1String("image/tiff");
+        // tif and tiff are the same type, image/tiff
+        QMimeDatabase mimeDatabase;
+        foreach (const QString &suffix, KSaneImageSaver::suffixes16Bit()) {
+            const QMimeType mimeType = mimeDatabase.mimeTypeForFile(QLatin1String("x.") + suffix, QMimeDatabase::MatchExtension);
+            // an older shared-mime-info may not know image/jxl yet
+            const QString name = mimeType.isDefault() ? QLatin1String("image/") + suffix : mimeType.name();
+            if (!m_filter16BitList.contains(name)) {
+                m_filter16BitList << name;
+            }
+        }
 
         // fill m_filterList (...) and m_typeList (list of file suffixes)
         foreach (QString mimeStr, m_filterList) {
@@ -149,6 +207,10 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
             if (fileSuffixes.size() > 0) {
                 m_typeList << fileSuffixes.first();
             }
+            else if (mimeStr == QLatin1String("image/jxl")) {
+                // not known to older shared-mime-info versions
+                m_typeList << QStringLiteral("jxl");
+            }
         }
 
         m_settingsUi.imgFormat->addItems(m_typeList);
@@ -177,36 +239,42 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
 
     // open the scan device
     if (m_ksanew->openDevice(device) == false) {
-        QString dev = m_ksanew->selectDevice(nullptr);
-        if (dev.isEmpty()) {
-            // either no scanner was found or then cancel was pressed.
-            exit(0);
-        }
-        if (m_ksanew->openDevice(dev) == false) {
-            // could not open a scanner
-            KMessageBox::sorry(nullptr, i18n("Opening the selected scanner failed."));
-            exit(1);
-        }
-        else {
-            setWindowTitle(i18nc("@title:window %1 = scanner maker, %2 = scanner model", "%1 %2 - Skanlite", m_ksanew->make(), m_ksanew->model()));
-            m_deviceName = QString::fromLatin1("%1:%2").arg(m_ksanew->make()).arg(m_ksanew->model());
+        // try the last used scanner first, the device discovery can take a long time with network backends
+        QString dev = device.isEmpty() ? m_deviceCache.lastDevice() : QString();
+        if (dev.isEmpty() || m_ksanew->openDevice(dev) == false) {
+            dev = m_ksanew->selectDevice(nullptr);
+            if (dev.isEmpty()) {
+                // either no scanner was found or then cancel was pressed.
+                exit(0);
+            }
+            if (m_ksanew->openDevice(dev) == false) {
+                // could not open a scanner
+                KMessageBox::sorry(nullptr, i18n("Opening the selected scanner failed."));
+                exit(1);
+            }
         }
+        setWindowTitle(i18nc("@title:window %1 = scanner maker, %2 = scanner model", "%1 %2 - Skanlite", m_ksanew->make(), m_ksanew->model()));
+        m_deviceName = QString::fromLatin1("%1:%2").arg(m_ksanew->make()).arg(m_ksanew->model());
+        m_deviceCache.setLastDevice(dev, m_ksanew->make(), m_ksanew->model());
     }
     else {
         setWindowTitle(i18nc("@title:window %1 = scanner device", "%1 - Skanlite", device));
         m_deviceName = device;
+        // the next start without --device opens it first
+        m_deviceCache.setLastDevice(device, m_ksanew->make(), m_ksanew->model());
     }
 
     // prepare the Show Image Dialog
     m_showImgDialog = new ShowImageDialog(this);
     connect(m_showImgDialog, &ShowImageDialog::saveRequested, this, &Skanlite::saveImage);
-    connect(m_showImgDialog, &ShowImageDialog::rejected, m_ksanew, &KSaneWidget::scanCancel);
+    connect(m_showImgDialog, &ShowImageDialog::rejected, this, &Skanlite::pageRejected);
 
     // save the default sane options for later use
     m_ksanew->getOptVals(m_defaultScanOpts);
 
     // load saved options
     loadScannerOptions();
+    loadColorProfile();
 
     m_ksanew->initGetDeviceList();
 
@@ -214,11 +282,20 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
 
     if (m_dbusInterface.setupDBusInterface()) {
         // D-Bus related slots
-        connect(&m_dbusInterface, &DBusInterface::requestedScan, m_ksanew, &KSaneWidget::scanFinal);
-        connect(&m_dbusInterface, &DBusInterface::requestedPreview, m_ksanew, &KSaneWidget::startPreviewScan);
-        connect(&m_dbusInterface, &DBusInterface::requestedScanCancel, m_ksanew, &KSaneWidget::scanCancel);
+        connect(&m_dbusInterface, &DBusInterface::requestedScan, this, &Skanlite::requestScan);
+        connect(&m_dbusInterface, &DBusInterface::requestedPreview, this, &Skanlite::preview);
+        connect(&m_dbusInterface, &DBusInterface::requestedQuickPreview, this, &Skanlite::quickPreview);
+        connect(&m_dbusInterface, &DBusInterface::requestedInvalidatePreview, this, &Skanlite::invalidatePreview);
+        connect(&m_dbusInterface, &DBusInterface::requestedScanCancel, this, &Skanlite::cancelScan);
+        connect(&m_dbusInterface, &DBusInterface::requestedStartContinuousScan, this, &Skanlite::startContinuousScan);
+        connect(&m_dbusInterface, &DBusInterface::requestedStopContinuousScan, this, &Skanlite::stopContinuousScan);
+        connect(&m_dbusInterface, &DBusInterface::requestedScanCancel, this, &Skanlite::stopContinuousScan);
+        connect(&m_dbusInterface, &DBusInterface::requestedSharedMemoryExport, this, &Skanlite::setSharedMemoryExport);
+        connect(&m_dbusInterface, &DBusInterface::requestedCloseDocument, this, &Skanlite::closeDocument);
+        connect(&m_dbusInterface, &DBusInterface::requestedStartTrace, this, &Skanlite::startTrace);
         connect(&m_dbusInterface, &DBusInterface::requestedSetScannerOptions, this, &Skanlite::setScannerOptions);
         connect(&m_dbusInterface, &DBusInterface::requestedSetSelection, this, &Skanlite::setSelection);
+        connect(&m_dbusInterface, &DBusInterface::requestedSetScanRegions, this, &Skanlite::setScanRegions);
 
         // D-Bus related slots below must be Qt::DirectConnection to simplify return value forwarding via DBusInterface
         connect(&m_dbusInterface, &DBusInterface::requestedGetScannerOptions, this, &Skanlite::getScannerOptions, Qt::DirectConnection);
@@ -227,12 +304,23 @@ Skanlite::Skanlite(const QString &device, QWidget *parent)
         connect(&m_dbusInterface, &DBusInterface::requestedSaveScannerOptionsToProfile, this, &Skanlite::saveScannerOptionsToProfile, Qt::DirectConnection);
         connect(&m_dbusInterface, &DBusInterface::requestedSwitchToProfile, this, &Skanlite::switchToProfile, Qt::DirectConnection);
         connect(&m_dbusInterface, &DBusInterface::requestedGetSelection, this, &Skanlite::getSelection, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedGetScanRegions, this, &Skanlite::getScanRegions, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedSaveScanRegionsToProfile, this, &Skanlite::saveScanRegionsToProfile, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedGetPipeline, this, &Skanlite::getPipeline, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedSetPipeline, this, &Skanlite::setPipeline, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedSavePipelineToProfile, this, &Skanlite::savePipelineToProfile, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedDeviceList, this, &Skanlite::getDeviceList, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedButtonActions, this, &Skanlite::getButtonActions, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedStopTrace, this, &Skanlite::stopTrace, Qt::DirectConnection);
+        connect(&m_dbusInterface, &DBusInterface::requestedSetButtonAction, this, &Skanlite::setButtonAction, Qt::DirectConnection);
 
         // D-Bus related signals
         connect(m_ksanew, &KSaneWidget::scanDone, &m_dbusInterface, &DBusInterface::scanDone);
         connect(m_ksanew, &KSaneWidget::userMessage, &m_dbusInterface, &DBusInterface::userMessage);
         connect(m_ksanew, &KSaneWidget::scanProgress, &m_dbusInterface, &DBusInterface::scanProgress);
         connect(m_ksanew, &KSaneWidget::buttonPressed, &m_dbusInterface, &DBusInterface::buttonPressed);
+        connect(m_buttonDispatcher, &ButtonDispatcher::triggerLatency, &m_dbusInterface, &DBusInterface::buttonTriggerLatency);
+        connect(this, &Skanlite::continuousScanFinished, &m_dbusInterface, &DBusInterface::continuousScanFinished);
     }
     else {
         // keep working without dbus
@@ -265,16 +353,6 @@ void Skanlite::saveWindowSize()
 
 // Pops up message box similar to what perror() would print
 //************************************************************
-static void perrorMessageBox(const QString &text)
-{
-    if (errno != 0) {
-        KMessageBox::sorry(nullptr, i18n("%1: %2", text, QString::fromLocal8Bit(strerror(errno))));
-    }
-    else {
-        KMessageBox::sorry(nullptr, text);
-    }
-}
-
 void Skanlite::readSettings(void)
 {
     // enable the widgets to allow modifying
@@ -293,6 +371,35 @@ void Skanlite::readSettings(void)
     m_settingsUi.imgQuality->setValue(saving.readEntry("ImgQuality", 90));
     m_settingsUi.setQuality->setChecked(saving.readEntry("SetQuality", false));
     m_settingsUi.showB4Save->setChecked(saving.readEntry("ShowBeforeSave", true));
+    m_exportSharedMemory = saving.readEntry("ExportSharedMemory", false);
+    m_duplicateCheck = saving.readEntry("DuplicateCheck", "off");
+    m_duplicateMaxDistance = saving.readEntry("DuplicateMaxDistance", 6);
+    m_pageHashIndex.setHistory(saving.readEntry("DuplicateHistory", 1000));
+    m_imageSaver->setEncoderOptions(saving.readEntry("EncoderThreads", 0),
+                                    saving.readEntry("JxlEffort", 7),
+                                    saving.readEntry("WebpMethod", 4));
+    m_imageSaver->setTiffOptions(saving.readEntry("TiffCompression", "deflate"),
+                                 saving.readEntry("TiffBigTiff", "auto"),
+                                 saving.readEntry("CompressionLevel", -1));
+    m_imageSaver->setJpegOptions(saving.readEntry("JpegSubsampling", "4:2:0"),
+                                 saving.readEntry("JpegProgressive", false),
+                                 saving.readEntry("JpegRestartRows", 0));
+    m_imageSaver->setSyncPolicy(saving.readEntry("SyncPolicy", "file"),
+                                saving.readEntry("SyncBatchSize", 16));
+    m_imageSaver->setWriteOptions(saving.readEntry("DirectIO", false),
+                                  saving.readEntry("AsyncWrites", false),
+                                  saving.readEntry("DropPageCache", false));
+    m_imageSaver->setDerivatives(KConfigGroup(KSharedConfig::openConfig(), "Derivatives").entryMap());
+    m_imageSaver->setRawCapture(saving.readEntry("RawCapture", false),
+                                saving.readEntry("RawCaptureLevel", 3));
+    m_defaultPipeline = saving.readEntry("Pipeline", QString());
+    setPipeline(m_defaultPipeline);
+    m_ocr->readSettings();
+    m_separatorActions = KConfigGroup(KSharedConfig::openConfig(), "Separator Actions").entryMap();
+    m_fileNamer.setTemplate(saving.readEntry("NameTemplate", QString()));
+    m_saveLocation->setNaming(m_fileNamer, FileNamer::Fields());
+    m_separatorSearchHeight = qBound(0.05, saving.readEntry("SeparatorSearchHeight", 0.25), 1.0);
+    m_acquisitionBuffers = qMax(1, saving.readEntry("AcquisitionBuffers", 3));
 
     KConfigGroup general(KSharedConfig::openConfig(), "General");
 
@@ -300,6 +407,8 @@ void Skanlite::readSettings(void)
     m_settingsUi.previewDPI->setCurrentText(general.readEntry("PreviewDPI", "100"));
 
     m_settingsUi.setPreviewDPI->setChecked(general.readEntry("SetPreviewDPI", false));
+    m_preview.setMaxAge(general.readEntry("PreviewCacheMaxAge", 600));
+    m_quickPreview.setMaxAge(general.readEntry("PreviewCacheMaxAge", 600));
     if (m_settingsUi.setPreviewDPI->isChecked()) {
         m_ksanew->setPreviewResolution(m_settingsUi.previewDPI->currentText().toFloat());
     }
@@ -308,6 +417,10 @@ void Skanlite::readSettings(void)
     }
     m_settingsUi.u_disableSelections->setChecked(general.readEntry("DisableAutoSelection", false));
     m_ksanew->enableAutoSelect(!m_settingsUi.u_disableSelections->isChecked());
+
+    m_settingsUi.continuousScan->setChecked(general.readEntry("ContinuousScan", false));
+    m_settingsUi.continuousDelay->setValue(general.readEntry("ContinuousScanDelay", 0));
+    m_settingsUi.continuousMaxPages->setValue(general.readEntry("ContinuousScanMaxPages", 0));
 }
 
 void Skanlite::showSettingsDialog(void)
@@ -331,6 +444,9 @@ void Skanlite::showSettingsDialog(void)
         general.writeEntry("PreviewDPI", m_settingsUi.previewDPI->currentText());
         general.writeEntry("SetPreviewDPI", m_settingsUi.setPreviewDPI->isChecked());
         general.writeEntry("DisableAutoSelection", m_settingsUi.u_disableSelections->isChecked());
+        general.writeEntry("ContinuousScan", m_settingsUi.continuousScan->isChecked());
+        general.writeEntry("ContinuousScanDelay", m_settingsUi.continuousDelay->value());
+        general.writeEntry("ContinuousScanMaxPages", m_settingsUi.continuousMaxPages->value());
         general.sync();
 
         // the previewDPI has to be set here
@@ -358,19 +474,128 @@ void Skanlite::showSettingsDialog(void)
 
 void Skanlite::imageReady(QByteArray &data, int w, int h, int bpl, int f)
 {
-    // save the image data
-    m_data = data;
-    m_width = w;
-    m_height = h;
-    m_bytesPerLine = bpl;
-    m_format = f;
+    if (m_acquireStart >= 0) {
+        Trace::complete("acquire", "page", m_acquireStart);
+        m_acquireStart = -1;
+    }
+    TraceSpan span("ready", "page");
+
+    // a quick preview is kept instead of saved
+    if (m_quickPreviewActive) {
+        m_quickPreviewActive = false;
+        QMap<QString, QString> opts;
+        m_ksanew->getOptVals(opts);
+        const QPointF origin(opts.value(QStringLiteral("tl-x")).toDouble(), opts.value(QStringLiteral("tl-y")).toDouble());
+        m_quickPreview.store(opts, data, w, h, bpl, f, (int) m_ksanew->currentDPI(), origin);
+        applyScannerOptions(m_quickPreviewRestore);
+        emit m_dbusInterface.quickPreviewReady(m_quickPreview.regions());
+        return;
+    }
 
-    if (m_settingsUi.showB4Save->isChecked() == true) {
-        /* copy the image data into m_img and show it*/
-        m_img = m_ksanew->toQImageSilent(data, w, h, bpl, (KSaneIface::KSaneWidget::ImageFormat)f);
+    // The page is only queued here. KSaneWidget starts reading the next page
+    // when this returns, so nothing in here waits for the user; the dialogs,
+    // the checks and the saving are done by processPages().
+    AcquiredPage page;
+    page.data = data;
+    page.width = w;
+    page.height = h;
+    page.bytesPerLine = bpl;
+    page.format = f;
+    page.dpi = (int) m_ksanew->currentDPI();
+    m_ksanew->getOptVals(page.options);
+    page.id = ++m_lastPageId;
+
+    m_pageReceived = true;
+
+    if (!m_continuousActive && m_settingsUi.continuousScan->isChecked()) {
+        m_continuousActive = true;
+        m_continuousPages = 0;
+        m_continuousDelay = m_settingsUi.continuousDelay->value();
+        m_continuousMaxPages = m_settingsUi.continuousMaxPages->value();
+    }
+    if (m_continuousActive) {
+        m_continuousPages++;
+        page.continuousPage = m_continuousPages;
+    }
+
+    checkSeparator(page);
+
+    // The buffers only limit the scans Skanlite starts, see resumeAcquisition().
+    // The pages KSaneWidget scans on its own, the rest of a feeder batch, are
+    // queued beyond the limit instead of stopping the batch.
+    m_acquiredPages.enqueue(page);
+    QMetaObject::invokeMethod(this, "processPages", Qt::QueuedConnection);
+}
+
+void Skanlite::processPages()
+{
+    // The dialogs of a page run an event loop, the pages scanned meanwhile are
+    // queued and processed in order when it returns. A page whose separator
+    // check still runs holds up the pages after it, separatorsChecked() goes on.
+    if (m_processingPages) {
+        return;
+    }
+    m_processingPages = true;
+    while (!m_acquiredPages.isEmpty()) {
+        takeSeparatorChecks();
+        if (m_acquiredPages.head().separatorPending) {
+            break;
+        }
+        const AcquiredPage page = m_acquiredPages.dequeue();
+        resumeAcquisition();
+        processPage(page);
+    }
+    m_processingPages = false;
+
+    // the batch ended while its last pages were queued
+    if (m_closeDocumentPending && m_acquiredPages.isEmpty()) {
+        m_closeDocumentPending = false;
+        closeDocument();
+    }
+}
+
+void Skanlite::processPage(const AcquiredPage &page)
+{
+    TraceSpan span("process", "page");
+
+    m_data = page.data;
+    m_width = page.width;
+    m_height = page.height;
+    m_bytesPerLine = page.bytesPerLine;
+    m_format = page.format;
+    m_dpi = page.dpi;
+    m_scanOptions = page.options;
+    m_continuousPage = page.continuousPage;
+    m_pageId = page.id;
+
+    // separator sheets look alike, they are not checked for duplicates, nor saved or exported
+    if (!page.separator.isEmpty()) {
+        applySeparator(page.separator);
+        return;
+    }
+
+    if (m_exportSharedMemory) {
+        exportPage();
+    }
+
+    if (checkDuplicate() && m_duplicateCheck == QLatin1String("skip")) {
+        emit m_dbusInterface.duplicatePageSkipped(PageHashIndex::hashToString(m_pageHash), m_duplicateOf);
+        return;
+    }
+
+    // a modal preview would stop the continuous scanning
+    if (m_settingsUi.showB4Save->isChecked() == true && m_continuousPage == 0) {
+        /* copy the image data into m_img and show it while it is being converted */
+        m_convertedRows = 0;
+        convertRows();
         m_showImgDialog->setQImage(&m_img);
+        m_showImgDialog->setValidRows(m_convertedRows);
         m_showImgDialog->zoom2Fit();
+        if (m_convertedRows < m_height) {
+            m_convertTimer->start();
+        }
         m_showImgDialog->exec();
+        m_convertTimer->stop();
         // save has been done as a result of save or then we got cancel
     }
     else {
@@ -379,14 +604,271 @@ void Skanlite::imageReady(QByteArray &data, int w, int h, int bpl, int f)
     }
 }
 
-bool pathExists(const QString& dir, QWidget* parent)
+QString Skanlite::localSaveDir() const
+{
+    const QUrl dirUrl = QUrl::fromUserInput(m_saveLocation->u_urlRequester->url().url());
+    return dirUrl.isLocalFile() ? QDir::cleanPath(dirUrl.toLocalFile()) : QString();
+}
+
+void Skanlite::checkSeparator(AcquiredPage &page)
+{
+    // Only sparse rows of the page are read, see Barcode::findCode39(), and that
+    // in the background, KSaneWidget reads the next page meanwhile.
+    if (m_separatorActions.isEmpty()) {
+        return;
+    }
+    const QByteArray data = page.data;
+    const int width = page.width;
+    const int height = page.height;
+    const int bpl = page.bytesPerLine;
+    const int format = page.format;
+    const int dpi = page.dpi;
+    const double searchHeight = m_separatorSearchHeight;
+    page.separatorCheck = QtConcurrent::run([data, width, height, bpl, format, dpi, searchHeight]() {
+        return Barcode::findCode39(data, width, height, bpl, format, dpi, searchHeight);
+    });
+    page.separatorPending = true;
+
+    QFutureWatcher<QString> *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, &Skanlite::separatorsChecked);
+    connect(watcher, &QFutureWatcher<QString>::finished, watcher, &QObject::deleteLater);
+    watcher->setFuture(page.separatorCheck);
+}
+
+void Skanlite::takeSeparatorChecks()
+{
+    // in page order, the scanner profile of the last separator is the one that stays
+    for (int i = 0; i < m_acquiredPages.size(); ++i) {
+        AcquiredPage &page = m_acquiredPages[i];
+        if (!page.separatorPending) {
+            continue;
+        }
+        if (!page.separatorCheck.isFinished()) {
+            return;
+        }
+        page.separatorPending = false;
+        const QString code = page.separatorCheck.result();
+        if (code.isEmpty() || !m_separatorActions.contains(code)) {
+            continue;
+        }
+        page.separator = code;
+
+        // The scanner options of a profile are for the next scan. Its saving
+        // settings and the split are for the pages after the sheet, the pages
+        // before it may still be queued; applySeparator() does them in page order.
+        foreach (const QString &step, m_separatorActions.value(code).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+            const QString trimmed = step.trimmed();
+            if (trimmed.startsWith(QLatin1String("profile:"))) {
+                switchScannerProfile(trimmed.mid(8), false);
+            }
+        }
+    }
+}
+
+bool Skanlite::separatorCheckPending() const
+{
+    foreach (const AcquiredPage &page, m_acquiredPages) {
+        if (page.separatorPending) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Skanlite::separatorsChecked()
+{
+    takeSeparatorChecks();
+    resumeAcquisition();
+    processPages();
+}
+
+void Skanlite::applySeparator(const QString &code)
+{
+    const QString action = m_separatorActions.value(code);
+    foreach (const QString &step, action.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QString trimmed = step.trimmed();
+        if (trimmed == QLatin1String("split")) {
+            closeDocument();
+        }
+        else if (trimmed.startsWith(QLatin1String("profile:"))) {
+            switchSaveProfile(trimmed.mid(8));
+        }
+        else {
+            qWarning() << "Unknown separator action" << trimmed;
+        }
+    }
+    emit m_dbusInterface.separatorDetected(code, action);
+}
+
+void Skanlite::requestScan()
+{
+    // Every page takes a buffer until it is processed, and a separator sheet may
+    // change the scanner options of the next scan. The scan starts as soon as a
+    // buffer is free and the queued pages are checked.
+    m_acquisitionWaiting = true;
+    resumeAcquisition();
+}
+
+void Skanlite::resumeAcquisition()
+{
+    if (!m_acquisitionWaiting || m_acquiredPages.size() >= m_acquisitionBuffers || separatorCheckPending()) {
+        return;
+    }
+    m_acquisitionWaiting = false;
+    m_scanRequestedAfter = m_lastPageId;
+    m_ksanew->scanFinal();
+}
+
+void Skanlite::cancelScan()
+{
+    // a scan waiting for a buffer does not start anymore, stopContinuousScan()
+    // ends a continuous scan that waits
+    if (!m_continuousActive) {
+        m_acquisitionWaiting = false;
+    }
+    m_ksanew->scanCancel();
+}
+
+void Skanlite::pageRejected()
 {
-    // propose directory creation if doesn't exists
+    // The scanner may already be at the next page, which is not turned down with
+    // this one. Only a feeder batch still busy with the pages after this one, of
+    // which none is queued yet, is stopped.
+    if (m_acquiredPages.isEmpty() && m_scanRunning && m_scanRequestedAfter < m_pageId) {
+        m_ksanew->scanCancel();
+    }
+}
+
+void Skanlite::startTrace(const QString &fileName)
+{
+    // a running trace is written first, so that it is not lost
+    Trace::stop();
+    Trace::start(fileName);
+}
+
+void Skanlite::stopTrace()
+{
+    QString error;
+    Trace::stop(&error);
+    m_dbusInterface.setReply(QStringList(error));
+}
+
+void Skanlite::closeDocument()
+{
+    if (m_documentPages == 0) {
+        return;
+    }
+    m_document++;
+    m_documentPages = 0;
+    // the pages may already be saved
+    documentPageSaved(QVariantMap(), QString());
+}
+
+void Skanlite::documentPageSaved(const QVariantMap &metadata, const QString &fileName)
+{
+    const int document = metadata.value(QStringLiteral("document")).toInt();
+    if (document > 0) {
+        if (!fileName.isEmpty()) {
+            m_documentFiles[document].append(fileName);
+        }
+        // a page cut into regions is saved with its last image
+        bool pageDone = true;
+        if (metadata.contains(QStringLiteral("regionOf"))) {
+            const QString page = metadata.value(QStringLiteral("regionOf")).toString();
+            if (!m_regionsPending.contains(page)) {
+                m_regionsPending[page] = metadata.value(QStringLiteral("regionCount"), 1).toInt();
+            }
+            pageDone = (--m_regionsPending[page] <= 0);
+            if (pageDone) {
+                m_regionsPending.remove(page);
+            }
+        }
+        if (pageDone) {
+            m_documentPending[document]--;
+        }
+    }
+
+    // the closed documents are reported in order once all their pages are saved
+    QMap<int, int>::iterator it = m_documentPending.begin();
+    while (it != m_documentPending.end() && it.key() < m_document && it.value() <= 0) {
+        emit m_dbusInterface.documentFinished(it.key(), m_documentFiles.take(it.key()));
+        it = m_documentPending.erase(it);
+    }
+}
+
+bool Skanlite::checkDuplicate()
+{
+    // The hash is looked up in the index of the recent pages of the save
+    // directory, the page is added to the index when it has been saved.
+    m_pageHashValid = false;
+    m_duplicateOf.clear();
+    if (m_duplicateCheck != QLatin1String("flag") && m_duplicateCheck != QLatin1String("skip")) {
+        return false;
+    }
+    // all empty pages look alike
+    if (PageAnalysis::analyze(m_data, m_width, m_height, m_bytesPerLine, m_format).blankScore > 0.99) {
+        return false;
+    }
+    m_pageHash = PageAnalysis::perceptualHash(m_data, m_width, m_height, m_bytesPerLine, m_format);
+    m_pageHashValid = true;
+
+    const QString dir = localSaveDir();
+    if (!dir.isEmpty()) {
+        m_duplicateOf = m_pageHashIndex.findSimilar(dir, m_pageHash, m_duplicateMaxDistance);
+    }
+    return !m_duplicateOf.isEmpty();
+}
+
+void Skanlite::convertRows()
+{
+    // Convert a band of rows per call so that the dialog shows the top of a large
+    // page right away and stays responsive while the rest is converted.
+    static const qint64 pixelsPerBand = 2 * 1024 * 1024;
+    if (m_convertedRows >= m_height) {
+        return;
+    }
+    const int rows = qBound(1, int(pixelsPerBand / qMax(1, m_width)), m_height - m_convertedRows);
+
+    QByteArray band = QByteArray::fromRawData(m_data.constData() + qint64(m_convertedRows) * m_bytesPerLine, rows * m_bytesPerLine);
+    QImage bandImg = m_ksanew->toQImageSilent(band, m_width, rows, m_bytesPerLine, (KSaneIface::KSaneWidget::ImageFormat)m_format);
+
+    if (m_convertedRows == 0) {
+        m_img = QImage(m_width, m_height, bandImg.format());
+        m_img.setColorTable(bandImg.colorTable());
+        m_img.setDotsPerMeterX(bandImg.dotsPerMeterX());
+        m_img.setDotsPerMeterY(bandImg.dotsPerMeterY());
+    }
+    const int lineBytes = qMin(m_img.bytesPerLine(), bandImg.bytesPerLine());
+    for (int i = 0; i < rows; ++i) {
+        memcpy(m_img.scanLine(m_convertedRows + i), bandImg.constScanLine(i), lineBytes);
+    }
+    m_convertedRows += rows;
+}
+
+void Skanlite::convertNextRows()
+{
+    if (m_convertedRows >= m_height || !m_showImgDialog->isVisible()) {
+        m_convertTimer->stop();
+        return;
+    }
+    convertRows();
+    m_showImgDialog->setValidRows(m_convertedRows >= m_height ? -1 : m_convertedRows);
+}
+
+bool pathExists(const QString& dir, QWidget* parent, bool ask)
+{
+    // propose directory creation if doesn't exists, a batch creates it without asking
     QUrl dirUrl(dir);
     if (dirUrl.isLocalFile()) {
         QDir path(dirUrl.toLocalFile());
         if (!path.exists()) {
-            if (KMessageBox::questionYesNo(parent, i18n("Directory doesn't exist, do you wish to create it?")) == KMessageBox::ButtonCode::Yes ) {
+            if (!ask) {
+                if (!path.mkpath(QLatin1String("."))) {
+                    qWarning() << "Could not create directory" << path.path();
+                    return false;
+                }
+            }
+            else if (KMessageBox::questionYesNo(parent, i18n("Directory doesn't exist, do you wish to create it?")) == KMessageBox::ButtonCode::Yes ) {
                 if (!path.mkpath(QLatin1String("."))) {
                     KMessageBox::error(parent, i18n("Could not create directory %1", path.path()));
                     return false;
@@ -397,15 +879,41 @@ bool pathExists(const QString& dir, QWidget* parent)
     return true;
 }
 
+// a region in form "tl-x,tl-y,br-x,br-y"
+bool parseScanRegion(const QString &region, QRectF &mm)
+{
+    const QStringList values = region.split(QLatin1Char(','));
+    if (values.size() != 4) {
+        return false;
+    }
+    qreal coords[4];
+    for (int i = 0; i < 4; ++i) {
+        bool ok = false;
+        coords[i] = values[i].trimmed().toDouble(&ok);
+        if (!ok) {
+            return false;
+        }
+    }
+    mm = QRectF(QPointF(coords[0], coords[1]), QPointF(coords[2], coords[3])).normalized();
+    return !mm.isEmpty();
+}
+
 void Skanlite::saveImage()
 {
     // ask the first time if we are in "ask on first" mode
     QString dir = QDir::cleanPath(m_saveLocation->u_urlRequester->url().url()).append(QLatin1Char('/')); //make sure whole value is processed as path to directory
 
+    FileNamer::Fields nameFields;
+    nameFields.device = m_deviceName;
+    nameFields.profile = m_saveProfile;
+    nameFields.page = !m_separatorActions.isEmpty() ? m_documentPages + 1 : qMax(1, m_continuousPage);
+    nameFields.time = QDateTime::currentDateTime();
+    m_saveLocation->setNaming(m_fileNamer, nameFields);
+
     while ((m_firstImage && (m_settingsUi.saveModeCB->currentIndex() == SaveModeAskFirst)) ||
-           !pathExists(dir, this)) {
+           !pathExists(dir, this, m_continuousPage == 0)) {
         if (m_saveLocation->exec() != QFileDialog::Accepted) {
-            m_ksanew->scanCancel(); // In case we are cancelling a document feeder scan
+            pageRejected(); // In case we are cancelling a document feeder scan
             return;
         }
         dir = QDir::cleanPath(m_saveLocation->u_urlRequester->url().url()).append(QLatin1Char('/'));
@@ -420,41 +928,71 @@ void Skanlite::saveImage()
     if ((m_format == KSaneIface::KSaneWidget::FormatRGB_16_C) ||
             (m_format == KSaneIface::KSaneWidget::FormatGrayScale16)) {
         filterList = m_filter16BitList;
-        enforceSavingAsPng16bit = true;
-        if (imgFormat != QLatin1String("png")) {
+        const QStringList suffixes16Bit = KSaneImageSaver::suffixes16Bit();
+        if (!suffixes16Bit.contains(imgFormat)) {
             imgFormat = QLatin1String("png");
-            KMessageBox::information(this, i18n("The image will be saved in the PNG format, as Skanlite only supports saving 16 bit color images in the PNG format."));
+            const QString message = i18n("The image will be saved in the PNG format, as Skanlite only supports saving 16 bit color images in the following formats: %1.",
+                                         suffixes16Bit.join(QLatin1String(", ")).toUpper());
+            // a message box for every page would hold up the batch
+            if (m_continuousPage == 0) {
+                KMessageBox::information(this, message);
+            }
+            else {
+                qWarning() << message;
+            }
         }
+        enforceSavingAsPng16bit = true;
     }
 
     //qDebug() << dir << prefix << imgFormat;
 
-    // find next available file name for name suggestion
+    // Local names come from the name template. Without the file dialog the name is
+    // reserved in the directory right away, so other Skanlite instances saving to
+    // the same directory never get it; the directory is not scanned either way.
+    const bool askForName = (m_settingsUi.saveModeCB->currentIndex() == SaveModeManual && m_continuousPage == 0);
+    nameFields.prefix = prefix;
+    int nameNumber = -1;
     QUrl fileUrl;
-    QString fname;
-    for (int i = fileNumber; i <= m_saveLocation->u_numStartFrom->maximum(); ++i) {
-        fname = QString::fromLatin1("%1%2.%3")
-                .arg(prefix)
-                .arg(i, 4, 10, QLatin1Char('0'))
-                .arg(imgFormat);
-
-        fileUrl = QUrl::fromUserInput(QStringLiteral("%1%2").arg(dir, fname));
-        //qDebug() << fileUrl;
-        if (fileUrl.isLocalFile()) {
-            if (!QFileInfo(fileUrl.toLocalFile()).exists()) {
-                break;
-            }
+    const QUrl dirUrl = QUrl::fromUserInput(dir);
+    if (dirUrl.isLocalFile()) {
+        const QString localDir = dirUrl.toLocalFile();
+        if (askForName) {
+            fileUrl = QUrl::fromLocalFile(m_fileNamer.suggest(localDir, imgFormat, nameFields, fileNumber, &nameNumber));
         }
         else {
-            KIO::StatJob *statJob = KIO::stat(fileUrl, KIO::StatJob::DestinationSide, 0);
-            KJobWidgets::setWindow(statJob, QApplication::activeWindow());
-            if (!statJob->exec()) {
-                break;
+            QString error;
+            const QString name = m_fileNamer.reserve(localDir, imgFormat, nameFields, fileNumber, &nameNumber, &error);
+            if (name.isEmpty()) {
+                emit m_dbusInterface.imageSaveFailed(localDir, error);
+                if (m_continuousPage == 0) {
+                    KMessageBox::sorry(nullptr, i18n("Failed to save image: %1", error));
+                }
+                else {
+                    qWarning() << "Failed to save image:" << error;
+                }
+                return;
             }
+            fileUrl = QUrl::fromLocalFile(name);
         }
     }
+    // remote directories are probed for the next free number
+    for (int i = fileNumber; !dirUrl.isLocalFile() && i <= m_saveLocation->u_numStartFrom->maximum(); ++i) {
+        const QString fname = QString::fromLatin1("%1%2.%3")
+                              .arg(prefix)
+                              .arg(i, 4, 10, QLatin1Char('0'))
+                              .arg(imgFormat);
 
-    if (m_settingsUi.saveModeCB->currentIndex() == SaveModeManual) {
+        fileUrl = QUrl::fromUserInput(QStringLiteral("%1%2").arg(dir, fname));
+        //qDebug() << fileUrl;
+        KIO::StatJob *statJob = KIO::stat(fileUrl, KIO::StatJob::DestinationSide, 0);
+        KJobWidgets::setWindow(statJob, QApplication::activeWindow());
+        if (!statJob->exec()) {
+            break;
+        }
+    }
+
+    // no file dialog for every page while scanning continuously
+    if (askForName) {
         // prepare the save dialog
         QFileDialog saveDialog(this, i18n("New Image File Name"));
         saveDialog.setAcceptMode(QFileDialog::AcceptSave);
@@ -477,6 +1015,9 @@ void Skanlite::saveImage()
                 return;
             }
 
+            if (saveDialog.selectedUrls()[0] != fileUrl) {
+                nameNumber = -1;
+            }
             fileUrl = saveDialog.selectedUrls()[0];
 
             bool exists;
@@ -538,18 +1079,97 @@ void Skanlite::saveImage()
     }
 
 
-    // Save
-    if (enforceSavingAsPng16bit) {
-        m_imageSaver->save16BitPng(fileUrl, localName, m_data, m_width, m_height, m_bytesPerLine, (int) m_ksanew->currentDPI(), m_format, fileFormat, quality);
+    // the scan information is written into the file by the saver
+    const QMap<QString, QString> &scanOpts = m_scanOptions;
+    m_imageSaver->setScanMetadata(m_deviceName, scanOpts, m_colorProfile);
+    QVariantMap pageMetadata;
+    pageMetadata[QStringLiteral("pageId")] = m_pageId;
+    if (m_pageHashValid) {
+        pageMetadata[QStringLiteral("perceptualHash")] = PageHashIndex::hashToString(m_pageHash);
+        if (!m_duplicateOf.isEmpty()) {
+            pageMetadata[QStringLiteral("duplicateOf")] = m_duplicateOf;
+        }
+    }
+    if (nameNumber >= 0) {
+        pageMetadata[QStringLiteral("fileNumber")] = nameNumber;
+    }
+    if (!m_separatorActions.isEmpty()) {
+        m_documentPages++;
+        m_documentPending[m_document]++;
+        pageMetadata[QStringLiteral("document")] = m_document;
+        pageMetadata[QStringLiteral("pageInDocument")] = m_documentPages;
+    }
+    m_imageSaver->setPageMetadata(pageMetadata);
+
+    // The regions are given in mm on the bed, the scanned image starts at the top
+    // left corner of the selection. All regions are cut from this one scan.
+    // The items found in a valid quick preview are used instead of detecting them again.
+    QList<QRect> regions;
+    bool detectRegions = (m_scanRegions == QStringList(QStringLiteral("auto")));
+    QStringList manualRegions = m_scanRegions;
+    if (detectRegions && m_quickPreview.isValid(scanOpts) && !m_quickPreview.regions().isEmpty()) {
+        manualRegions = m_quickPreview.regions();
+        detectRegions = false;
+    }
+    if (!detectRegions) {
+        const qreal pixelsPerMm = m_dpi / 25.4;
+        const QPointF origin(scanOpts.value(QStringLiteral("tl-x")).toDouble(), scanOpts.value(QStringLiteral("tl-y")).toDouble());
+        foreach (const QString &region, manualRegions) {
+            QRectF mm;
+            if (parseScanRegion(region, mm)) {
+                mm.translate(-origin);
+                regions.append(QRect(qRound(mm.left() * pixelsPerMm), qRound(mm.top() * pixelsPerMm),
+                                     qRound(mm.width() * pixelsPerMm), qRound(mm.height() * pixelsPerMm)));
+            }
+        }
+    }
+    m_imageSaver->setScanRegions(regions, detectRegions);
+
+    // Save, 16 bit images that do not go to another 16 bit format are saved as PNG
+    if (enforceSavingAsPng16bit && !(KSaneImageSaver::suffixes16Bit().contains(suffix.toLower()) && suffix.toLower() != QLatin1String("png"))) {
+        m_imageSaver->save16BitPng(fileUrl, localName, m_data, m_width, m_height, m_bytesPerLine, m_dpi, m_format, fileFormat, quality);
     } else {
-        m_imageSaver->saveQImage(fileUrl, localName, m_data, m_width, m_height, m_bytesPerLine, (int) m_ksanew->currentDPI(), m_format, fileFormat, quality);
+        m_imageSaver->saveQImage(fileUrl, localName, m_data, m_width, m_height, m_bytesPerLine, m_dpi, m_format, fileFormat, quality);
+    }
+
+    // The text is recognized from the scanned data while the page is encoded.
+    // Pages cut into regions are not recognized, there is no file of the whole page.
+    if (m_ocr->isEnabled() && fileUrl.isLocalFile() && regions.isEmpty() && !detectRegions) {
+        int rotation = 0;
+        foreach (const ImagePipeline::Stage &stage, ImagePipeline::parse(m_pipeline)) {
+            if (stage.op == ImagePipeline::Rotate) {
+                rotation = (rotation + int(stage.args[0])) % 360;
+            }
+        }
+        m_ocr->recognize(localName, m_data, m_width, m_height, m_bytesPerLine, m_format, m_dpi, rotation);
     }
 }
 
-void Skanlite::imageSaved(const QUrl &fileUrl, const QString &localName, bool success)
+void Skanlite::imageSaved(const QUrl &fileUrl, const QString &localName, bool success, const QVariantMap &metadata)
 {
+    // the reserved name of a page cut into regions stays unused, as does the one of a failed page
+    if (metadata.contains(QStringLiteral("regionOf"))) {
+        FileNamer::release(QUrl(metadata.value(QStringLiteral("regionOf")).toString()).toLocalFile());
+    }
+    if (!success && fileUrl.isLocalFile()) {
+        FileNamer::release(localName);
+    }
+    // the text sidecars are written next to a saved image only
+    if (fileUrl.isLocalFile()) {
+        m_ocr->imageSaved(localName, success);
+    }
+
     if (!success) {
-        perrorMessageBox(i18n("Failed to save image"));
+        const QString error = metadata.value(QStringLiteral("error")).toString();
+        emit m_dbusInterface.imageSaveFailed(fileUrl.isLocalFile() ? localName : fileUrl.toString(), error);
+        if (!m_continuousActive) {
+            KMessageBox::sorry(nullptr, error.isEmpty() ? i18n("Failed to save image") : i18n("Failed to save image: %1", error));
+        }
+        else {
+            // a message box would stall the document feeder
+            qWarning() << "Failed to save image:" << error;
+        }
+        documentPageSaved(metadata, QString());
         return;
     }
 
@@ -561,39 +1181,80 @@ void Skanlite::imageSaved(const QUrl &fileUrl, const QString &localName, bool su
         tmpFile.open(QIODevice::ReadOnly);
         auto uploadJob = KIO::storedPut(&tmpFile, fileUrl, -1);
         KJobWidgets::setWindow(uploadJob, QApplication::activeWindow());
+        const qint64 uploadStart = Trace::isEnabled() ? Trace::now() : 0;
         bool ok = uploadJob->exec();
+        if (Trace::isEnabled()) {
+            Trace::complete("upload", "io", uploadStart, fileUrl.toString());
+        }
         tmpFile.close();
         tmpFile.remove();
         if (!ok) {
             KMessageBox::sorry(nullptr, i18n("Failed to upload image"));
         }
         else {
+            TraceSpan span("dbus emit", "dbus");
             emit m_dbusInterface.imageSaved(fileUrl.toString());
+            emit m_dbusInterface.imageSavedWithMetadata(fileUrl.toString(), metadata);
         }
+        documentPageSaved(metadata, ok ? fileUrl.toString() : QString());
     }
     else {
-        emit m_dbusInterface.imageSaved(localName);
-    }
+        {
+            TraceSpan span("dbus emit", "dbus");
+            emit m_dbusInterface.imageSaved(localName);
+            emit m_dbusInterface.imageSavedWithMetadata(localName, metadata);
+        }
 
-    // Save the file base name without number
-    QString baseName = QFileInfo(fileUrl.fileName()).completeBaseName();
-    while ((!baseName.isEmpty()) && (baseName[baseName.size() - 1].isNumber())) {
-        baseName.remove(baseName.size() - 1, 1);
+        // the regions of a page share its hash, it is indexed once
+        bool hashOk = false;
+        const quint64 hash = PageHashIndex::hashFromString(metadata.value(QStringLiteral("perceptualHash")).toString(), &hashOk);
+        if (hashOk && metadata.value(QStringLiteral("region"), 1).toInt() == 1) {
+            const QFileInfo info(localName);
+            m_pageHashIndex.add(info.absolutePath(), hash, info.fileName());
+        }
+        documentPageSaved(metadata, localName);
     }
-    m_saveLocation->u_imgPrefix->setText(baseName);
 
-    // Save the number
-    QString fileNumStr = QFileInfo(fileUrl.fileName()).completeBaseName();
-    fileNumStr.remove(baseName);
-    int fileNumber = fileNumStr.toInt();
-    if (fileNumber) {
+    // The next number, an image cut from a page counts as the page. A handed out
+    // name comes with its number. A name picked in the file dialog gives the
+    // prefix too: the current prefix if the name starts with it, otherwise all
+    // but the last digits (at most 4, the width of the number), so that a prefix
+    // may end in digits. Local names of a template with other fields have their
+    // own counters, the start number of the settings stays the first number of
+    // every name.
+    const QUrl pageUrl = metadata.contains(QStringLiteral("regionOf")) ?
+                         QUrl(metadata.value(QStringLiteral("regionOf")).toString()) : fileUrl;
+    const bool sharedNumber = !pageUrl.isLocalFile() || m_fileNamer.numbersOnly();
+    int fileNumber = 0;
+    if (metadata.contains(QStringLiteral("fileNumber"))) {
+        fileNumber = metadata.value(QStringLiteral("fileNumber")).toInt();
+    }
+    else if (sharedNumber) {
+        const QString baseName = QFileInfo(pageUrl.fileName()).completeBaseName();
+        const QString currentPrefix = m_saveLocation->u_imgPrefix->text();
+        int digits = 0;
+        while (digits < baseName.size() && baseName[baseName.size() - 1 - digits].isDigit()) {
+            digits++;
+        }
+        QString prefix;
+        if (!currentPrefix.isEmpty() && baseName.startsWith(currentPrefix) && baseName.size() - currentPrefix.size() <= digits) {
+            prefix = currentPrefix;
+        }
+        else {
+            prefix = baseName.left(baseName.size() - qMin(digits, 4));
+        }
+        fileNumber = baseName.mid(prefix.size()).toInt();
+        // changing the prefix resets the number
+        m_saveLocation->u_imgPrefix->setText(prefix);
+    }
+    if (fileNumber && sharedNumber) {
         m_saveLocation->u_numStartFrom->setValue(fileNumber + 1);
     }
 
     if (m_settingsUi.saveModeCB->currentIndex() == SaveModeManual) {
         // Save last used dir, prefix and suffix.
-        m_saveLocation->u_urlRequester->setUrl(KIO::upUrl(fileUrl));
-        m_saveLocation->u_imgFormat->setCurrentText(QFileInfo(fileUrl.fileName()).suffix());
+        m_saveLocation->u_urlRequester->setUrl(KIO::upUrl(pageUrl));
+        m_saveLocation->u_imgFormat->setCurrentText(QFileInfo(pageUrl.fileName()).suffix());
     }
 }
 
@@ -660,6 +1321,23 @@ void Skanlite::applyScannerOptions(const QMap <QString, QString> &opts)
     }
 }
 
+void Skanlite::loadColorProfile()
+{
+    // optional ICC profile of the scanner, "Color Profiles" maps the device name to a profile file
+    KConfigGroup profiles(KSharedConfig::openConfig(), "Color Profiles");
+    const QString path = profiles.readEntry(m_deviceName, QString());
+    m_colorProfile.clear();
+    if (path.isEmpty()) {
+        return;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not read the color profile" << path;
+        return;
+    }
+    m_colorProfile = file.readAll();
+}
+
 void Skanlite::loadScannerOptions()
 {
     KConfigGroup saving(KSharedConfig::openConfig(), "Image Saving");
@@ -674,11 +1352,196 @@ void Skanlite::loadScannerOptions()
     applyScannerOptions(opts);
 }
 
+void Skanlite::exportPage()
+{
+    // hand the raw page to local consumers before it is encoded and saved
+    if (!SharedPageExport::isSupported()) {
+        return;
+    }
+    int fd = SharedPageExport::createPageFd(m_data);
+    if (fd < 0) {
+        return;
+    }
+    emit m_dbusInterface.pageBufferReady(QDBusUnixFileDescriptor(fd), m_pageId, m_width, m_height, m_bytesPerLine,
+                                         PageAnalysis::formatName(m_format), m_dpi);
+    close(fd); // QDBusUnixFileDescriptor keeps its own copy
+}
+
+void Skanlite::setSharedMemoryExport(bool enabled)
+{
+    m_exportSharedMemory = enabled;
+    KConfigGroup saving(KSharedConfig::openConfig(), "Image Saving");
+    saving.writeEntry("ExportSharedMemory", enabled);
+    saving.sync();
+}
+
+void Skanlite::scanDone(int status, const QString &strStatus)
+{
+    if (m_quickPreviewActive) {
+        // the quick preview failed or was cancelled
+        m_quickPreviewActive = false;
+        applyScannerOptions(m_quickPreviewRestore);
+    }
+    if (m_previewActive) {
+        m_previewActive = false;
+        if (status != KSaneWidget::NoError) {
+            m_preview.clear();
+        }
+    }
+
+    if (!m_pendingApplyScanOpts.isEmpty()) {
+        applyScannerOptions(m_pendingApplyScanOpts);
+    }
+
+    // preview and cancelled scans do not deliver an image
+    const bool pageReceived = m_pageReceived;
+    m_pageReceived = false;
+    m_scanRunning = false;
+
+    if (!m_continuousActive) {
+        return;
+    }
+
+    QString reason;
+    if (m_continuousStopRequested) {
+        reason = QStringLiteral("stopped");
+    }
+    else if (status != KSaneWidget::NoError) {
+        reason = strStatus.isEmpty() ? QStringLiteral("error") : strStatus;
+    }
+    else if (!pageReceived) {
+        reason = QStringLiteral("cancelled");
+    }
+    else if (m_continuousMaxPages > 0 && m_continuousPages >= m_continuousMaxPages) {
+        reason = QStringLiteral("page limit");
+    }
+    else if (!paperPresent()) {
+        reason = QStringLiteral("feeder empty");
+    }
+
+    if (!reason.isEmpty()) {
+        finishContinuousScan(reason);
+        return;
+    }
+
+    // the image is saved in the background, the next page can be scanned right away,
+    // requestScan() waits for a free buffer
+    m_continuousTimer->start(m_continuousDelay);
+}
+
+void Skanlite::preview()
+{
+    // nothing on the bed changed, KSaneWidget still shows the last preview
+    QMap<QString, QString> opts;
+    m_ksanew->getOptVals(opts);
+    if (m_preview.isValid(opts)) {
+        emit m_dbusInterface.scanDone(KSaneWidget::NoError, QString());
+        return;
+    }
+    m_preview.store(opts);
+    m_previewActive = true;
+    m_ksanew->startPreviewScan();
+}
+
+void Skanlite::quickPreview(int dpi)
+{
+    QMap<QString, QString> opts;
+    m_ksanew->getOptVals(opts);
+    if (m_quickPreview.isValid(opts)) {
+        emit m_dbusInterface.quickPreviewReady(m_quickPreview.regions());
+        return;
+    }
+
+    if (dpi <= 0) {
+        dpi = m_settingsUi.setPreviewDPI->isChecked() ? m_settingsUi.previewDPI->currentText().toInt() : 75;
+    }
+
+    // the final scans get their resolution back when the preview is done
+    QMap<QString, QString> previewOpts;
+    m_quickPreviewRestore.clear();
+    static const QStringList resolutionOptions = { QLatin1String("resolution"), QLatin1String("x-resolution"),
+                                                   QLatin1String("y-resolution") };
+    foreach (const QString &option, resolutionOptions) {
+        if (opts.contains(option)) {
+            m_quickPreviewRestore[option] = opts[option];
+            previewOpts[option] = QString::number(dpi);
+        }
+    }
+    applyScannerOptions(previewOpts);
+    m_quickPreviewActive = true;
+    m_ksanew->scanFinal();
+}
+
+void Skanlite::invalidatePreview()
+{
+    m_preview.clear();
+    m_quickPreview.clear();
+}
+
+bool Skanlite::paperPresent()
+{
+    // Sensor options of the backends that report whether the feeder still has paper.
+    // When the backend has none of these the feeder status is reported by scanDone.
+    static const QStringList paperSensors = { QStringLiteral("page-loaded"), QStringLiteral("document-loaded"),
+                                              QStringLiteral("adf-loaded"), QStringLiteral("paper-in") };
+    foreach (const QString &sensor, paperSensors) {
+        QString value;
+        if (m_ksanew->getOptVal(sensor, value)) {
+            return value != QLatin1String("false") && value != QLatin1String("0");
+        }
+    }
+    return true;
+}
+
+void Skanlite::startContinuousScan(int delayMs, int maxPages)
+{
+    if (m_continuousActive) {
+        return;
+    }
+    m_continuousActive = true;
+    m_continuousStopRequested = false;
+    m_continuousPages = 0;
+    m_continuousDelay = delayMs < 0 ? m_settingsUi.continuousDelay->value() : delayMs;
+    m_continuousMaxPages = maxPages < 0 ? m_settingsUi.continuousMaxPages->value() : maxPages;
+    requestScan();
+}
+
+void Skanlite::stopContinuousScan()
+{
+    if (!m_continuousActive) {
+        return;
+    }
+    if (m_continuousTimer->isActive() || m_acquisitionWaiting) {
+        // waiting for the next page, no scan is running
+        finishContinuousScan(QStringLiteral("stopped"));
+        return;
+    }
+    // let the running scan finish, scanDone() ends the loop
+    m_continuousStopRequested = true;
+}
+
+void Skanlite::finishContinuousScan(const QString &reason)
+{
+    m_continuousTimer->stop();
+    m_continuousActive = false;
+    m_continuousStopRequested = false;
+    m_acquisitionWaiting = false;
+    // the last document of the batch has no separator after it, it ends after its queued pages
+    if (m_processingPages || !m_acquiredPages.isEmpty()) {
+        m_closeDocumentPending = true;
+    }
+    else {
+        closeDocument();
+    }
+    emit continuousScanFinished(m_continuousPages, reason);
+}
+
 void Skanlite::availableDevices(const QList<KSaneWidget::DeviceInfo> &deviceList)
 {
     for (int i = 0; i < deviceList.size(); ++i) {
         qDebug() << deviceList.at(i).name;
     }
+    m_deviceCache.update(deviceList);
 }
 
 void Skanlite::alertUser(int type, const QString &strStatus)
@@ -774,6 +1637,8 @@ void Skanlite::getDefaultScannerOptions()
 }
 
 static const QLatin1String defaultProfileGroup("Options For %1 - Profile %2"); // 1 - device, 2 - arg
+static const QLatin1String regionsProfileGroup("Regions For %1 - Profile %2");
+static const QLatin1String pipelineProfileGroup("Pipeline For %1 - Profile %2");
 
 void Skanlite::saveScannerOptionsToProfile(const QStringList &options, const QString &profile, bool ignoreSelection)
 {
@@ -784,6 +1649,12 @@ void Skanlite::saveScannerOptionsToProfile(const QStringList &options, const QSt
 }
 
 void Skanlite::switchToProfile(const QString &profile, bool ignoreSelection)
+{
+    switchScannerProfile(profile, ignoreSelection);
+    switchSaveProfile(profile);
+}
+
+void Skanlite::switchScannerProfile(const QString &profile, bool ignoreSelection)
 {
     QMap <QString, QString> opts;
     readScannerOptions(QString(defaultProfileGroup).arg(m_deviceName).arg(profile), opts);
@@ -796,6 +1667,19 @@ void Skanlite::switchToProfile(const QString &profile, bool ignoreSelection)
     applyScannerOptions(opts);
 }
 
+void Skanlite::switchSaveProfile(const QString &profile)
+{
+    m_saveProfile = profile;
+
+    // a profile without regions saves whole pages
+    KConfigGroup regions(KSharedConfig::openConfig(), QString(regionsProfileGroup).arg(m_deviceName).arg(profile));
+    setScanRegions(regions.readEntry("Regions", QStringList()));
+
+    // and one without a pipeline uses the one from the settings
+    KConfigGroup pipeline(KSharedConfig::openConfig(), QString(pipelineProfileGroup).arg(m_deviceName).arg(profile));
+    setPipeline(pipeline.readEntry("Stages", m_defaultPipeline));
+}
+
 void Skanlite::getDeviceName()
 {
     m_dbusInterface.setReply(QStringList(m_deviceName));
@@ -819,3 +1703,80 @@ void Skanlite::setSelection(const QStringList &options)
 { // here options contains selection related subset of options
     setScannerOptions(options, false);
 }
+
+void Skanlite::getScanRegions()
+{
+    m_dbusInterface.setReply(m_scanRegions);
+}
+
+void Skanlite::setScanRegions(const QStringList &regions)
+{
+    m_scanRegions = regions;
+
+    // one pass over the area that covers all regions
+    QRectF bounds;
+    foreach (const QString &region, regions) {
+        QRectF mm;
+        if (parseScanRegion(region, mm)) {
+            bounds |= mm;
+        }
+    }
+    if (!bounds.isEmpty()) {
+        QStringList selection;
+        selection << QStringLiteral("tl-x=%1").arg(bounds.left())
+                  << QStringLiteral("tl-y=%1").arg(bounds.top())
+                  << QStringLiteral("br-x=%1").arg(bounds.right())
+                  << QStringLiteral("br-y=%1").arg(bounds.bottom());
+        setSelection(selection);
+    }
+}
+
+void Skanlite::saveScanRegionsToProfile(const QStringList &regions, const QString &profile)
+{
+    KConfigGroup group(KSharedConfig::openConfig(), QString(regionsProfileGroup).arg(m_deviceName).arg(profile));
+    group.writeEntry("Regions", regions);
+    group.sync();
+}
+
+void Skanlite::getPipeline()
+{
+    m_dbusInterface.setReply(QStringList(m_pipeline));
+}
+
+void Skanlite::setPipeline(const QString &spec)
+{
+    QString error;
+    if (m_imageSaver->setPipeline(spec, &error)) {
+        m_pipeline = spec;
+    }
+    else {
+        qWarning() << "Invalid pipeline" << spec << error;
+    }
+    m_dbusInterface.setReply(QStringList(error));
+}
+
+void Skanlite::savePipelineToProfile(const QString &spec, const QString &profile)
+{
+    KConfigGroup group(KSharedConfig::openConfig(), QString(pipelineProfileGroup).arg(m_deviceName).arg(profile));
+    group.writeEntry("Stages", spec);
+    group.sync();
+}
+
+void Skanlite::getDeviceList()
+{
+    // answer from the cache and refresh it in the background, the discovery must not block the caller
+    m_dbusInterface.setReply(m_deviceCache.serialize());
+    m_ksanew->initGetDeviceList();
+}
+
+void Skanlite::setButtonAction(const QString &optionName, const QString &action)
+{
+    QString error;
+    m_buttonDispatcher->setAction(optionName, action, &error);
+    m_dbusInterface.setReply(QStringList(error));
+}
+
+void Skanlite::getButtonActions()
+{
+    m_dbusInterface.setReply(m_buttonDispatcher->actions());
+}
@@ -25,6 +25,8 @@
 #define Skanlite_h
 
 #include <QDir>
+#include <QFuture>
+#include <QQueue>
 #include <QDialog>
 
 #include <KSaneWidget>
@@ -32,9 +34,16 @@
 #include "ui_settings.h"
 #include "DBusInterface.h"
 #include "KSaneImageSaver.h"
+#include "DeviceCache.h"
+#include "ButtonDispatcher.h"
+#include "PageHashIndex.h"
+#include "PreviewCache.h"
+#include "FileNamer.h"
 
 class ShowImageDialog;
+class QTimer;
 class SaveLocation;
+class PageOcr;
 class KAboutData;
 
 using namespace KSaneIface;
@@ -54,18 +63,61 @@ private:
         SaveModeAskFirst = 1,
     };
 
+    // A scanned page waiting for processPages(), with the scan state it was made with
+    struct AcquiredPage {
+        QByteArray             data;
+        int                    width;
+        int                    height;
+        int                    bytesPerLine;
+        int                    format;
+        int                    dpi;
+        QMap<QString, QString> options;
+        int                    id;
+        int                    continuousPage = 0; // 0 when not scanning continuously
+        QString                separator;          // code of a separator sheet
+        QFuture<QString>       separatorCheck;     // Barcode::findCode39() of the page
+        bool                   separatorPending = false; // the check is not taken yet
+    };
+
     void readSettings();
     void doSaveImage(bool askFilename = true);
     void loadScannerOptions();
+    void loadColorProfile();
 
     void processSelectionOptions(QMap<QString, QString> &opts, bool ignoreSelection);
 
+    void exportPage();
+    QString localSaveDir() const;
+    bool checkDuplicate();
+    void convertRows();
+    bool paperPresent();
+    void finishContinuousScan(const QString &reason);
+    void checkSeparator(AcquiredPage &page);
+    void takeSeparatorChecks();
+    bool separatorCheckPending() const;
+    void applySeparator(const QString &code);
+    void resumeAcquisition();
+    // the scanner options and the saving settings (regions, pipeline) of a profile
+    void switchScannerProfile(const QString &profile, bool ignoreSelection);
+    void switchSaveProfile(const QString &profile);
+    void processPage(const AcquiredPage &page);
+    void documentPageSaved(const QVariantMap &metadata, const QString &fileName);
+
+Q_SIGNALS:
+    void continuousScanFinished(int pages, const QString &reason);
+
 private Q_SLOTS:
     void showSettingsDialog();
     void getDir();
     void imageReady(QByteArray &, int, int, int, int);
+    void processPages();
+    void separatorsChecked();
+    void requestScan();
+    void cancelScan();
+    void pageRejected();
     void saveImage();
-    void imageSaved(const QUrl &url, const QString &name, bool success);
+    void convertNextRows();
+    void imageSaved(const QUrl &url, const QString &name, bool success, const QVariantMap &metadata);
     void showAboutDialog();
     void saveWindowSize();
 
@@ -80,7 +132,18 @@ private Q_SLOTS:
 
     void showHelp();
 
+    void scanDone(int status, const QString &strStatus);
+    void preview();
+    void quickPreview(int dpi);
+    void invalidatePreview();
+    void startContinuousScan(int delayMs, int maxPages);
+    void stopContinuousScan();
+    void setSharedMemoryExport(bool enabled);
+    void closeDocument();
+
     // slots to communicate with D-Bus interface
+    void startTrace(const QString &fileName);
+    void stopTrace();
     void getScannerOptions();
     void setScannerOptions(const QStringList &options, bool ignoreSelection);
     void getDefaultScannerOptions();
@@ -89,6 +152,15 @@ private Q_SLOTS:
     void getDeviceName();
     void getSelection();
     void setSelection(const QStringList &options);
+    void getScanRegions();
+    void setScanRegions(const QStringList &regions);
+    void saveScanRegionsToProfile(const QStringList &regions, const QString &profile);
+    void getPipeline();
+    void setPipeline(const QString &spec);
+    void savePipelineToProfile(const QString &spec, const QString &profile);
+    void getDeviceList();
+    void getButtonActions();
+    void setButtonAction(const QString &optionName, const QString &action);
 
 protected:
     void closeEvent(QCloseEvent *event) Q_DECL_OVERRIDE;
@@ -97,11 +169,18 @@ private:
     KAboutData              *m_aboutData;
     KSaneWidget             *m_ksanew = nullptr;
     KSaneImageSaver         *m_imageSaver = nullptr;
+    PageOcr                 *m_ocr = nullptr;
+    ButtonDispatcher        *m_buttonDispatcher = nullptr;
     Ui::SkanliteSettings     m_settingsUi;
     QDialog                 *m_settingsDialog = nullptr;
     ShowImageDialog         *m_showImgDialog = nullptr;
     SaveLocation            *m_saveLocation = nullptr;
     QString                  m_deviceName;
+    QString                  m_saveProfile; // the last one switched to, in page order for separators
+    FileNamer                m_fileNamer;
+    qint64                   m_acquireStart = -1; // trace time of the first progress of the scan
+    QByteArray               m_colorProfile;
+    DeviceCache              m_deviceCache;
     QMap<QString, QString>   m_defaultScanOpts;
     QMap<QString, QString>   m_pendingApplyScanOpts;
     QImage                   m_img;
@@ -110,12 +189,63 @@ private:
     int                      m_height;
     int                      m_bytesPerLine;
     int                      m_format;
+    int                      m_dpi = 0;
+    QMap<QString, QString>   m_scanOptions;        // of the page being processed
+    int                      m_continuousPage = 0; // of the page being processed
+    int                      m_pageId = 0;         // of the page being processed
+    int                      m_lastPageId = 0;
+    int                      m_convertedRows = 0;
+    QTimer                  *m_convertTimer = nullptr;
 
     DBusInterface            m_dbusInterface;
     QStringList              m_filterList;
     QStringList              m_filter16BitList;
     QStringList              m_typeList;
     bool                     m_firstImage;
+
+    QTimer                  *m_continuousTimer = nullptr;
+    bool                     m_continuousActive = false;
+    bool                     m_continuousStopRequested = false;
+    int                      m_continuousDelay = 0;
+    int                      m_continuousMaxPages = 0;
+    int                      m_continuousPages = 0;
+    bool                     m_pageReceived = false;
+    bool                     m_scanRunning = false;   // from the first progress to scanDone
+    int                      m_scanRequestedAfter = 0; // m_lastPageId when Skanlite started the last scan
+    bool                     m_exportSharedMemory = false;
+
+    // scanned pages not processed yet, a dialog does not hold up the scanner
+    QQueue<AcquiredPage>     m_acquiredPages;
+    int                      m_acquisitionBuffers = 3;
+    bool                     m_processingPages = false;
+    bool                     m_acquisitionWaiting = false; // the next scan waits, see resumeAcquisition()
+    bool                     m_closeDocumentPending = false;
+
+    PageHashIndex            m_pageHashIndex;
+    QString                  m_duplicateCheck;
+    int                      m_duplicateMaxDistance = 6;
+    quint64                  m_pageHash = 0;
+    bool                     m_pageHashValid = false;
+    QString                  m_duplicateOf;
+
+    QStringList              m_scanRegions; // "tl-x,tl-y,br-x,br-y" in mm, or "auto"
+    QString                  m_pipeline;
+    QString                  m_defaultPipeline; // for profiles without a pipeline
+
+    PreviewCache             m_preview;      // the preview shown by KSaneWidget
+    PreviewCache             m_quickPreview; // with the image and the items found in it
+    bool                     m_previewActive = false;
+    bool                     m_quickPreviewActive = false;
+    QMap<QString, QString>   m_quickPreviewRestore; // resolution of the final scans
+
+    // barcode text -> comma separated actions, "split" and/or "profile:<name>"
+    QMap<QString, QString>   m_separatorActions;
+    double                   m_separatorSearchHeight = 0.25;
+    int                      m_document = 1;
+    int                      m_documentPages = 0;      // pages of the open document
+    QMap<int, int>           m_documentPending;        // pages of a document not saved yet
+    QMap<int, QStringList>   m_documentFiles;
+    QMap<QString, int>       m_regionsPending;         // images of a page cut into regions not saved yet
 };
 
 #endif